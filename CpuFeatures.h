@@ -0,0 +1,115 @@
+#pragma once
+
+// Runtime detection of the instruction sets the SIMD kernels can use
+
+#include <atomic>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MATRIX_SIMD_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#else
+#define MATRIX_SIMD_X86 0
+#endif
+
+namespace CpuFeatures
+{
+	// Ordered from the least to the most capable
+	enum class simd_level
+	{
+		scalar,
+		sse2,
+		avx2,
+		avx512
+	};
+
+	// Queries CPUID (and the OS-enabled register state) once per call.
+	// Prefer active_level() which caches the result.
+	inline simd_level detect()
+	{
+#if MATRIX_SIMD_X86 && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		const int max_leaf = info[0];
+
+		__cpuid(info, 1);
+		const bool sse2 = (info[3] & (1 << 26)) != 0;
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		if (!sse2) return simd_level::scalar;
+		if (!osxsave || !avx || max_leaf < 7) return simd_level::sse2;
+
+		// YMM (and ZMM) state has to be enabled by the OS
+		const auto xcr0 = _xgetbv(0);
+		if ((xcr0 & 0x6) != 0x6) return simd_level::sse2;
+
+		__cpuidex(info, 7, 0);
+		const bool avx2 = (info[1] & (1 << 5)) != 0;
+		const bool avx512f = (info[1] & (1 << 16)) != 0;
+		if (avx512f && (xcr0 & 0xe6) == 0xe6) return simd_level::avx512;
+		return avx2 ? simd_level::avx2 : simd_level::sse2;
+#elif MATRIX_SIMD_X86
+		// The GCC / Clang builtins also check the OS support
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) return simd_level::avx512;
+		if (__builtin_cpu_supports("avx2")) return simd_level::avx2;
+		if (__builtin_cpu_supports("sse2")) return simd_level::sse2;
+		return simd_level::scalar;
+#else
+		return simd_level::scalar;
+#endif
+	}
+
+	// Level the kernels dispatch on. Starts as the detected level.
+	inline std::atomic<simd_level>& level_storage()
+	{
+		static std::atomic<simd_level> level{ detect() };
+		return level;
+	}
+
+	inline simd_level active_level()
+	{
+		return level_storage().load(std::memory_order_relaxed);
+	}
+
+	// Caps the dispatch level, e.g. to compare kernels against each other.
+	// Levels above the detected one are never selected.
+	inline void set_max_level(const simd_level max_level)
+	{
+		level_storage().store(std::min(detect(), max_level));
+	}
+
+	// AVX-512 subsets beyond the foundation that single kernels use on top
+	// of the avx512 level
+	struct Avx512Subsets
+	{
+		bool bw = false;	// byte and word instructions
+		bool vnni = false;	// vpdpbusd, vpdpwssd
+	};
+
+	inline Avx512Subsets detect_avx512_subsets()
+	{
+		Avx512Subsets subsets;
+		if (detect() != simd_level::avx512) return subsets;
+#if MATRIX_SIMD_X86 && defined(_MSC_VER)
+		int info[4];
+		__cpuidex(info, 7, 0);
+		subsets.bw = (info[1] & (1 << 30)) != 0;
+		subsets.vnni = (info[2] & (1 << 11)) != 0;
+#elif MATRIX_SIMD_X86
+		subsets.bw = __builtin_cpu_supports("avx512bw");
+		subsets.vnni = __builtin_cpu_supports("avx512vnni");
+#endif
+		return subsets;
+	}
+
+	// Detected once, kernels still check active_level() first
+	inline const Avx512Subsets& avx512_subsets()
+	{
+		static const Avx512Subsets subsets = detect_avx512_subsets();
+		return subsets;
+	}
+}
@@ -0,0 +1,422 @@
+#pragma once
+
+// Matrix product kernels operating on raw row-major buffers
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include "MatrixScratch.h"
+#include "ThreadPool.h"
+#include "VectorOps.h"
+
+namespace GemmKernels
+{
+	// Cache blocking parameters of the packed kernel.
+	// MR x NR is the register tile computed by the micro-kernel, KC x NR
+	// panels of B stay in L1, MC x KC blocks of A in L2 and KC x NC panels
+	// of B in L3.
+	template<typename T>
+	struct BlockSizes;
+
+	template<>
+	struct BlockSizes<double>
+	{
+		static constexpr std::size_t MR = 4;
+		static constexpr std::size_t NR = 8;
+		static constexpr std::size_t KC = 256;
+		static constexpr std::size_t MC = 96;
+		static constexpr std::size_t NC = 2048;
+	};
+
+	template<>
+	struct BlockSizes<float>
+	{
+		static constexpr std::size_t MR = 4;
+		static constexpr std::size_t NR = 16;
+		static constexpr std::size_t KC = 384;
+		static constexpr std::size_t MC = 96;
+		static constexpr std::size_t NC = 4096;
+	};
+
+	template<>
+	struct BlockSizes<int>
+	{
+		static constexpr std::size_t MR = 4;
+		static constexpr std::size_t NR = 16;
+		static constexpr std::size_t KC = 384;
+		static constexpr std::size_t MC = 96;
+		static constexpr std::size_t NC = 4096;
+	};
+
+	// Types with a packed, register-tiled kernel. Everything else (Fraction
+	// and other class types) goes through the generic loop.
+	template<typename T>
+	inline constexpr bool has_packed_kernel =
+		std::is_same_v<T, double> ||
+		std::is_same_v<T, float> ||
+		std::is_same_v<T, int>;
+
+	// Below this many multiply-adds packing does not pay off
+	inline constexpr std::size_t packed_threshold = 32 * 32 * 32;
+
+	// Below this many multiply-adds products stay on the calling thread
+	inline constexpr std::size_t parallel_threshold = 96 * 96 * 96;
+
+	// Width of the output tiles the parallel product hands out. Tiles are
+	// MC rows high, so each task packs its own A blocks once.
+	inline constexpr std::size_t parallel_tile_cols = 256;
+
+	// Operand description. Element (i, j) is located at
+	// ptr[i * row_stride + j * col_stride].
+	template<typename T>
+	struct Operand
+	{
+		const T* ptr;
+		std::size_t row_stride;
+		std::size_t col_stride;
+
+		const T& operator()(const std::size_t i, const std::size_t j) const
+		{
+			return ptr[i * row_stride + j * col_stride];
+		}
+	};
+
+	// Generic i-k-j loop: C += alpha * A * B. Rows of B and C are walked
+	// contiguously, so this is also the sensible order for class types.
+	template<typename T>
+	void multiply_generic(
+		const std::size_t m, const std::size_t n, const std::size_t k,
+		const T alpha, const Operand<T>& a, const Operand<T>& b,
+		T* c, const std::size_t ldc)
+	{
+		const bool unit_alpha = alpha == T(1);
+		for (std::size_t i = 0; i < m; ++i)
+		{
+			T* c_row = c + i * ldc;
+			for (std::size_t p = 0; p < k; ++p)
+			{
+				const T a_ip = unit_alpha ? a(i, p) : alpha * a(i, p);
+				for (std::size_t j = 0; j < n; ++j)
+				{
+					c_row[j] += a_ip * b(p, j);
+				}
+			}
+		}
+	}
+
+	// Packs an mc x kc block of A into row panels of MR rows. Inside a panel
+	// the MR elements of one column are consecutive. Edge panels are zero
+	// padded so the micro-kernel never needs bounds checks.
+	template<typename T, std::size_t MR>
+	void pack_a(
+		const std::size_t mc, const std::size_t kc,
+		const Operand<T>& a, const std::size_t i0, const std::size_t p0,
+		T* packed)
+	{
+		for (std::size_t ir = 0; ir < mc; ir += MR)
+		{
+			const auto rows = std::min(MR, mc - ir);
+			for (std::size_t p = 0; p < kc; ++p)
+			{
+				std::size_t r = 0;
+				for (; r < rows; ++r)
+				{
+					packed[r] = a(i0 + ir + r, p0 + p);
+				}
+				for (; r < MR; ++r)
+				{
+					packed[r] = T(0);
+				}
+				packed += MR;
+			}
+		}
+	}
+
+	// Packs a kc x nc panel of B into column panels of NR columns, the
+	// counterpart of pack_a.
+	template<typename T, std::size_t NR>
+	void pack_b(
+		const std::size_t kc, const std::size_t nc,
+		const Operand<T>& b, const std::size_t p0, const std::size_t j0,
+		T* packed)
+	{
+		for (std::size_t jr = 0; jr < nc; jr += NR)
+		{
+			const auto cols = std::min(NR, nc - jr);
+			for (std::size_t p = 0; p < kc; ++p)
+			{
+				std::size_t c = 0;
+				if (b.col_stride == 1)
+				{
+					const T* src = b.ptr + (p0 + p) * b.row_stride + j0 + jr;
+					for (; c < cols; ++c)
+					{
+						packed[c] = src[c];
+					}
+				}
+				else
+				{
+					for (; c < cols; ++c)
+					{
+						packed[c] = b(p0 + p, j0 + jr + c);
+					}
+				}
+				for (; c < NR; ++c)
+				{
+					packed[c] = T(0);
+				}
+				packed += NR;
+			}
+		}
+	}
+
+	// Computes an MR x NR tile of C from packed panels. The accumulators
+	// are kept in a local array which the compiler maps to vector registers.
+	// Only the leading m x n part is added, scaled by alpha, to C (edge
+	// tiles).
+	template<typename T, std::size_t MR, std::size_t NR>
+	void micro_kernel(
+		const std::size_t kc, const T alpha, const T* a, const T* b,
+		T* c, const std::size_t ldc,
+		const std::size_t m, const std::size_t n)
+	{
+		T acc[MR][NR] = {};
+
+		for (std::size_t p = 0; p < kc; ++p)
+		{
+			for (std::size_t i = 0; i < MR; ++i)
+			{
+				const T a_ip = a[i];
+				for (std::size_t j = 0; j < NR; ++j)
+				{
+					acc[i][j] += a_ip * b[j];
+				}
+			}
+			a += MR;
+			b += NR;
+		}
+
+		if (alpha == T(1))
+		{
+			for (std::size_t i = 0; i < m; ++i)
+			{
+				for (std::size_t j = 0; j < n; ++j)
+				{
+					c[i * ldc + j] += acc[i][j];
+				}
+			}
+		}
+		else
+		{
+			for (std::size_t i = 0; i < m; ++i)
+			{
+				for (std::size_t j = 0; j < n; ++j)
+				{
+					c[i * ldc + j] += alpha * acc[i][j];
+				}
+			}
+		}
+	}
+
+	// Per-thread packing buffers. They only ever grow, so after the first
+	// product of a given size no further allocations happen.
+	template<typename T>
+	std::vector<T>& packing_buffer(const unsigned which)
+	{
+		thread_local std::vector<T> buffers[2];
+		return buffers[which];
+	}
+
+	// Packed, cache-blocked C += alpha * A * B (Goto-style loop nest).
+	template<typename T>
+	void multiply_packed(
+		const std::size_t m, const std::size_t n, const std::size_t k,
+		const T alpha, const Operand<T>& a, const Operand<T>& b,
+		T* c, const std::size_t ldc)
+	{
+		using sizes = BlockSizes<T>;
+		constexpr auto MR = sizes::MR;
+		constexpr auto NR = sizes::NR;
+
+		auto& a_buf = packing_buffer<T>(0);
+		auto& b_buf = packing_buffer<T>(1);
+
+		// Round the block sizes up to whole panels
+		const auto mc_max = std::min(sizes::MC, (m + MR - 1) / MR * MR);
+		const auto nc_max = std::min(sizes::NC, (n + NR - 1) / NR * NR);
+		const auto kc_max = std::min(sizes::KC, k);
+		a_buf.resize(std::max(a_buf.size(), mc_max * kc_max));
+		b_buf.resize(std::max(b_buf.size(), nc_max * kc_max));
+
+		for (std::size_t jc = 0; jc < n; jc += sizes::NC)
+		{
+			const auto nc = std::min(sizes::NC, n - jc);
+
+			for (std::size_t pc = 0; pc < k; pc += sizes::KC)
+			{
+				const auto kc = std::min(sizes::KC, k - pc);
+				pack_b<T, NR>(kc, nc, b, pc, jc, b_buf.data());
+
+				for (std::size_t ic = 0; ic < m; ic += sizes::MC)
+				{
+					const auto mc = std::min(sizes::MC, m - ic);
+					pack_a<T, MR>(mc, kc, a, ic, pc, a_buf.data());
+
+					for (std::size_t jr = 0; jr < nc; jr += NR)
+					{
+						const T* b_panel = b_buf.data() + jr * kc;
+						for (std::size_t ir = 0; ir < mc; ir += MR)
+						{
+							micro_kernel<T, MR, NR>(
+								kc, alpha, a_buf.data() + ir * kc, b_panel,
+								c + (ic + ir) * ldc + jc + jr, ldc,
+								std::min(MR, mc - ir), std::min(NR, nc - jr));
+						}
+					}
+				}
+			}
+		}
+	}
+
+	/*
+	* Parallel packed product. C is cut into 2D tiles and every tile is
+	* computed by one task with the same k blocking as multiply_packed, so
+	* the result is bitwise the same for every thread count.
+	* If there are fewer tiles than threads and the pool is not in
+	* deterministic mode, the inner dimension is split instead: the chunks
+	* go to separate buffers which are added to C in chunk order. That
+	* changes the floating point summation order.
+	*/
+	template<typename T>
+	void multiply_parallel(
+		const std::size_t m, const std::size_t n, const std::size_t k,
+		const T alpha, const Operand<T>& a, const Operand<T>& b,
+		T* c, const std::size_t ldc)
+	{
+		using sizes = BlockSizes<T>;
+		auto& pool = ThreadPool::instance();
+
+		const auto tile_m = sizes::MC;
+		const auto tile_n = parallel_tile_cols;
+		const auto tiles_m = (m + tile_m - 1) / tile_m;
+		const auto tiles_n = (n + tile_n - 1) / tile_n;
+		const auto k_blocks = (k + sizes::KC - 1) / sizes::KC;
+
+		if (tiles_m * tiles_n >= pool.thread_count() ||
+			pool.deterministic() || k_blocks < 2)
+		{
+			pool.parallel_for(tiles_m * tiles_n, [&](const std::size_t t)
+			{
+				const auto i0 = t / tiles_n * tile_m;
+				const auto j0 = t % tiles_n * tile_n;
+				multiply_packed(
+					std::min(tile_m, m - i0), std::min(tile_n, n - j0), k,
+					alpha,
+					Operand<T>{ a.ptr + i0 * a.row_stride,
+						a.row_stride, a.col_stride },
+					Operand<T>{ b.ptr + j0 * b.col_stride,
+						b.row_stride, b.col_stride },
+					c + i0 * ldc + j0, ldc);
+			});
+			return;
+		}
+
+		// Whole KC blocks per chunk. The first chunk accumulates straight
+		// into C, the others into zeroed m x n buffers.
+		const auto chunks = std::min(pool.thread_count(), k_blocks);
+		const auto chunk_k = (k_blocks + chunks - 1) / chunks * sizes::KC;
+		std::pmr::vector<T> partial((chunks - 1) * m * n, T(0),
+			MatrixScratch::resource());
+
+		pool.parallel_for(chunks, [&](const std::size_t p)
+		{
+			const auto p0 = p * chunk_k;
+			if (p0 >= k) return;
+			T* dst = p == 0 ? c : partial.data() + (p - 1) * m * n;
+			const auto ld = p == 0 ? ldc : n;
+			multiply_packed(m, n, std::min(chunk_k, k - p0), alpha,
+				Operand<T>{ a.ptr + p0 * a.col_stride,
+					a.row_stride, a.col_stride },
+				Operand<T>{ b.ptr + p0 * b.row_stride,
+					b.row_stride, b.col_stride },
+				dst, ld);
+		});
+
+		for (std::size_t p = 1; p < chunks; ++p)
+		{
+			const T* src = partial.data() + (p - 1) * m * n;
+			for (std::size_t i = 0; i < m; ++i)
+			{
+				VectorOperations::add(c + i * ldc, c + i * ldc, src + i * n, n);
+			}
+		}
+	}
+
+	// C += alpha * A * B where A is m x k, B is k x n and C is m x n.
+	// Dispatches to the packed kernel for arithmetic types it supports.
+	// Large products run on the thread pool.
+	template<typename T>
+	void multiply(
+		const std::size_t m, const std::size_t n, const std::size_t k,
+		const T alpha, const Operand<T>& a, const Operand<T>& b,
+		T* c, const std::size_t ldc)
+	{
+		const bool parallel = m * n * k >= parallel_threshold &&
+			ThreadPool::instance().thread_count() > 1;
+
+		if constexpr (has_packed_kernel<T>)
+		{
+			if (parallel)
+			{
+				multiply_parallel(m, n, k, alpha, a, b, c, ldc);
+				return;
+			}
+			if (m * n * k >= packed_threshold)
+			{
+				multiply_packed(m, n, k, alpha, a, b, c, ldc);
+				return;
+			}
+		}
+		else if (parallel)
+		{
+			// Rows of C are independent in the generic loop
+			VectorOperations::for_ranges(m, n * k,
+				[&](const std::size_t begin, const std::size_t end)
+				{
+					multiply_generic(end - begin, n, k, alpha,
+						Operand<T>{ a.ptr + begin * a.row_stride,
+							a.row_stride, a.col_stride },
+						b, c + begin * ldc, ldc);
+				});
+			return;
+		}
+		multiply_generic(m, n, k, alpha, a, b, c, ldc);
+	}
+
+	// C = alpha * A * B + beta * C. As in BLAS, beta == 0 overwrites C
+	// without reading it. Transposed operands are expressed through the
+	// Operand strides, the packing routines absorb them.
+	template<typename T>
+	void gemm(
+		const std::size_t m, const std::size_t n, const std::size_t k,
+		const T alpha, const Operand<T>& a, const Operand<T>& b,
+		const T beta, T* c, const std::size_t ldc)
+	{
+		if (beta != T(1))
+		{
+			const bool zero_beta = beta == T(0);
+			for (std::size_t i = 0; i < m; ++i)
+			{
+				T* c_row = c + i * ldc;
+				for (std::size_t j = 0; j < n; ++j)
+				{
+					c_row[j] = zero_beta ? T(0) : beta * c_row[j];
+				}
+			}
+		}
+		if (k == 0 || alpha == T(0)) return;
+
+		multiply(m, n, k, alpha, a, b, c, ldc);
+	}
+}
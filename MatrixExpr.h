@@ -0,0 +1,210 @@
+#pragma once
+
+// Lazy element-wise expressions.
+//
+// Matrix +, - and scalar products build a small expression tree instead of
+// a new Matrix. The tree is evaluated in a single pass when it is assigned
+// to or used to construct a Matrix, so chains like A + B - 2 * C allocate
+// only the result.
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include "VectorOps.h"
+
+template<typename T>
+class Matrix;
+
+template<typename T>
+class MatrixView;
+
+// Base class of every expression (and of Matrix and MatrixView). Derived
+// classes provide value_type, size(), coeff(i, j), eval_row(i, dst) and
+// aliases(dst), which tells whether the expression reads storage that an
+// element-wise write to dst could change first.
+template<typename E>
+class MatrixExpr
+{
+public:
+	const E& self() const noexcept
+	{
+		return static_cast<const E&>(*this);
+	}
+};
+
+namespace MatrixExprDetail
+{
+	template<typename E>
+	struct is_matrix : std::false_type {};
+
+	template<typename T>
+	struct is_matrix<Matrix<T>> : std::true_type {};
+
+	// Matrices are held by reference, intermediate nodes by value. The
+	// nodes are small and usually temporaries of the full expression.
+	template<typename E>
+	using storage_t = std::conditional_t<is_matrix<E>::value, const E&, E>;
+
+}
+
+// Element-wise binary operation, Op is one of the VectorOperations functors
+template<typename Op, typename L, typename R>
+class MatrixBinaryExpr : public MatrixExpr<MatrixBinaryExpr<Op, L, R>>
+{
+public:
+	using value_type = typename L::value_type;
+
+	static_assert(std::is_same_v<value_type, typename R::value_type>,
+		"operands of a matrix expression must have the same element type");
+
+	MatrixBinaryExpr(const L& lhs, const R& rhs) :
+		lhs_(lhs),
+		rhs_(rhs)
+	{
+		// Element-wise operations require equal sizes
+		assert(lhs.size() == rhs.size());
+	}
+
+	[[nodiscard]] std::pair<std::size_t, std::size_t> size() const noexcept
+	{
+		return lhs_.size();
+	}
+
+	value_type coeff(const std::size_t i, const std::size_t j) const
+	{
+		return Op()(lhs_.coeff(i, j), rhs_.coeff(i, j));
+	}
+
+	// Evaluates a row into dst. Rows of two matrices go straight to the
+	// SIMD kernels, deeper trees are fused element by element.
+	void eval_row(const std::size_t i, value_type* dst) const
+	{
+		constexpr bool leaves = MatrixExprDetail::is_matrix<L>::value &&
+			MatrixExprDetail::is_matrix<R>::value;
+
+		const auto cols = size().second;
+		if constexpr (leaves &&
+			std::is_same_v<Op, VectorOperations::Plus<value_type>>)
+		{
+			VectorOperations::add(dst, lhs_[i].begin(), rhs_[i].begin(), cols);
+		}
+		else if constexpr (leaves &&
+			std::is_same_v<Op, VectorOperations::Minus<value_type>>)
+		{
+			VectorOperations::subtract(
+				dst, lhs_[i].begin(), rhs_[i].begin(), cols);
+		}
+		else
+		{
+			for (std::size_t j = 0; j < cols; ++j)
+			{
+				dst[j] = coeff(i, j);
+			}
+		}
+	}
+
+	[[nodiscard]] bool aliases(const MatrixView<const value_type>& dst) const
+	{
+		return lhs_.aliases(dst) || rhs_.aliases(dst);
+	}
+
+private:
+	MatrixExprDetail::storage_t<L> lhs_;
+	MatrixExprDetail::storage_t<R> rhs_;
+};
+
+// Scalar product, scalar * expr and expr * scalar
+template<typename E>
+class MatrixScaledExpr : public MatrixExpr<MatrixScaledExpr<E>>
+{
+public:
+	using value_type = typename E::value_type;
+
+	MatrixScaledExpr(const value_type scalar, const E& expr) :
+		scalar_(scalar),
+		expr_(expr)
+	{}
+
+	[[nodiscard]] std::pair<std::size_t, std::size_t> size() const noexcept
+	{
+		return expr_.size();
+	}
+
+	value_type coeff(const std::size_t i, const std::size_t j) const
+	{
+		return scalar_ * expr_.coeff(i, j);
+	}
+
+	void eval_row(const std::size_t i, value_type* dst) const
+	{
+		const auto cols = size().second;
+		for (std::size_t j = 0; j < cols; ++j)
+		{
+			dst[j] = coeff(i, j);
+		}
+	}
+
+	[[nodiscard]] bool aliases(const MatrixView<const value_type>& dst) const
+	{
+		return expr_.aliases(dst);
+	}
+
+private:
+	value_type scalar_;
+	MatrixExprDetail::storage_t<E> expr_;
+};
+
+// Writes the expression into a row-major buffer with row stride ld. Large
+// expressions are evaluated in row blocks on the thread pool.
+template<typename E>
+void evaluate(const MatrixExpr<E>& expr, typename E::value_type* dst,
+	const std::size_t ld)
+{
+	const auto [rows, cols] = expr.self().size();
+	VectorOperations::for_ranges(rows, cols,
+		[&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				expr.self().eval_row(i, dst + i * ld);
+			}
+		});
+}
+
+
+// Operators. These only build the tree.
+
+template<typename L, typename R>
+MatrixBinaryExpr<VectorOperations::Plus<typename L::value_type>, L, R>
+operator+(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs)
+{
+	return { lhs.self(), rhs.self() };
+}
+
+template<typename L, typename R>
+MatrixBinaryExpr<VectorOperations::Minus<typename L::value_type>, L, R>
+operator-(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs)
+{
+	using T = typename L::value_type;
+	static_assert(std::is_signed<T>() || std::is_class<T>(),
+		"subtraction is not defined for unsigned integral type");
+
+	return { lhs.self(), rhs.self() };
+}
+
+// A non-const Matrix lvalue on the right-hand side still selects the
+// in-place Matrix::operator*(T, Matrix&).
+template<typename E>
+MatrixScaledExpr<E> operator*(
+	const typename E::value_type scalar, const MatrixExpr<E>& expr)
+{
+	return { scalar, expr.self() };
+}
+
+template<typename E>
+MatrixScaledExpr<E> operator*(
+	const MatrixExpr<E>& expr, const typename E::value_type scalar)
+{
+	return { scalar, expr.self() };
+}
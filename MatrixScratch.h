@@ -0,0 +1,34 @@
+#pragma once
+
+// Per-thread memory for the temporaries of the library algorithms
+
+#include <cstddef>
+#include <memory_resource>
+#include "Tracing.h"
+
+namespace MatrixScratch
+{
+	/*
+	* Pool the algorithms take their temporaries from (transpose buffers,
+	* the factorization behind determinant(), partial products, ...).
+	* Freed blocks stay in the pool, so after the first call of a given
+	* size no further heap allocations happen. Blocks larger than the
+	* pool's largest_required_pool_block go straight to the heap.
+	* The pool is not synchronized: memory taken from it has to be released
+	* on the same thread and must not outlive the call that took it.
+	* The pool draws from the heap directly, never from the default
+	* resource, which may change or go away during the thread's lifetime.
+	* With tracing compiled in, the heap allocations are counted.
+	*/
+	inline std::pmr::memory_resource* resource()
+	{
+#if MATRIX_TRACING
+		const auto heap = Tracing::heap_resource();
+#else
+		const auto heap = std::pmr::new_delete_resource();
+#endif
+		thread_local std::pmr::unsynchronized_pool_resource pool(
+			std::pmr::pool_options{ 0, std::size_t(1) << 24 }, heap);
+		return &pool;
+	}
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+// Non-owning strided views into matrices. Included by matrix.h after the
+// declarations of gemm and the triangular solves.
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include "MatrixExpr.h"
+#include "MatrixScratch.h"
+
+template<typename T>
+class MatrixView;
+
+namespace MatrixExprDetail
+{
+	// True when the address ranges of the two views intersect. Interleaved
+	// but disjoint views are reported as overlapping.
+	template<typename T>
+	bool spans_overlap(const MatrixView<const T>& a, const MatrixView<const T>& b)
+	{
+		if (a.size().first == 0 || a.size().second == 0 ||
+			b.size().first == 0 || b.size().second == 0)
+		{
+			return false;
+		}
+		const auto last = [](const MatrixView<const T>& v)
+		{
+			return v.data() + (v.size().first - 1) * v.row_stride() +
+				(v.size().second - 1) * v.col_stride();
+		};
+		const std::less<const T*> less;
+		return !less(last(a), b.data()) && !less(last(b), a.data());
+	}
+
+	// True when an element-wise write to dst can change what the source
+	// reads at another position. Identical layouts only read the element
+	// being written.
+	template<typename T>
+	bool overlaps(const MatrixView<const T>& src, const MatrixView<const T>& dst)
+	{
+		if (src.data() == dst.data() && src.size() == dst.size() &&
+			src.row_stride() == dst.row_stride() &&
+			src.col_stride() == dst.col_stride())
+		{
+			return false;
+		}
+
+		return spans_overlap(src, dst);
+	}
+}
+
+/*
+* Window into row-major storage, usually a block, row, column or diagonal
+* of a Matrix. Element (i, j) is located at
+* data()[i * row_stride() + j * col_stride()], so a transpose only swaps
+* the strides. MatrixView<T> can write through to the storage,
+* MatrixView<const T> is read-only.
+* Like std::span the view is a cheap handle: copies and assignments rebind
+* it, the elements are written with assign(), += and -=. A view must not
+* outlive its storage, resizing or transposing a Matrix invalidates it.
+*/
+template<typename T>
+class MatrixView : public MatrixExpr<MatrixView<T>>
+{
+public:
+	using value_type = std::remove_const_t<T>;
+
+	MatrixView(T* ptr, const std::size_t rows, const std::size_t cols,
+		const std::size_t row_stride, const std::size_t col_stride = 1) noexcept :
+		ptr_(ptr),
+		rows_(rows),
+		cols_(cols),
+		row_stride_(row_stride),
+		col_stride_(col_stride)
+	{}
+
+	// Whole Matrix. Implicit so that matrices can be passed wherever a
+	// view is expected.
+	MatrixView(Matrix<value_type>& matrix) noexcept :
+		MatrixView(matrix.data(), matrix.size().first, matrix.size().second,
+			matrix.stride())
+	{}
+
+	template <typename U = T, typename = std::enable_if_t<std::is_const_v<U>>>
+	MatrixView(const Matrix<value_type>& matrix) noexcept :
+		MatrixView(matrix.data(), matrix.size().first, matrix.size().second,
+			matrix.stride())
+	{}
+
+	// Mutable to read-only
+	template <typename U = T, typename = std::enable_if_t<std::is_const_v<U>>>
+	MatrixView(const MatrixView<value_type>& other) noexcept :
+		MatrixView(other.data(), other.size().first, other.size().second,
+			other.row_stride(), other.col_stride())
+	{}
+
+	[[nodiscard]] std::pair<std::size_t, std::size_t> size() const noexcept
+	{
+		return { rows_, cols_ };
+	}
+
+	// Element access. Like std::span, writing does not need a mutable view
+	// object, only a mutable element type.
+	T& operator()(const std::size_t i, const std::size_t j) const
+	{
+		assert(i < rows_ && j < cols_);
+		return ptr_[i * row_stride_ + j * col_stride_];
+	}
+
+	value_type coeff(const std::size_t i, const std::size_t j) const
+	{
+		return ptr_[i * row_stride_ + j * col_stride_];
+	}
+
+	T* data() const noexcept { return ptr_; }
+	[[nodiscard]] std::size_t row_stride() const noexcept { return row_stride_; }
+	[[nodiscard]] std::size_t col_stride() const noexcept { return col_stride_; }
+
+
+	// Slices, all of them are views into the same storage
+
+	// rows x cols block starting at (i0, j0)
+	[[nodiscard]] MatrixView submatrix(const std::size_t i0, const std::size_t j0,
+		const std::size_t rows, const std::size_t cols) const
+	{
+		assert(i0 + rows <= rows_ && j0 + cols <= cols_);
+		return { ptr_ + i0 * row_stride_ + j0 * col_stride_,
+			rows, cols, row_stride_, col_stride_ };
+	}
+
+	// 1 x cols
+	[[nodiscard]] MatrixView row(const std::size_t i) const
+	{
+		return submatrix(i, 0, 1, cols_);
+	}
+
+	// rows x 1
+	[[nodiscard]] MatrixView column(const std::size_t j) const
+	{
+		return submatrix(0, j, rows_, 1);
+	}
+
+	// Main diagonal as a column
+	[[nodiscard]] MatrixView diagonal() const noexcept
+	{
+		return { ptr_, std::min(rows_, cols_), 1,
+			row_stride_ + col_stride_, 1 };
+	}
+
+	// Lazy transpose, nothing is moved
+	[[nodiscard]] MatrixView transposed() const noexcept
+	{
+		return { ptr_, cols_, rows_, col_stride_, row_stride_ };
+	}
+
+	[[nodiscard]] MatrixView<const value_type> view() const noexcept
+	{
+		return { ptr_, rows_, cols_, row_stride_, col_stride_ };
+	}
+
+
+	// Element-wise writes. The right-hand side may overlap the view, it is
+	// then evaluated into a temporary first.
+
+	template <typename E>
+	const MatrixView& assign(const MatrixExpr<E>& expr) const
+	{
+		return update(expr, [](value_type& dst, const value_type& src)
+		{
+			dst = src;
+		});
+	}
+
+	template <typename E>
+	const MatrixView& operator+=(const MatrixExpr<E>& expr) const
+	{
+		return update(expr, [](value_type& dst, const value_type& src)
+		{
+			dst = dst + src;
+		});
+	}
+
+	template <typename E>
+	const MatrixView& operator-=(const MatrixExpr<E>& expr) const
+	{
+		static_assert(std::is_signed<value_type>() || std::is_class<value_type>(),
+			"subtraction is not defined for unsigned integral type");
+
+		return update(expr, [](value_type& dst, const value_type& src)
+		{
+			dst = dst - src;
+		});
+	}
+
+	const MatrixView& operator*=(const value_type scalar) const
+	{
+		for (std::size_t i = 0; i < rows_; ++i)
+		{
+			for (std::size_t j = 0; j < cols_; ++j)
+			{
+				(*this)(i, j) = (*this)(i, j) * scalar;
+			}
+		}
+		return *this;
+	}
+
+
+	// Factorizations work on a copy, as their results are new matrices
+
+	[[nodiscard]] auto lu() const
+	{
+		return Matrix<value_type>(*this).lu();
+	}
+
+	[[nodiscard]] auto determinant() const
+	{
+		return Matrix<value_type>(*this).determinant();
+	}
+
+
+	// Expression interface, see MatrixExpr.h
+
+	void eval_row(const std::size_t i, value_type* dst) const
+	{
+		const T* src = ptr_ + i * row_stride_;
+		if (col_stride_ == 1)
+		{
+			std::copy(src, src + cols_, dst);
+			return;
+		}
+		for (std::size_t j = 0; j < cols_; ++j)
+		{
+			dst[j] = src[j * col_stride_];
+		}
+	}
+
+	[[nodiscard]] bool aliases(const MatrixView<const value_type>& dst) const
+	{
+		return MatrixExprDetail::overlaps(view(), dst);
+	}
+
+private:
+	T* ptr_;
+	std::size_t rows_;
+	std::size_t cols_;
+	std::size_t row_stride_;
+	std::size_t col_stride_;
+
+	template <typename E, typename Op>
+	const MatrixView& update(const MatrixExpr<E>& rhs, Op op) const
+	{
+		static_assert(!std::is_const_v<T>, "the view is read-only");
+
+		const auto& expr = rhs.self();
+		assert(expr.size() == size());
+		if (expr.aliases(view()))
+		{
+			const Matrix<value_type> copy(expr, MatrixScratch::resource());
+			return update(copy, op);
+		}
+		for (std::size_t i = 0; i < rows_; ++i)
+		{
+			for (std::size_t j = 0; j < cols_; ++j)
+			{
+				op((*this)(i, j), expr.coeff(i, j));
+			}
+		}
+		return *this;
+	}
+};
+
+namespace MatrixExprDetail
+{
+	// Matrices and views provide view() and can be handed to gemm as
+	// they are
+	template<typename E, typename = void>
+	struct has_view : std::false_type {};
+
+	template<typename E>
+	struct has_view<E, std::void_t<decltype(std::declval<const E&>().view())>> :
+		std::true_type {};
+
+	// Operand of a product: views are used in place, other expressions
+	// are evaluated into a Matrix
+	template<typename E>
+	auto product_operand(const E& expr)
+	{
+		if constexpr (has_view<E>::value)
+		{
+			return expr.view();
+		}
+		else
+		{
+			return Matrix<typename E::value_type>(expr);
+		}
+	}
+}
+
+// Matrix products need materialized operands. Views and matrices are
+// passed to gemm in place, other expressions are evaluated first. Two
+// plain matrices pick the exact Matrix overload.
+template<typename L, typename R>
+Matrix<typename L::value_type> operator*(
+	const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs)
+{
+	using T = typename L::value_type;
+	static_assert(std::is_same_v<T, typename R::value_type>,
+		"operands of a matrix product must have the same element type");
+
+	const auto a = MatrixExprDetail::product_operand(lhs.self());
+	const auto b = MatrixExprDetail::product_operand(rhs.self());
+	assert(a.size().second == b.size().first);
+
+	Matrix<T> result(a.size().first, b.size().second);
+	gemm(T(1), a, op_type::none, b, op_type::none, T(0), result);
+	return result;
+}
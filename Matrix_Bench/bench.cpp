@@ -0,0 +1,420 @@
+// Google benchmark file
+//
+// Every kernel is swept over sizes and the element types int, float,
+// double and Fraction. Besides the time, the benchmarks report
+//   FLOP/s   arithmetic operations per second, where they are meaningful
+//   bytes/s  compulsory memory traffic: every operand read and every
+//            result written once
+// and, on Linux, hardware counters per element of the operands (see
+// perf_counters.h): cycles, instructions, L1D, LLC and dTLB misses,
+// branch misses and the instructions per cycle.
+// JSON output: matrix_bench --benchmark_out=bench.json --benchmark_out_format=json
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+#include "../matrix.h"
+#include "../matrix_text.h"
+#include "../matrix_batch.h"
+#include "../matrix_quantized.h"
+#include "perf_counters.h"
+
+namespace MatrixBenchmarks
+{
+	// Fraction arithmetic is orders of magnitude slower, its sweeps stop
+	// earlier
+	template<typename T>
+	constexpr bool is_exact = std::is_class_v<T>;
+
+	// O(n^3) kernels: products, power, LU
+	template<typename T>
+	void cubic_sizes(benchmark::internal::Benchmark* bench)
+	{
+		bench->RangeMultiplier(2)->Range(is_exact<T> ? 8 : 32, is_exact<T> ? 64 : 512);
+	}
+
+	// O(n^2) kernels: element-wise operations, transpose, fill
+	template<typename T>
+	void square_sizes(benchmark::internal::Benchmark* bench)
+	{
+		bench->RangeMultiplier(4)->Range(is_exact<T> ? 16 : 64, is_exact<T> ? 256 : 2048);
+	}
+
+	// n x n and n x 2n, the rectangular case uses another in-place kernel
+	template<typename T>
+	void transpose_sizes(benchmark::internal::Benchmark* bench)
+	{
+		for (std::int64_t n = is_exact<T> ? 16 : 64; n <= (is_exact<T> ? 256 : 2048); n *= 4)
+		{
+			bench->Args({ n, n });
+			bench->Args({ n, 2 * n });
+		}
+	}
+
+	// Large products: n x n with the Strassen crossovers, 0 = classical
+	template<typename T>
+	void strassen_sizes(benchmark::internal::Benchmark* bench)
+	{
+		for (std::int64_t n = 512; n <= 2048; n *= 2)
+		{
+			for (std::int64_t crossover : { 0, 128, 256, 512 })
+			{
+				bench->Args({ n, crossover });
+			}
+		}
+	}
+
+	// Many small matrices: n x n, a fixed count of them
+	template<typename T>
+	void batch_sizes(benchmark::internal::Benchmark* bench)
+	{
+		for (std::int64_t n = 2; n <= 16; n *= 2)
+		{
+			bench->Args({ n, 4096 });
+		}
+	}
+
+	// Every fill_type for every size
+	template<typename T>
+	void fill_sizes(benchmark::internal::Benchmark* bench)
+	{
+		for (std::int64_t n = is_exact<T> ? 16 : 64; n <= (is_exact<T> ? 256 : 2048); n *= 4)
+		{
+			for (const auto fill : { fill_type::zeros, fill_type::ones,
+				fill_type::identity, fill_type::randi, fill_type::rand })
+			{
+				bench->Args({ n, static_cast<std::int64_t>(fill) });
+			}
+		}
+	}
+
+	// Work per iteration, reported as rates
+	void report(benchmark::State& state, const double flops, const double bytes)
+	{
+		if (flops > 0)
+		{
+			state.counters["FLOP/s"] = benchmark::Counter(flops,
+				benchmark::Counter::kIsIterationInvariantRate);
+		}
+		state.SetBytesProcessed(static_cast<std::int64_t>(bytes) * state.iterations());
+	}
+
+	// Matrix products done by Matrix::power, see its repeated squaring
+	constexpr int power_products(int exponent)
+	{
+		int products = 0;
+		for (bool first = true; exponent > 0; exponent >>= 1)
+		{
+			if (exponent & 1)
+			{
+				if (!first) ++products;
+				first = false;
+			}
+			if (exponent > 1) ++products;
+		}
+		return products;
+	}
+
+	template<typename T>
+	void BM_Multiply(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const Matrix<T> A(n, n, fill_type::randi);
+		const Matrix<T> B(n, n, fill_type::randi);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(A * B);
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, 2.0 * n * n * n, 3.0 * n * n * sizeof(T));
+	}
+
+	template<typename T>
+	void BM_Add(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const Matrix<T> A(n, n, fill_type::randi);
+		const Matrix<T> B(n, n, fill_type::randi);
+		Matrix<T> C(n, n);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			C = A + B;
+			benchmark::DoNotOptimize(C.data());
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, 1.0 * n * n, 3.0 * n * n * sizeof(T));
+	}
+
+	template<typename T>
+	void BM_Subtract(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const Matrix<T> A(n, n, fill_type::randi);
+		const Matrix<T> B(n, n, fill_type::randi);
+		Matrix<T> C(n, n);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			C = A - B;
+			benchmark::DoNotOptimize(C.data());
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, 1.0 * n * n, 3.0 * n * n * sizeof(T));
+	}
+
+	template<typename T>
+	void BM_Transpose(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const auto m = static_cast<std::size_t>(state.range(1));
+		Matrix<T> A(n, m, fill_type::randi);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			A.transpose();
+			benchmark::ClobberMemory();
+		}
+		perf.report(state, 1.0 * n * m);
+		report(state, 0, 2.0 * n * m * sizeof(T));
+	}
+
+	template<typename T>
+	void BM_Power(benchmark::State& state)
+	{
+		constexpr int exponent = 15;
+
+		// Cyclic shift, its powers are permutations, so no type overflows
+		const auto n = static_cast<std::size_t>(state.range(0));
+		Matrix<T> A(n, n);
+		for (std::size_t i = 0; i < n; ++i) A[i][(i + 1) % n] = T(1);
+
+		Matrix<T> result(n, n);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			A.power(exponent, result);
+			benchmark::DoNotOptimize(result.data());
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, power_products(exponent) * 2.0 * n * n * n,
+			2.0 * n * n * sizeof(T));
+	}
+
+	template<typename T>
+	void BM_Fill(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const auto fill = static_cast<fill_type>(state.range(1));
+		constexpr const char* names[] = { "zeros", "ones", "identity", "randi", "rand" };
+		state.SetLabel(names[state.range(1)]);
+
+		Matrix<T> A(n, n);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			A.fill(fill);
+			benchmark::DoNotOptimize(A.data());
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, 0, 1.0 * n * n * sizeof(T));
+	}
+
+	template<typename T>
+	void BM_LU(benchmark::State& state)
+	{
+		using LU_T = typename Matrix<T>::LU_T;
+
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const Matrix<T> A(n, n, fill_type::randi);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(A.lu());
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, 2.0 / 3.0 * n * n * n, 3.0 * n * n * sizeof(LU_T));
+	}
+
+	template<typename T>
+	void BM_Trace(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		Matrix<T> A(n, n, fill_type::randi);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(A.trace());
+		}
+		perf.report(state, 1.0 * n);
+		report(state, 1.0 * n, 1.0 * n * sizeof(T));
+	}
+
+	// FLOP/s are those of the classical product, so the crossovers compare
+	// by time
+	template<typename T>
+	void BM_Strassen(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const Matrix<T> A(n, n, fill_type::randi);
+		const Matrix<T> B(n, n, fill_type::randi);
+		StrassenKernels::set_crossover(static_cast<std::size_t>(state.range(1)));
+		StrassenKernels::reserve<T>(n, n, n);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(A * B);
+		}
+		perf.report(state, 1.0 * n * n);
+		StrassenKernels::set_crossover(0);
+		report(state, 2.0 * n * n * n, 3.0 * n * n * sizeof(T));
+	}
+
+	// int8 and int16 products with int32 sums, compare with BM_Multiply<int>
+	template<typename T>
+	void BM_Quantized(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		Matrix<T> A(n, n), B(n, n);
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			for (std::size_t j = 0; j < n; ++j)
+			{
+				A[i][j] = static_cast<T>((i * 31 + j * 7) % 255);
+				B[i][j] = static_cast<T>((i * 13 + j * 17) % 255);
+			}
+		}
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(MatrixQuantized::multiply(A, B));
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, 2.0 * n * n * n, (2.0 * sizeof(T) + 4.0) * n * n);
+	}
+
+	// Products of count pairs of small matrices as one MatrixBatch
+	template<typename T>
+	void BM_BatchMultiply(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const auto count = static_cast<std::size_t>(state.range(1));
+		std::vector<Matrix<T>> a, b;
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			a.emplace_back(n, n, fill_type::randi);
+			b.emplace_back(n, n, fill_type::randi);
+		}
+		const MatrixBatch<T> A(a), B(b);
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(A * B);
+		}
+		perf.report(state, 1.0 * count * n * n);
+		report(state, 2.0 * count * n * n * n, 3.0 * count * n * n * sizeof(T));
+	}
+
+	// The same products one Matrix at a time, the baseline of BM_BatchMultiply
+	template<typename T>
+	void BM_LoopMultiply(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const auto count = static_cast<std::size_t>(state.range(1));
+		std::vector<Matrix<T>> a, b;
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			a.emplace_back(n, n, fill_type::randi);
+			b.emplace_back(n, n, fill_type::randi);
+		}
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				benchmark::DoNotOptimize(a[i] * b[i]);
+			}
+		}
+		perf.report(state, 1.0 * count * n * n);
+		report(state, 2.0 * count * n * n * n, 3.0 * count * n * n * sizeof(T));
+	}
+
+	// Bytes are the characters written
+	template<typename T>
+	void BM_Output(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		const Matrix<T> A(n, n, fill_type::randi);
+		std::ostringstream os;
+		std::size_t written = 0;
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			os.str({});
+			os << A;
+			written = static_cast<std::size_t>(os.tellp());
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, 0, static_cast<double>(written));
+	}
+
+	// Bytes are the characters read
+	template<typename T>
+	void BM_Parse(benchmark::State& state)
+	{
+		const auto n = static_cast<std::size_t>(state.range(0));
+		std::ostringstream os;
+		MatrixText::write(os, Matrix<T>(n, n, fill_type::randi), MatrixText::csv);
+		const auto text = os.str();
+		PerfCounters perf;
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(MatrixText::parse<T>(text, ','));
+		}
+		perf.report(state, 1.0 * n * n);
+		report(state, 0, static_cast<double>(text.size()));
+	}
+}
+
+// Registers bench for all element types with the sweep sizes<T>
+#define MATRIX_BENCHMARK(bench, sizes) \
+	BENCHMARK_TEMPLATE(bench, int)->Apply(sizes<int>); \
+	BENCHMARK_TEMPLATE(bench, float)->Apply(sizes<float>); \
+	BENCHMARK_TEMPLATE(bench, double)->Apply(sizes<double>); \
+	BENCHMARK_TEMPLATE(bench, Fraction)->Apply(sizes<Fraction>)
+
+namespace MatrixBenchmarks
+{
+	MATRIX_BENCHMARK(BM_Multiply, cubic_sizes);
+	MATRIX_BENCHMARK(BM_Add, square_sizes);
+	MATRIX_BENCHMARK(BM_Subtract, square_sizes);
+	MATRIX_BENCHMARK(BM_Transpose, transpose_sizes);
+	MATRIX_BENCHMARK(BM_Power, cubic_sizes);
+	MATRIX_BENCHMARK(BM_Fill, fill_sizes);
+	MATRIX_BENCHMARK(BM_LU, cubic_sizes);
+	MATRIX_BENCHMARK(BM_Trace, square_sizes);
+	MATRIX_BENCHMARK(BM_Output, square_sizes);
+
+	// Fraction has no parser
+	BENCHMARK_TEMPLATE(BM_Parse, int)->Apply(square_sizes<int>);
+	BENCHMARK_TEMPLATE(BM_Parse, float)->Apply(square_sizes<float>);
+	BENCHMARK_TEMPLATE(BM_Parse, double)->Apply(square_sizes<double>);
+
+	BENCHMARK_TEMPLATE(BM_Strassen, int)->Apply(strassen_sizes<int>);
+	BENCHMARK_TEMPLATE(BM_Strassen, float)->Apply(strassen_sizes<float>);
+	BENCHMARK_TEMPLATE(BM_Strassen, double)->Apply(strassen_sizes<double>);
+
+	BENCHMARK_TEMPLATE(BM_Quantized, std::int8_t)->Apply(cubic_sizes<std::int8_t>);
+	BENCHMARK_TEMPLATE(BM_Quantized, std::int16_t)->Apply(cubic_sizes<std::int16_t>);
+
+	// The batches only pay off for machine types
+	BENCHMARK_TEMPLATE(BM_BatchMultiply, float)->Apply(batch_sizes<float>);
+	BENCHMARK_TEMPLATE(BM_BatchMultiply, double)->Apply(batch_sizes<double>);
+	BENCHMARK_TEMPLATE(BM_LoopMultiply, float)->Apply(batch_sizes<float>);
+	BENCHMARK_TEMPLATE(BM_LoopMultiply, double)->Apply(batch_sizes<double>);
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,170 @@
+#pragma once
+
+// Hardware performance counters of the benchmarked kernels, Linux only
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <vector>
+#include "../ThreadPool.h"
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+namespace MatrixBenchmarks
+{
+	/*
+	* Counts cycles, instructions, L1D, last level cache and dTLB read
+	* misses and branch misses from construction to report(), on every
+	* thread of the process: the kernels run on the library thread pool,
+	* which is started first. Only user space is counted, which the default
+	* perf_event_paranoid setting of 2 allows. Events the CPU or the kernel
+	* don't provide, in many virtual machines all of them, are left out of
+	* the report, and so are all of them on other systems or when the
+	* environment variable MATRIX_BENCH_PERF is 0.
+	*/
+	class PerfCounters
+	{
+	public:
+		enum event { cycles, instructions, l1d_misses, llc_misses, dtlb_misses,
+			branch_misses, event_count };
+
+#if defined(__linux__)
+		PerfCounters()
+		{
+			const auto setting = std::getenv("MATRIX_BENCH_PERF");
+			if (setting != nullptr && std::strcmp(setting, "0") == 0) return;
+
+			(void)ThreadPool::instance();
+			const auto threads = thread_ids();
+			for (int e = 0; e < event_count; ++e)
+			{
+				for (const auto tid : threads)
+				{
+					// Threads may have exited since they were listed, an event
+					// missing on the others is left out
+					const auto fd = open(static_cast<event>(e), tid);
+					if (fd >= 0)
+					{
+						fds_[e].push_back(fd);
+					}
+					else if (errno != ESRCH)
+					{
+						for (const auto opened : fds_[e]) ::close(opened);
+						fds_[e].clear();
+						break;
+					}
+				}
+			}
+			for (const auto& fds : fds_)
+			{
+				for (const auto fd : fds) ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+
+		~PerfCounters()
+		{
+			for (const auto& fds : fds_)
+			{
+				for (const auto fd : fds) ::close(fd);
+			}
+		}
+
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+
+		/*
+		* Stops counting and adds the counts per iteration and element to the
+		* counters of state, with the instructions per cycle
+		*/
+		void report(benchmark::State& state, const double elements)
+		{
+			double totals[event_count] = {};
+			bool counted[event_count] = {};
+			for (int e = 0; e < event_count; ++e)
+			{
+				for (const auto fd : fds_[e]) ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+				for (const auto fd : fds_[e])
+				{
+					// Scaled up when the events were multiplexed
+					std::uint64_t values[3] = {};
+					if (::read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0)
+					{
+						continue;
+					}
+					totals[e] += static_cast<double>(values[0]) *
+						static_cast<double>(values[1]) / static_cast<double>(values[2]);
+					counted[e] = true;
+				}
+			}
+
+			constexpr const char* names[] = { "cycles/elem", "instr/elem", "L1D miss/elem",
+				"LLC miss/elem", "dTLB miss/elem", "branch miss/elem" };
+			for (int e = 0; e < event_count; ++e)
+			{
+				if (!counted[e]) continue;
+				state.counters[names[e]] = benchmark::Counter(totals[e] / elements,
+					benchmark::Counter::kAvgIterations);
+			}
+			if (counted[cycles] && counted[instructions] && totals[cycles] > 0)
+			{
+				state.counters["IPC"] = totals[instructions] / totals[cycles];
+			}
+		}
+
+	private:
+		std::vector<int> fds_[event_count];
+
+		static std::vector<pid_t> thread_ids()
+		{
+			std::vector<pid_t> result;
+			if (DIR* dir = ::opendir("/proc/self/task"))
+			{
+				while (const dirent* entry = ::readdir(dir))
+				{
+					if (entry->d_name[0] != '.') result.push_back(std::atoi(entry->d_name));
+				}
+				::closedir(dir);
+			}
+			return result;
+		}
+
+		static int open(const event e, const pid_t tid)
+		{
+			const auto cache = [](const std::uint64_t cache_id)
+			{
+				return cache_id | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+					(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			};
+			const std::uint64_t configs[][2] = {
+				{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+				{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+				{ PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D) },
+				{ PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL) },
+				{ PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_DTLB) },
+				{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+			};
+
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = static_cast<std::uint32_t>(configs[e][0]);
+			attr.config = configs[e][1];
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			return static_cast<int>(::syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0));
+		}
+#else
+		void report(benchmark::State&, const double) {}
+#endif
+	};
+}
@@ -7,4 +7,5 @@
 
 #include "gtest/gtest.h"
 #include <algorithm>
+#include <filesystem>
 #include <iostream>
\ No newline at end of file
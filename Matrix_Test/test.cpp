@@ -2,6 +2,13 @@
 
 #include "pch.h"
 #include "../matrix.h"
+#include "../fixed_matrix.h"
+#include "../sparse_matrix.h"
+#include "../matrix_file.h"
+#include "../out_of_core.h"
+#include "../matrix_text.h"
+#include "../matrix_batch.h"
+#include "../matrix_quantized.h"
 
 // TODO: Test vectors
 
@@ -11,6 +18,10 @@ namespace MatrixTests
 	inline const std::size_t N_SIZE = 3;
 	inline const std::size_t M_SIZE = 5;
 
+	// Death test pattern, matches the assert messages of MSVC
+	// ("Assertion failed: ...") and glibc ("...: Assertion `...' failed.")
+	inline const char* const ASSERTION_FAILED = "Assertion.*failed";
+
 	// initializer-list for test case (5x5 matrix I)
 	inline const std::initializer_list<std::initializer_list<int>>
 		I_LIST = {
@@ -49,7 +60,7 @@ namespace MatrixTests
 	{
 		// Death tests with erroneous initLists;
 		ASSERT_DEATH(Matrix<int> bad_init({{1, 2},{1, 2, 3}}),
-			"^Assertion failed");
+			ASSERTION_FAILED);
 		
 		ASSERT_DEATH(
 			Matrix<int> bad_init({
@@ -57,7 +68,7 @@ namespace MatrixTests
 				{1, 2},
 				{1, 2, 3},
 				{1, 2, 3, 4}
-			}), "^Assertion failed"
+			}), ASSERTION_FAILED
 		);
 	}
 	
@@ -77,7 +88,26 @@ namespace MatrixTests
 		ASSERT_EQ(sq_id, sq_id_pw4);
 		ASSERT_EQ(sq_of_pw0, sq_id);
 
-		ASSERT_DEATH(sq_id.power(-4), "^Assertion failed");
+		ASSERT_DEATH(sq_id.power(-4), ASSERTION_FAILED);
+
+		// Repeated squaring against successive products
+		const Matrix<int> A({ { 1, 1, 0 }, { 1, 0, 1 }, { 0, 1, -1 } });
+		Matrix<int> expected(3, fill_type::identity);
+		Matrix<int> out(1);
+		for (int e = 0; e <= 13; ++e)
+		{
+			ASSERT_EQ(A.power(e), expected);
+			ASSERT_EQ(A.power(e, out), expected);
+			expected *= A;
+		}
+
+		// Diagonal fast path and result == *this
+		Matrix<int> D({ { 2, 0, 0 }, { 0, -1, 0 }, { 0, 0, 3 } });
+		D.power(5, D);
+		ASSERT_EQ(D, Matrix<int>({ { 32, 0, 0 }, { 0, -1, 0 }, { 0, 0, 243 } }));
+		Matrix<int> B = A;
+		B.power(6, B);
+		ASSERT_EQ(B, A.power(3) * A.power(3));
 	}
 
 	TEST_F(int_typed, TraceTest)
@@ -90,6 +120,114 @@ namespace MatrixTests
 		ASSERT_EQ(sq_id.trace(), static_cast<int>(sq_id.size().first));
 	}
 	
+	// Detects whether lhs * rhs compiles
+	template <typename L, typename R, typename = void>
+	struct can_multiply : std::false_type {};
+
+	template <typename L, typename R>
+	struct can_multiply<L, R, std::void_t<
+		decltype(std::declval<L>() * std::declval<R>())>> : std::true_type {};
+
+	TEST(FixedMatrixTest, FixedMatrixTest)
+	{
+		using mat2 = FixedMatrix<int, 2>;
+
+		// Everything but the random fills works at compile time
+		constexpr mat2 fib({ { 1, 1 }, { 1, 0 } });
+		static_assert(fib.power(10) == mat2({ { 89, 55 }, { 55, 34 } }));
+		static_assert(fib.power(0) == mat2(fill_type::identity));
+		static_assert((fib + fib - fib).trace() == 1);
+		static_assert(2 * fib == fib + fib);
+
+		constexpr FixedMatrix<int, 2, 3> A({ { 1, 2, 3 }, { 4, 5, 6 } });
+		static_assert(A.transpose()(2, 1) == 6);
+		static_assert((A * A.transpose()) == mat2({ { 14, 32 }, { 32, 77 } }));
+
+		// Mismatched sizes don't compile
+		static_assert(can_multiply<FixedMatrix<int, 2, 3>,
+			FixedMatrix<int, 3, 4>>::value);
+		static_assert(!can_multiply<FixedMatrix<int, 2, 3>,
+			FixedMatrix<int, 2, 3>>::value);
+
+		// Conversions to and from Matrix agree with the Matrix operations
+		Matrix<int> dynamic = A;
+		ASSERT_EQ((FixedMatrix<int, 2, 3>(dynamic)), A);
+		Matrix<int> dyn_transposed = dynamic;
+		dyn_transposed.transpose();
+		Matrix<int> dyn_product = dynamic * dyn_transposed;
+		ASSERT_EQ(dyn_product, Matrix<int>(A * A.transpose()));
+
+		// Zero leading pivot needs a row swap
+		constexpr FixedMatrix<double, 3> B(
+			{ { 0, 2, 1 }, { 4, 1, 3 }, { 2, 5, 7 } });
+		constexpr auto lu = B.lu();
+		static_assert(lu.P[0] == 1);
+		const auto [L, U, P] = lu;
+		ASSERT_TRUE(Matrix<double>(U).is_upper_triangular());
+		ASSERT_EQ(Matrix<double>(L * U),
+			Matrix<double>(B).permute_rows({ P.begin(), P.end() }));
+
+		// Integral matrices factor exactly in Fraction
+		const auto [Lf, Uf, Pf] = fib.lu();
+		ASSERT_EQ(Matrix<Fraction>(Lf * Uf),
+			Matrix<Fraction>(static_cast<Matrix<int>>(fib)));
+	}
+
+	TEST_F(int_typed, BareissTest)
+	{
+		const Matrix<int> A = { {2, -1, 0},{-1, 2, -1},{0, -1, 2} };
+		ASSERT_EQ(A.determinant(), 4);
+		ASSERT_EQ(A.rank(), 3u);
+
+		// Zero leading pivot, the row swap flips the sign
+		const Matrix<int> swap = { {0, 2, 1},{3, 1, 0},{1, 0, 4} };
+		ASSERT_EQ(swap.determinant(), -25);
+
+		// Rank deficient and non-square
+		const Matrix<int> deficient = {
+			{1, 2, 3, 4},
+			{2, 4, 6, 8},
+			{1, 0, 1, 0}
+		};
+		const auto elim = deficient.bareiss();
+		ASSERT_EQ(elim.rank, 2u);
+		ASSERT_EQ(elim.determinant, 0);
+
+		// First column of A^-1 = [3, 2, 1] / 4
+		const auto [X, den] = A.solve_exact(Matrix<int>({ {1}, {0}, {0} }));
+		ASSERT_EQ(den, 4);
+		ASSERT_EQ(X, Matrix<long long>({ {3}, {2}, {1} }));
+
+		// Random system: A * X = den * B has to hold exactly
+		Matrix<int> R(6, fill_type::randi);
+		while (R.determinant() == 0) R.fill(fill_type::randi);
+		const Matrix<int> B(6, 2, fill_type::randi);
+		const auto exact = R.solve_exact(B);
+
+		Matrix<long long> R_wide(6), B_wide(6, 2);
+		std::copy(R.data(), R.data() + 36, R_wide.data());
+		std::copy(B.data(), B.data() + 12, B_wide.data());
+		ASSERT_EQ(R_wide * exact.X, exact.denominator * std::as_const(B_wide));
+
+		// Minors past the range of the working type are reported
+		const Matrix<int> big = {
+			{1000000000, 2, 3},
+			{4, 1000000000, 6},
+			{7, 8, 1000000000}
+		};
+		ASSERT_THROW(static_cast<void>(big.determinant()), std::overflow_error);
+		ASSERT_THROW(static_cast<void>(big.rank()), std::overflow_error);
+		const Matrix<int> e1 = { {1}, {0}, {0} };
+		ASSERT_THROW(static_cast<void>(big.solve_exact(e1)),
+			std::overflow_error);
+		ASSERT_THROW(static_cast<void>(big.determinant<int>()),
+			std::overflow_error);
+
+		// Floating point determinants come from the LU-factorization
+		const Matrix<double> A_real = { {2, -1, 0},{-1, 2, -1},{0, -1, 2} };
+		ASSERT_NEAR(A_real.determinant(), 4.0, 1e-12);
+	}
+
 	// First tests are ran with signed types
 	TYPED_TEST_CASE_P(MatrixGTest);
 	
@@ -134,29 +272,302 @@ namespace MatrixTests
 		ASSERT_TRUE(sq_mat_id.all_of(null));
 	}
 	
+	// Exact comparison for exact types, a small tolerance for floating point
+	template<typename T>
+	::testing::AssertionResult MatricesNear(
+		const Matrix<T>& lhs, const Matrix<T>& rhs)
+	{
+		if (lhs.size() != rhs.size())
+		{
+			return ::testing::AssertionFailure() << "sizes differ";
+		}
+		if constexpr (std::is_floating_point_v<T>)
+		{
+			for (std::size_t i = 0; i < lhs.size().first; ++i)
+			{
+				for (std::size_t j = 0; j < lhs.size().second; ++j)
+				{
+					if (std::abs(lhs[i][j] - rhs[i][j]) > 1e-9)
+					{
+						return ::testing::AssertionFailure()
+							<< "element (" << i << ", " << j << ") differs";
+					}
+				}
+			}
+			return ::testing::AssertionSuccess();
+		}
+		else
+		{
+			if (lhs == rhs) return ::testing::AssertionSuccess();
+			return ::testing::AssertionFailure() << lhs << rhs;
+		}
+	}
+
+	// Sets the Strassen crossover for a scope. The previous value comes
+	// back even when an assertion returns from the test early.
+	class CrossoverGuard
+	{
+	public:
+		explicit CrossoverGuard(const std::size_t crossover) :
+			previous_(StrassenKernels::crossover())
+		{
+			StrassenKernels::set_crossover(crossover);
+		}
+
+		CrossoverGuard(const CrossoverGuard&) = delete;
+		CrossoverGuard& operator=(const CrossoverGuard&) = delete;
+
+		~CrossoverGuard()
+		{
+			StrassenKernels::set_crossover(previous_);
+		}
+
+	private:
+		std::size_t previous_;
+	};
+
+	// Counts the allocations passed on to the heap
+	class CountingResource : public std::pmr::memory_resource
+	{
+	public:
+		std::size_t allocations = 0;
+
+	private:
+		void* do_allocate(std::size_t bytes, std::size_t alignment) override
+		{
+			++allocations;
+			return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+		}
+
+		void do_deallocate(void* p, std::size_t bytes,
+			std::size_t alignment) override
+		{
+			std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+		}
+
+		bool do_is_equal(const memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+	};
+
+	TEST(MatrixGTest, AllocatorTest)
+	{
+		CountingResource counting;
+		std::pmr::monotonic_buffer_resource arena(&counting);
+
+		// Results of member operations stay in the resource of the Matrix
+		Matrix<double> A(40, fill_type::rand, &arena);
+		for (std::size_t i = 0; i < 40; ++i)
+		{
+			A[i][i] += 40;
+		}
+		const auto [L, U, P] = A.lu();
+		ASSERT_EQ(L.get_allocator().resource(), &arena);
+		ASSERT_EQ(U.get_allocator().resource(), &arena);
+		ASSERT_EQ(A.power(3).get_allocator().resource(), &arena);
+		ASSERT_EQ((A * A).get_allocator().resource(), &arena);
+		ASSERT_TRUE(MatricesNear(L * U, A.permute_rows(P)));
+
+		// Copies go to the default resource, moves keep the resource
+		Matrix<double> copy = A;
+		ASSERT_EQ(copy.get_allocator().resource(),
+			std::pmr::get_default_resource());
+		Matrix<double> moved = std::move(copy);
+		ASSERT_EQ(moved.get_allocator().resource(),
+			std::pmr::get_default_resource());
+		ASSERT_EQ(Matrix<double>(A, &counting), A);
+
+		// *= of matrices from different resources
+		Matrix<double> B(A, &arena);
+		B *= A;
+		ASSERT_EQ(B, A * A);
+		ASSERT_EQ(B.get_allocator().resource(), &arena);
+
+		// *= keeps nothing from the default resource in effect during the
+		// call, which may go away right after it
+		{
+			CountingResource short_lived;
+			auto* previous = std::pmr::set_default_resource(&short_lived);
+			Matrix<double> C(A, &counting);
+			C *= A;
+			std::pmr::set_default_resource(previous);
+			ASSERT_EQ(short_lived.allocations, 0u);
+			ASSERT_EQ(C.get_allocator().resource(), &counting);
+			ASSERT_EQ(C, A * A);
+		}
+
+		// Temporaries of the algorithms come from the scratch pool, not
+		// from the default resource
+		CountingResource default_counting;
+		Matrix<int> I = { { 2, -1, 0 }, { -1, 2, -1 }, { 0, -1, 2 } };
+		auto* previous = std::pmr::set_default_resource(&default_counting);
+		const auto det = A.determinant();
+		const auto det_int = I.determinant();
+		const auto rank = I.rank();
+		Matrix<double> At = A;
+		At.transpose();
+		std::pmr::set_default_resource(previous);
+
+		// Only the copy At
+		ASSERT_EQ(default_counting.allocations, 1u);
+		ASSERT_NE(det, 0.0);
+		ASSERT_EQ(det_int, 4);
+		ASSERT_EQ(rank, 3u);
+	}
+
 	TYPED_TEST_P(MatrixGTest, LUFactTest)
 	{
 		using matrix_type = Matrix<TypeParam>;
+		using lu_matrix = Matrix<typename matrix_type::LU_T>;
 
 		matrix_type sq_id(3, fill_type::identity);
-		const auto [L, U] = sq_id.lu();
+		const auto [L, U, P] = sq_id.lu();
 		ASSERT_EQ(L * U, sq_id);
 		
+		// Singular, the last column needs a row interchange
 		matrix_type mat = { {1, 1, 0},{1, 1, 0},{0, 0, 1} };
-		const auto [L2, U2] = mat.lu();
-		ASSERT_EQ(L2 * U2, mat);
+		const auto [L2, U2, P2] = mat.lu();
+		ASSERT_TRUE(MatricesNear(L2 * U2, lu_matrix(mat.permute_rows(P2))));
+		ASSERT_TRUE(L2.is_lower_triangular());
+		ASSERT_TRUE(U2.is_upper_triangular());
+
+		// Zero leading pivot
+		matrix_type swap = { {0, 2, 1},{3, 1, 0},{1, 0, 4} };
+		const auto [L3, U3, P3] = swap.lu();
+		ASSERT_TRUE(MatricesNear(L3 * U3, lu_matrix(swap.permute_rows(P3))));
 
 		matrix_type sq_of(3, fill_type::randi);
-		const auto [L3, U3] = sq_of.lu();
-		ASSERT_EQ(L3 * U3, sq_of);
+		const auto [L4, U4, P4] = sq_of.lu();
+		ASSERT_TRUE(MatricesNear(L4 * U4, lu_matrix(sq_of.permute_rows(P4))));
 
-		std::cout << L3 << U3 << std::endl;
+		// Several panels for the blocked path. Kept to floating point as
+		// exact fractions grow quickly with random input.
+		if constexpr (std::is_floating_point_v<TypeParam>)
+		{
+			matrix_type big(150, 130, fill_type::rand);
+			const auto [L5, U5, P5] = big.lu();
+			ASSERT_EQ(L5.size(), std::make_pair(std::size_t(150), std::size_t(150)));
+			ASSERT_TRUE(L5.is_lower_triangular());
+			ASSERT_TRUE(U5.is_upper_triangular());
+			ASSERT_TRUE(MatricesNear(L5 * U5, big.permute_rows(P5)));
+		}
 	}
 	
+	TYPED_TEST_P(MatrixGTest, SolveTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+		using lu_type = typename matrix_type::LU_T;
+		using lu_matrix = Matrix<lu_type>;
+
+		// Zero leading pivot, non-singular
+		const matrix_type A = { {0, 2, 1},{3, 1, 0},{1, 0, 4} };
+		const matrix_type X = { {1, 2},{-1, 0},{2, 5} };
+		const matrix_type B = A * X;
+
+		ASSERT_TRUE(MatricesNear(solve(A, B), lu_matrix(X)));
+
+		// Factorize once, solve for several right-hand sides
+		const auto lu = A.lu();
+		const std::vector<lu_type> b = { lu_type(3), lu_type(4), lu_type(9) };
+		const auto x = lu.solve(b);
+		ASSERT_TRUE(MatricesNear(lu_matrix(A) * lu_matrix({ x }).transpose(),
+			lu_matrix({ b }).transpose()));
+
+		// Non-unit diagonal of integral type, the solves divide exactly
+		if constexpr (std::is_integral_v<TypeParam>)
+		{
+			const matrix_type L = { {2, 0, 0},{3, -4, 0},{1, 5, 3} };
+			const matrix_type Y = { {1, -2},{3, 0},{-1, 7} };
+			matrix_type sol = L * Y;
+			trsm(triangle_type::lower, diag_type::non_unit, L, sol);
+			ASSERT_EQ(sol, Y);
+
+			matrix_type U = L;
+			U.transpose();
+			sol = U * Y;
+			trsm(triangle_type::upper, diag_type::non_unit, U, sol);
+			ASSERT_EQ(sol, Y);
+
+			// Agrees with the single right-hand side solve
+			std::vector<TypeParam> y = { 2, 3, 52 };
+			trsv(triangle_type::lower, diag_type::non_unit, L, y);
+			ASSERT_EQ(y, std::vector<TypeParam>({ 1, 0, 17 }));
+		}
+
+		// Blocked triangular solves against the products they invert
+		if constexpr (std::is_floating_point_v<TypeParam>)
+		{
+			matrix_type T(150, fill_type::rand);
+			for (unsigned i = 0; i < 150; ++i)
+			{
+				// Diagonally dominant keeps the test well conditioned
+				T[i][i] += TypeParam(150);
+			}
+			matrix_type rhs(150, 7, fill_type::rand);
+
+			auto lower = T;
+			for (unsigned i = 0; i < 150; ++i)
+			{
+				for (unsigned j = i + 1; j < 150; ++j) lower[i][j] = 0;
+			}
+			auto sol = rhs;
+			trsm(triangle_type::lower, diag_type::non_unit, T, sol);
+			ASSERT_TRUE(MatricesNear(lower * sol, rhs));
+
+			auto upper = T;
+			for (unsigned i = 0; i < 150; ++i)
+			{
+				for (unsigned j = 0; j < i; ++j) upper[i][j] = 0;
+			}
+			sol = rhs;
+			trsm(triangle_type::upper, diag_type::non_unit, T, sol);
+			ASSERT_TRUE(MatricesNear(upper * sol, rhs));
+
+			const auto big_x = solve(T, rhs);
+			ASSERT_TRUE(MatricesNear(T * big_x, rhs));
+		}
+	}
+
+	TYPED_TEST_P(MatrixGTest, ExpressionTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+
+		const matrix_type ones(N_SIZE, M_SIZE, fill_type::ones);
+		matrix_type& twos = this->nsq_3by5_.fill(fill_type::ones);
+		twos += ones;
+
+		// Fused chains evaluate on construction
+		matrix_type threes = ones + twos;
+		ASSERT_TRUE(threes.all_of(TypeParam(3)));
+
+		matrix_type zeros = threes - ones - twos;
+		ASSERT_TRUE(zeros.all_of(TypeParam(0)));
+
+		// Scalar products of const operands are lazy, both orders work
+		matrix_type sixes = TypeParam(2) * ones + threes * TypeParam(1)
+			+ (ones - twos + twos) * TypeParam(1);
+		ASSERT_TRUE(sixes.all_of(TypeParam(6)));
+
+		// The assigned-to Matrix may appear in the expression
+		sixes = sixes - ones - ones;
+		ASSERT_TRUE(sixes.all_of(TypeParam(4)));
+		sixes -= ones + ones;
+		ASSERT_TRUE(sixes.all_of(TypeParam(2)));
+
+		// Assignment of a differently sized expression resizes
+		matrix_type small(2);
+		small = threes + ones;
+		ASSERT_EQ(small.size(), threes.size());
+
+		ASSERT_DEATH(matrix_type bad = threes + this->nsq_5by3_,
+			ASSERTION_FAILED);
+	}
+
 	using SignedTypes = testing::Types<int, double>;
 	REGISTER_TYPED_TEST_CASE_P(
 		MatrixGTest,
-		EqualityTest, SubtractionTest, LUFactTest
+		EqualityTest, SubtractionTest, LUFactTest, SolveTest, ExpressionTest
 	);
 	INSTANTIATE_TYPED_TEST_CASE_P(MatrixIntTests, MatrixGTest, SignedTypes);
 
@@ -244,8 +655,8 @@ namespace MatrixTests
 		ASSERT_TRUE(nsq_mat_of.all_of(two));
 		
 		// Matrices with erroneous sizes.
-		ASSERT_DEATH(sq_mat_id += nsq_mat_id, "^Assertion failed");
-		ASSERT_DEATH(sq_mat_id + nsq_mat_id, "^Assertion failed");
+		ASSERT_DEATH(sq_mat_id += nsq_mat_id, ASSERTION_FAILED);
+		ASSERT_DEATH(sq_mat_id + nsq_mat_id, ASSERTION_FAILED);
 	}
 
 	TYPED_TEST(MatrixGTest, ScalarMultiplicationTest)
@@ -305,8 +716,481 @@ namespace MatrixTests
 		ASSERT_TRUE(sq_mat_null2.all_of(null));
 		
 		// Incompatible matrices
-		ASSERT_DEATH(nsq_mat_id * nsq_mat_id, "^Assertion failed");
-		ASSERT_DEATH(nsq_mat_of * sq_mat_null, "^Assertion failed");
+		ASSERT_DEATH(nsq_mat_id * nsq_mat_id, ASSERTION_FAILED);
+		ASSERT_DEATH(nsq_mat_of * sq_mat_null, ASSERTION_FAILED);
+	}
+
+	TYPED_TEST(MatrixGTest, BlockedMultiplicationTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+
+		// Sizes that are not multiples of the register or cache tiles
+		matrix_type lhs(67, 45, fill_type::randi);
+		matrix_type rhs(45, 53, fill_type::randi);
+		const auto product = lhs * rhs;
+
+		// Reference result from the naive triple loop
+		matrix_type expected(67, 53);
+		for (unsigned i = 0; i < 67; ++i)
+		{
+			for (unsigned j = 0; j < 53; ++j)
+			{
+				for (unsigned k = 0; k < 45; ++k)
+				{
+					expected[i][j] += lhs[i][k] * rhs[k][j];
+				}
+			}
+		}
+		ASSERT_EQ(product, expected);
+	}
+
+	TYPED_TEST(MatrixGTest, GemmTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+
+		// Large enough for the packed kernel for the types that have one
+		for (const std::size_t n : { std::size_t(4), std::size_t(50) })
+		{
+			matrix_type A(n + 3, n, fill_type::randi);
+			matrix_type B(n + 3, n + 1, fill_type::randi);
+			matrix_type C(n, n + 1, fill_type::randi);
+
+			// Reference with explicit transposes
+			auto A_t = A;
+			A_t.transpose();
+			const matrix_type AtB = A_t * B;
+			const matrix_type expected =
+				TypeParam(2) * AtB + TypeParam(3) * std::as_const(C);
+
+			// C = 2 * A^T * B + 3 * C
+			gemm(TypeParam(2), A, op_type::transpose, B, op_type::none,
+				TypeParam(3), C);
+			ASSERT_EQ(C, expected);
+
+			// C = (A^T)^T^T * B, beta = 0 discards C
+			gemm(TypeParam(1), A_t, op_type::none, B, op_type::none,
+				TypeParam(0), C);
+			ASSERT_EQ(C, AtB);
+
+			// B^T * A = (A^T * B)^T
+			matrix_type D(n + 1, n);
+			gemm(TypeParam(1), B, op_type::transpose, A_t, op_type::transpose,
+				TypeParam(0), D);
+			D.transpose();
+			ASSERT_EQ(D, AtB);
+		}
+	}
+
+	TYPED_TEST(MatrixGTest, StrassenTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+
+		// Odd sizes need padding, small elements keep the powers exact
+		const matrix_type A(67, 45, fill_type::randi);
+		const matrix_type B(45, 53, fill_type::randi);
+		const matrix_type C(67, 53, fill_type::randi);
+		matrix_type S(40, 40);
+		for (std::size_t i = 0; i < 40; ++i)
+		{
+			for (std::size_t j = 0; j < 40; ++j)
+			{
+				S[i][j] = static_cast<TypeParam>((i * 7 + j) % 3 == 0);
+			}
+		}
+
+		// References from the classical kernels
+		ASSERT_EQ(StrassenKernels::crossover(), 0u);
+		const matrix_type product = A * B;
+		const matrix_type power = S.power(5);
+		const matrix_type scaled = TypeParam(2) * product + TypeParam(3) * C;
+
+		// Three levels for the products of A and B, into a strided view
+		CrossoverGuard guard(8);
+		ASSERT_EQ(StrassenKernels::depth(67, 53, 45), 3u);
+		ASSERT_FALSE(StrassenKernels::applies(67, 53, 7));
+		ASSERT_EQ(A * B, product);
+		ASSERT_EQ(S.power(5), power);
+
+		matrix_type Ct(C.transposed());
+		gemm(TypeParam(2), A, op_type::none, B, op_type::none,
+			TypeParam(3), Ct.view().transposed());
+		ASSERT_EQ(matrix_type(Ct.transposed()), scaled);
+		ASSERT_GE(StrassenKernels::workspace<TypeParam>().size(),
+			StrassenKernels::workspace_size(67, 53, 45));
+
+		StrassenKernels::set_crossover(0);
+		ASSERT_FALSE(StrassenKernels::applies(67, 53, 45));
+	}
+
+	template<typename T>
+	void check_quantized_product(const std::size_t m, const std::size_t k, const std::size_t n)
+	{
+		using CpuFeatures::simd_level;
+		using limits = std::numeric_limits<T>;
+
+		// The full range including the extremes, B transposed in memory
+		Matrix<T> A(m, k), Bt(n, k);
+		for (std::size_t i = 0; i < m; ++i)
+		{
+			for (std::size_t p = 0; p < k; ++p)
+			{
+				A[i][p] = static_cast<T>((i + p) % 5 == 0 ? limits::min() :
+					static_cast<int>((i * 37 + p * 11) % 256) - 128);
+			}
+		}
+		for (std::size_t j = 0; j < n; ++j)
+		{
+			for (std::size_t p = 0; p < k; ++p)
+			{
+				Bt[j][p] = static_cast<T>((j + p) % 3 == 0 ? limits::min() :
+					(j + p) % 7 == 0 ? limits::max() : static_cast<int>((j * 13 + p * 29) % 200) - 100);
+			}
+		}
+
+		// The sums modulo 2^32
+		Matrix<std::int32_t> expected(m, n);
+		for (std::size_t i = 0; i < m; ++i)
+		{
+			for (std::size_t j = 0; j < n; ++j)
+			{
+				std::int64_t sum = 0;
+				for (std::size_t p = 0; p < k; ++p)
+				{
+					sum += std::int64_t(A[i][p]) * Bt[j][p];
+				}
+				expected[i][j] = static_cast<std::int32_t>(static_cast<std::uint32_t>(sum));
+			}
+		}
+
+		for (auto level : { simd_level::scalar, simd_level::sse2,
+			simd_level::avx2, simd_level::avx512 })
+		{
+			CpuFeatures::set_max_level(level);
+			ASSERT_EQ(MatrixQuantized::multiply(A.view(), std::as_const(Bt).view().transposed()),
+				expected);
+		}
+	}
+
+	TEST(MatrixGTest, QuantizedTest)
+	{
+		// Odd inner dimensions leave partial pairs and quads
+		check_quantized_product<std::int8_t>(37, 70, 45);
+		check_quantized_product<std::int8_t>(5, 3, 1);
+		check_quantized_product<std::int16_t>(37, 71, 45);
+
+		auto& pool = ThreadPool::instance();
+		pool.set_thread_count(4);
+		check_quantized_product<std::int8_t>(150, 301, 70);
+		check_quantized_product<std::int16_t>(150, 300, 70);
+		pool.set_thread_count(0);
+		CpuFeatures::set_max_level(CpuFeatures::simd_level::avx512);
+
+		const Matrix<std::int8_t> A({ { 100, 100 }, { -100, 3 } });
+		const Matrix<std::int8_t> B({ { 100, 1 }, { 100, -1 } });
+		const auto P = MatrixQuantized::multiply(A, B);
+		ASSERT_EQ(P, Matrix<std::int32_t>({ { 20000, 0 }, { -9700, -103 } }));
+
+		// Per tensor: saturated, rounded half away from zero
+		using MatrixQuantized::axis;
+		Matrix<std::int8_t> Q(2, 2);
+		MatrixQuantized::requantize(P, { axis::tensor, { 0.01f }, { -1 } }, Q);
+		ASSERT_EQ(Q, Matrix<std::int8_t>({ { 127, -1 }, { -98, -2 } }));
+
+		// Per row and per column, fused with the product
+		MatrixQuantized::multiply(A, B, { axis::row, { 0.001f, 0.1f }, { 5, 0 } }, Q);
+		ASSERT_EQ(Q, Matrix<std::int8_t>({ { 25, 5 }, { -128, -10 } }));
+		Matrix<std::int32_t> R(2, 2);
+		MatrixQuantized::multiply(A, B, { axis::column, { 0.5f, 2.0f }, {} }, R);
+		ASSERT_EQ(R, Matrix<std::int32_t>({ { 10000, 0 }, { -4850, -206 } }));
+
+		// Huge scales saturate at both ends of the output type
+		MatrixQuantized::requantize(P, { axis::tensor, { 1e30f }, {} }, R);
+		const auto r_max = std::numeric_limits<std::int32_t>::max();
+		const auto r_min = std::numeric_limits<std::int32_t>::min();
+		ASSERT_EQ(R, Matrix<std::int32_t>({ { r_max, 0 }, { r_min, r_min } }));
+		Matrix<std::uint32_t> U(2, 2);
+		MatrixQuantized::requantize(P, { axis::tensor, { 1e30f }, {} }, U);
+		ASSERT_EQ(U, Matrix<std::uint32_t>({ { 4294967295u, 0 }, { 0, 0 } }));
+	}
+
+	TYPED_TEST(MatrixGTest, ViewTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+
+		matrix_type M(4, 5);
+		for (std::size_t i = 0; i < 4; ++i)
+		{
+			for (std::size_t j = 0; j < 5; ++j)
+			{
+				M[i][j] = static_cast<TypeParam>(i * 5 + j);
+			}
+		}
+		const auto& cM = M;
+
+		// Slices read the storage in place
+		ASSERT_EQ(matrix_type(cM.submatrix(1, 2, 2, 3)),
+			matrix_type({ { 7, 8, 9 }, { 12, 13, 14 } }));
+		ASSERT_EQ(matrix_type(cM.row(2)), matrix_type({ { 10, 11, 12, 13, 14 } }));
+		ASSERT_EQ(matrix_type(cM.column(1)), matrix_type({ { 1 }, { 6 }, { 11 }, { 16 } }));
+		ASSERT_EQ(matrix_type(cM.diagonal()), matrix_type({ { 0 }, { 6 }, { 12 }, { 18 } }));
+		ASSERT_EQ(cM.submatrix(1, 1, 3, 3).diagonal().coeff(2, 0), TypeParam(18));
+
+		auto Mt = M;
+		Mt.transpose();
+		const auto lazy_t = cM.view().transposed();
+		ASSERT_EQ(lazy_t.size(), Mt.size());
+		ASSERT_EQ(matrix_type(lazy_t), Mt);
+
+		// Writes go through to M
+		matrix_type N = M;
+		N.submatrix(2, 0, 2, 2).assign(matrix_type(2, 2, fill_type::ones));
+		N.column(4) += cM.column(0);
+		ASSERT_EQ(N[3][1], TypeParam(1));
+		ASSERT_EQ(N[3][4], TypeParam(34));
+		ASSERT_EQ(N[0][0], TypeParam(0));
+
+		// Overlapping right-hand sides are evaluated first
+		matrix_type S(3);
+		for (std::size_t i = 0; i < 3; ++i)
+		{
+			for (std::size_t j = 0; j < 3; ++j)
+			{
+				S[i][j] = static_cast<TypeParam>(i * 3 + j);
+			}
+		}
+		auto S_t = S;
+		S_t.transpose();
+		const matrix_type sym = S + S_t;
+		auto R = S;
+		R += R.view().transposed();
+		ASSERT_EQ(R, sym);
+		R = R.submatrix(0, 0, 2, 2);
+		ASSERT_EQ(R, matrix_type(sym.submatrix(0, 0, 2, 2)));
+		S.submatrix(1, 1, 2, 2).assign(S.submatrix(0, 0, 2, 2));
+		ASSERT_EQ(S[2][2], TypeParam(4));
+
+		// Products of views, without copying the operands
+		const auto block = cM.submatrix(0, 1, 3, 3);
+		const matrix_type block_copy = block;
+		ASSERT_EQ(block * lazy_t.submatrix(1, 0, 3, 2),
+			block_copy * matrix_type(lazy_t.submatrix(1, 0, 3, 2)));
+
+		// C as a view: a block, a transposed window and a diagonal
+		matrix_type C(4, 4, fill_type::zeros);
+		gemm(TypeParam(1), block, op_type::none, block, op_type::transpose,
+			TypeParam(0), C.submatrix(1, 1, 3, 3));
+		auto block_t = block_copy;
+		block_t.transpose();
+		const matrix_type BBt = block_copy * block_t;
+		ASSERT_EQ(matrix_type(std::as_const(C).submatrix(1, 1, 3, 3)), BBt);
+		ASSERT_EQ(C[0][0], TypeParam(0));
+
+		matrix_type Ct(3, 3);
+		gemm(TypeParam(1), block, op_type::none, block_copy, op_type::none,
+			TypeParam(0), Ct.view().transposed());
+		Ct.transpose();
+		ASSERT_EQ(Ct, block_copy * block_copy);
+
+		matrix_type D(3, 3, fill_type::ones);
+		const matrix_type ones_col(3, 1, fill_type::ones);
+		gemm(TypeParam(1), block, op_type::none, ones_col, op_type::none,
+			TypeParam(1), D.diagonal());
+		ASSERT_EQ(D[2][2], TypeParam(1 + 11 + 12 + 13));
+		ASSERT_EQ(D[0][1], TypeParam(1));
+
+		if constexpr (std::is_floating_point_v<TypeParam>)
+		{
+			// Solves with a view right-hand side and a transposed triangle
+			matrix_type A = { { 4, 1, 2 }, { 1, 5, 1 }, { 2, 1, 6 } };
+			const auto x = A.lu().solve(cM.submatrix(0, 0, 3, 2));
+			ASSERT_TRUE(MatricesNear(A * x, matrix_type(cM.submatrix(0, 0, 3, 2))));
+
+			const matrix_type L = { { 2, 0, 0 }, { 1, 3, 0 }, { 4, 1, 2 } };
+			matrix_type X = block_copy;
+			trsm(triangle_type::upper, diag_type::non_unit,
+				L.view().transposed(), X);
+			auto U = L;
+			U.transpose();
+			ASSERT_TRUE(MatricesNear(U * X, block_copy));
+		}
+	}
+
+	TYPED_TEST(MatrixGTest, SimdDispatchTest)
+	{
+		using namespace VectorOperations;
+		using CpuFeatures::simd_level;
+
+		// Odd length so that every level also runs its scalar tail
+		const std::size_t n = 37;
+		std::vector<TypeParam> lhs(n), rhs(n);
+		for (unsigned i = 0; i < n; ++i)
+		{
+			lhs[i] = static_cast<TypeParam>(i + 3);
+			rhs[i] = static_cast<TypeParam>(2 * i + 1);
+		}
+
+		// Reference results from the scalar kernels
+		CpuFeatures::set_max_level(simd_level::scalar);
+		auto sum = lhs + rhs;
+		auto axpy_ref = rhs;
+		axpy(axpy_ref.data(), TypeParam(3), lhs.data(), n);
+
+		for (auto level : { simd_level::sse2, simd_level::avx2,
+			simd_level::avx512 })
+		{
+			CpuFeatures::set_max_level(level);
+
+			ASSERT_EQ(lhs + rhs, sum);
+			auto diff = sum;
+			diff -= rhs;
+			ASSERT_EQ(diff, lhs);
+
+			auto y = rhs;
+			axpy(y.data(), TypeParam(3), lhs.data(), n);
+			ASSERT_TRUE(equal(y.data(), axpy_ref.data(), n));
+
+			auto scaled = lhs;
+			scale(scaled.data(), TypeParam(0), n);
+			ASSERT_TRUE(all_equal(scaled.data(), TypeParam(0), n));
+			ASSERT_FALSE(equal(lhs.data(), rhs.data(), n));
+
+			// Unsigned elements wrap around, vector lanes and tails alike
+			if constexpr (std::is_unsigned_v<TypeParam>)
+			{
+				const auto max = std::numeric_limits<TypeParam>::max();
+				const std::vector<TypeParam> half(n, max / 2), ones(n, 1);
+				ASSERT_EQ(half + ones, std::vector<TypeParam>(n, max / 2 + 1));
+				ASSERT_EQ(half + half + ones + ones,
+					std::vector<TypeParam>(n, 0));
+				auto wrapped = ones;
+				wrapped -= half;
+				ASSERT_EQ(wrapped, std::vector<TypeParam>(n, max / 2 + 3));
+			}
+		}
+		CpuFeatures::set_max_level(simd_level::avx512);
+	}
+
+	TYPED_TEST(MatrixGTest, RandomFillTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+		using CpuFeatures::simd_level;
+
+		// Known answer of Philox4x32-10 for a zero counter and key
+		ASSERT_EQ(SimdKernels::philox_word(0, 0), 0xe169c58d6627e8d5u);
+
+		// Reproducible with a seed, different without
+		matrix_type A(300, 301), B(300, 301);
+		A.fill(fill_type::randi, 42);
+		B.fill(fill_type::randi, 42);
+		ASSERT_EQ(A, B);
+		B.fill(fill_type::randi, 43);
+		ASSERT_NE(A, B);
+		B.fill(fill_type::randi);
+		ASSERT_NE(A, B);
+
+		// The same bits for every thread count and instruction set
+		auto& pool = ThreadPool::instance();
+		for (const auto threads : { 1u, 4u })
+		{
+			pool.set_thread_count(threads);
+			for (auto level : { simd_level::scalar, simd_level::sse2,
+				simd_level::avx2, simd_level::avx512 })
+			{
+				CpuFeatures::set_max_level(level);
+				ASSERT_EQ(B.fill(fill_type::randi, 42), A);
+			}
+		}
+		pool.set_thread_count(0);
+
+		// Limits are read on every call
+		matrix_type::set_rand_limits(3, 7);
+		A.fill(fill_type::randi);
+		ASSERT_EQ(*std::min_element(A.data(), A.data() + 300 * 301), TypeParam(3));
+		ASSERT_EQ(*std::max_element(A.data(), A.data() + 300 * 301), TypeParam(7));
+		matrix_type::set_rand_limits(0, 10);
+
+		// Per-call distributions
+		A.fill_random(Random::uniform_int{ 100, 101 }, 7);
+		ASSERT_TRUE(std::all_of(A.data(), A.data() + 300 * 301,
+			[](const TypeParam x) { return x == TypeParam(100) || x == TypeParam(101); }));
+		if constexpr (std::is_floating_point_v<TypeParam>)
+		{
+			A.fill_random(Random::normal{ 5.0, 2.0 }, 7);
+			const auto n = 300.0 * 301.0;
+			const auto mean = std::accumulate(A.data(), A.data() + 300 * 301, 0.0) / n;
+			ASSERT_NEAR(mean, 5.0, 0.05);
+
+			A.fill_random(Random::uniform_real{ -1.0, 1.0 });
+			ASSERT_TRUE(std::all_of(A.data(), A.data() + 300 * 301,
+				[](const TypeParam x) { return x >= -1.0 && x < 1.0; }));
+		}
+	}
+
+	TYPED_TEST(MatrixGTest, ParallelTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+		auto& pool = ThreadPool::instance();
+
+		// Every index runs exactly once, nested loops run inline
+		pool.set_thread_count(4);
+		std::vector<std::atomic<int>> hits(1000);
+		pool.parallel_for(10, [&](const std::size_t i)
+		{
+			pool.parallel_for(100, [&](const std::size_t j)
+			{
+				++hits[i * 100 + j];
+			});
+		});
+		for (auto& hit : hits)
+		{
+			ASSERT_EQ(hit.load(), 1);
+		}
+
+		// Many short jobs back to back: the submitter returns as soon as
+		// the last task finishes, while that task's thread is still
+		// inside run() (the Job lives on the submitter's stack)
+		for (int round = 0; round < 20000; ++round)
+		{
+			std::atomic<std::size_t> count{ 0 };
+			pool.parallel_for(4, [&](const std::size_t)
+			{
+				count.fetch_add(1, std::memory_order_relaxed);
+			});
+			ASSERT_EQ(count.load(), 4u);
+		}
+
+		// Small integers keep every product exact, so the threaded results
+		// must match the single-threaded ones
+		auto make = [](std::size_t rows, std::size_t cols, unsigned seed)
+		{
+			matrix_type result(rows, cols);
+			for (std::size_t i = 0; i < rows; ++i)
+			{
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					result[i][j] = static_cast<TypeParam>((i * seed + j) % 5);
+				}
+			}
+			return result;
+		};
+		const auto A = make(200, 150, 3), B = make(150, 300, 7);
+		const auto tall = make(16, 2000, 5), wide = make(2000, 16, 11);
+		const auto C = make(300, 300, 2), D = make(300, 300, 13);
+
+		pool.set_thread_count(1);
+		const matrix_type AB = A * B, tall_wide = tall * wide;
+		const matrix_type sum = C + D;
+
+		for (bool deterministic : { true, false })
+		{
+			pool.set_thread_count(4);
+			pool.set_deterministic(deterministic);
+			ASSERT_EQ(A * B, AB);
+			ASSERT_EQ(tall * wide, tall_wide);
+			ASSERT_EQ(matrix_type(C + D), sum);
+		}
+		pool.set_deterministic(false);
+		pool.set_thread_count(0);
 	}
 
 	TYPED_TEST(MatrixGTest, TransposeTest)
@@ -325,6 +1209,27 @@ namespace MatrixTests
 		nsq_mat1.transpose();
 		ASSERT_EQ(nsq_mat1.size(), nsq_mat2.size());
 
+		// Recursive square, scratch copy and cycle-following paths
+		for (const auto& [rows, cols] : { std::pair<std::size_t, std::size_t>
+			{ 100, 100 }, { 37, 53 }, { 300, 1000 }, { 1, 7 } })
+		{
+			matrix_type M(rows, cols);
+			for (std::size_t i = 0; i < rows; ++i)
+			{
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					M[i][j] = static_cast<TypeParam>((i * 7 + j * 3) % 101);
+				}
+			}
+			const matrix_type lazy = std::as_const(M).transposed();
+			ASSERT_EQ(lazy.size(), std::make_pair(cols, rows));
+
+			M.transpose();
+			ASSERT_EQ(M, lazy);
+			M.transpose();
+			ASSERT_EQ(matrix_type(M.transposed()), lazy);
+		}
+
 		/*
 		// Test visually
 		nsq_mat1.fill(fill_type::randi);
@@ -335,6 +1240,426 @@ namespace MatrixTests
 		*/
 	}
 	
+	TYPED_TEST(MatrixGTest, BatchTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+		using batch_type = MatrixBatch<TypeParam>;
+		using CpuFeatures::simd_level;
+
+		// Small integers keep the products exact, 37 leaves the last group
+		// partly filled
+		const auto matrices = [](const std::size_t count, const std::size_t rows,
+			const std::size_t cols, const std::size_t seed)
+		{
+			std::vector<matrix_type> result;
+			for (std::size_t b = 0; b < count; ++b)
+			{
+				matrix_type M(rows, cols);
+				for (std::size_t i = 0; i < rows; ++i)
+				{
+					for (std::size_t j = 0; j < cols; ++j)
+					{
+						M[i][j] = static_cast<TypeParam>((b * 7 + i * 3 + j + seed) % 4);
+					}
+				}
+				result.push_back(M);
+			}
+			return result;
+		};
+		const std::size_t count = 37;
+		const auto a = matrices(count, 3, 5, 0);
+		const auto b = matrices(count, 5, 4, 1);
+		const auto s = matrices(count, 4, 4, 2);
+		const batch_type A(a), B(b), S(s);
+
+		ASSERT_EQ(A.count(), count);
+		ASSERT_EQ(A.size(), std::make_pair(std::size_t(3), std::size_t(5)));
+		ASSERT_EQ(A.groups(), std::size_t(3));
+		ASSERT_EQ(A(20, 1, 2), a[20][1][2]);
+		ASSERT_EQ(A.matrix(36), a[36]);
+
+		auto& pool = ThreadPool::instance();
+		for (const auto threads : { 1, 4 })
+		{
+			pool.set_thread_count(threads);
+			for (auto level : { simd_level::scalar, simd_level::sse2,
+				simd_level::avx2, simd_level::avx512 })
+			{
+				CpuFeatures::set_max_level(level);
+
+				const auto C = A * B;
+				const auto T = A.transpose();
+				const auto traces = S.trace();
+				const auto P = S.power(5);
+				ASSERT_EQ(traces.size(), count);
+				for (std::size_t i = 0; i < count; ++i)
+				{
+					ASSERT_EQ(C.matrix(i), a[i] * b[i]);
+					ASSERT_EQ(T.matrix(i), matrix_type(a[i].transposed()));
+					ASSERT_EQ(traces[i], matrix_type(s[i]).trace());
+					ASSERT_EQ(P.matrix(i), s[i].power(5));
+				}
+			}
+		}
+		pool.set_thread_count(0);
+		CpuFeatures::set_max_level(simd_level::avx512);
+
+		ASSERT_EQ(S.power(0).matrix(5), matrix_type(4, fill_type::identity));
+		ASSERT_EQ(S.power(1), S);
+
+		auto U = S;
+		U.assign(3, s[4]);
+		ASSERT_NE(U, S);
+		ASSERT_EQ(U.matrix(3), s[4]);
+	}
+
+	TEST(MatrixGTest, BatchSolveTest)
+	{
+		// Diagonally dominant matrices, the first one needs pivoting and
+		// the count leaves the last group partly filled
+		const std::size_t count = 21, n = 6;
+		std::vector<Matrix<double>> a, b;
+		for (std::size_t m = 0; m < count; ++m)
+		{
+			Matrix<double> A(n, n), B(n, 2);
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				for (std::size_t j = 0; j < n; ++j)
+				{
+					A[i][j] = static_cast<double>((m + 3 * i + 5 * j) % 7) - 3.0;
+				}
+				A[i][i] += m == 0 ? 0.0 : 20.0;
+				B[i][0] = static_cast<double>(i + m);
+				B[i][1] = 1.0;
+			}
+			a.push_back(A);
+			b.push_back(B);
+		}
+		const MatrixBatch<double> A(a), B(b);
+		const auto X = solve(A, B);
+		for (std::size_t m = 0; m < count; ++m)
+		{
+			ASSERT_TRUE(MatricesNear(a[m] * X.matrix(m), b[m]));
+			ASSERT_TRUE(MatricesNear(X.matrix(m), solve(a[m], b[m])));
+		}
+	}
+
+	TYPED_TEST(MatrixGTest, SparseTest)
+	{
+		using matrix_type = Matrix<TypeParam>;
+		using sparse_type = SparseMatrix<TypeParam>;
+
+		// About one nonzero in seven
+		const auto pattern = [](const std::size_t rows, const std::size_t cols,
+			const std::size_t seed)
+		{
+			matrix_type M(rows, cols);
+			for (std::size_t i = 0; i < rows; ++i)
+			{
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					const auto h = (i * 31 + j * 17 + seed) % 7;
+					if (h == 0) M[i][j] = static_cast<TypeParam>(1 + (i + j) % 5);
+				}
+			}
+			return M;
+		};
+		const auto A = pattern(40, 30, 1);
+		const auto B = pattern(30, 50, 3);
+		const sparse_type SA(A);
+		const sparse_type SB(B);
+
+		ASSERT_LT(SA.nonzeros(), 40u * 30u / 5);
+		ASSERT_EQ(SA.to_dense(), A);
+		ASSERT_EQ(SA.coeff(0, 6), A[0][6]);
+
+		// CSC and transpose
+		ASSERT_EQ(sparse_type(SA.to_csc()), SA);
+		auto At = A;
+		ASSERT_EQ(SA.transpose().to_dense(), At.transpose());
+
+		// SpMV, SpMM both ways and SpGEMM against the dense products
+		std::vector<TypeParam> x(30);
+		for (std::size_t i = 0; i < x.size(); ++i) x[i] = static_cast<TypeParam>(i % 4);
+		const auto dense_x = A * Matrix<TypeParam>({ x }).transpose();
+		const auto y = SA * x;
+		for (std::size_t i = 0; i < y.size(); ++i) ASSERT_EQ(y[i], dense_x[i][0]);
+
+		ASSERT_EQ(SA * B, A * B);
+		ASSERT_EQ(A * SB, A * B);
+		ASSERT_EQ((SA * SB).to_dense(), A * B);
+		ASSERT_EQ(SA * SB, sparse_type(A * B));
+
+		// Large enough to split the rows over the pool
+		auto& pool = ThreadPool::instance();
+		pool.set_thread_count(4);
+		const auto L = pattern(400, 400, 5);
+		const sparse_type SL(L);
+		ASSERT_EQ(SL * SL, sparse_type(L * L));
+		ASSERT_EQ(SL * L, L * L);
+		pool.set_thread_count(0);
+
+		// Coordinate form, duplicates are summed and zeros dropped
+		const sparse_type T(2, 3, { { 1, 2, TypeParam(4) }, { 0, 0, TypeParam(1) },
+			{ 1, 2, TypeParam(1) }, { 0, 1, TypeParam(0) } });
+		ASSERT_EQ(T.nonzeros(), 2u);
+		ASSERT_EQ(T.to_dense(), matrix_type({ { 1, 0, 0 }, { 0, 0, 5 } }));
+		ASSERT_TRUE(sparse_type(matrix_type(4, fill_type::identity)).is_upper_triangular());
+		ASSERT_FALSE(T.transpose().is_upper_triangular());
+		ASSERT_TRUE(T.transpose().is_lower_triangular());
+	}
+
+	TEST(MatrixGTest, SparseFractionTest)
+	{
+		const Matrix<Fraction> A({ { Fraction(1, 2), 0, 0 }, { 0, 0, Fraction(2, 3) },
+			{ 3, 0, Fraction(-1, 4) } });
+		const SparseMatrix<Fraction> S(A);
+		ASSERT_EQ(S.nonzeros(), 4u);
+		ASSERT_EQ((S * S).to_dense(), A * A);
+		ASSERT_EQ(S * A, A * A);
+
+		// Entries that cancel are not stored
+		const SparseMatrix<Fraction> C(Matrix<Fraction>({ { 1, 1 }, { 1, 1 } }));
+		const SparseMatrix<Fraction> D(Matrix<Fraction>({ { 1, 0 }, { -1, 0 } }));
+		ASSERT_EQ((C * D).nonzeros(), 0u);
+	}
+
+	TEST(MatrixGTest, StrassenFractionTest)
+	{
+		Matrix<Fraction> A(9, 9);
+		for (int i = 0; i < 9; ++i)
+		{
+			for (int j = 0; j < 9; ++j)
+			{
+				A[i][j] = Fraction(i - j, 1 + (i + 2 * j) % 4);
+			}
+		}
+		const auto expected = A * A;
+
+		// Exact with padding to 12 and two levels
+		CrossoverGuard guard(3);
+		ASSERT_EQ(A * A, expected);
+	}
+
+	TEST(MatrixGTest, FileTest)
+	{
+		const auto dir = std::filesystem::temp_directory_path();
+		const auto path = (dir / "matrix_file_test.bin").string();
+
+		Matrix<double> A(37, 53, fill_type::rand);
+		MatrixFile::save(path, A);
+		{
+			const auto mapped = MatrixFile::map<double>(path);
+			ASSERT_EQ(mapped.size(), A.size());
+			ASSERT_EQ(reinterpret_cast<std::uintptr_t>(mapped.data()) %
+				MatrixFile::default_alignment, 0u);
+			ASSERT_EQ(Matrix<double>(mapped.view()), A);
+
+			// Usable like any other read-only view
+			ASSERT_EQ(mapped.view() * A.transposed(), A * A.transposed());
+		}
+
+		// Strided views are written densely
+		MatrixFile::save(path, A.submatrix(1, 2, 10, 20).transposed(), 16);
+		ASSERT_EQ(MatrixFile::load<double>(path),
+			Matrix<double>(A.submatrix(1, 2, 10, 20).transposed()));
+
+		// Wrong element type, data overlapping the header, truncated file
+		// and missing file
+		ASSERT_THROW(MatrixFile::map<float>(path), std::runtime_error);
+		{
+			std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+			const std::uint64_t zero = 0;
+			file.seekp(offsetof(MatrixFile::Header, data_offset));
+			file.write(reinterpret_cast<const char*>(&zero), sizeof(zero));
+		}
+		ASSERT_THROW(MatrixFile::map<double>(path), std::runtime_error);
+		ASSERT_THROW(MatrixFile::load<double>(path), std::runtime_error);
+		MatrixFile::save(path, A.submatrix(1, 2, 10, 20).transposed(), 16);
+		std::filesystem::resize_file(path, 64 + 16 * 8);
+		ASSERT_THROW(MatrixFile::map<double>(path), std::runtime_error);
+		std::filesystem::remove(path);
+		ASSERT_THROW(MatrixFile::map<double>(path), std::system_error);
+
+		const Matrix<std::int16_t> small({ { 1, -2 }, { 3, 4 } });
+		MatrixFile::save(path, small);
+		ASSERT_EQ(MatrixFile::load<std::int16_t>(path), small);
+		ASSERT_THROW(MatrixFile::load<std::uint16_t>(path), std::runtime_error);
+		std::filesystem::remove(path);
+	}
+
+	TEST(MatrixGTest, OutOfCoreTest)
+	{
+		const auto dir = std::filesystem::temp_directory_path();
+		const auto a_path = (dir / "ooc_a.bin").string();
+		const auto b_path = (dir / "ooc_b.bin").string();
+		const auto c_path = (dir / "ooc_c.bin").string();
+
+		// The tiles stay within the budget
+		const auto tiles = OutOfCore::tiling<double>(1000, 800, 600, 1 << 20);
+		ASSERT_LE(2 * sizeof(double) * (tiles.rows * tiles.depth +
+			tiles.depth * tiles.cols + tiles.rows * tiles.cols), std::size_t(1) << 20);
+
+		// A budget of a few tiles, none of the dimensions divides evenly
+		Matrix<int> A(70, 45, fill_type::randi);
+		Matrix<int> B(45, 33, fill_type::randi);
+		MatrixFile::save(a_path, A);
+		MatrixFile::save(b_path, B);
+		OutOfCore::multiply<int>(a_path, b_path, c_path, 6 * 16 * 16 * sizeof(int));
+		ASSERT_EQ(MatrixFile::load<int>(c_path), A * B);
+
+		Matrix<double> D(61, 29, fill_type::rand);
+		MatrixFile::save(a_path, D);
+		MatrixFile::save(b_path, D.transposed());
+		OutOfCore::multiply<double>(a_path, b_path, c_path, 10000);
+		ASSERT_TRUE(MatricesNear(MatrixFile::load<double>(c_path), D * D.transposed()));
+
+		ASSERT_THROW(OutOfCore::multiply<double>(a_path, a_path, c_path), std::runtime_error);
+		for (const auto& path : { a_path, b_path, c_path }) std::filesystem::remove(path);
+	}
+
+	TEST(MatrixGTest, TextTest)
+	{
+		// Columns padded to their widest element, the stream is unchanged
+		std::ostringstream os;
+		os << std::setprecision(7) << Matrix<int>({ { 1, -20 }, { 300, 4 } });
+		ASSERT_EQ(os.str(), "|   1 -20 |\n| 300   4 |\n");
+		ASSERT_EQ(os.precision(), 7);
+
+		os.str({});
+		os << Matrix<double>({ { 0.5, -1.0 / 3 } }) << Matrix<Fraction>({ { Fraction(1, 2) } });
+		ASSERT_EQ(os.str(), "| 0.50 -0.33 |\n| 1/2 |\n");
+
+		// Measured widths match the formatted ones, also where rounding
+		// adds a digit
+		std::string buffer;
+		for (const double value : { 0.0, -0.0, -0.001, 0.125, 9.995, 9.9949, -99.995,
+			99.996, 999.5, 1e14, 123456.789, 1e300 })
+		{
+			for (const int precision : { 0, 1, 2, 5 })
+			{
+				ASSERT_EQ(TextKernels::width(value, precision, buffer),
+					TextKernels::format(value, precision, buffer).size()) << value;
+				ASSERT_EQ(TextKernels::width(float(value), precision, buffer),
+					TextKernels::format(float(value), precision, buffer).size()) << value;
+			}
+		}
+
+		// CSV reads back exactly, strided views included
+		Matrix<double> A(37, 53, fill_type::rand);
+		A[3][4] = -1e300;
+		os.str({});
+		MatrixText::write(os, A.transposed(), MatrixText::csv);
+		ASSERT_EQ(MatrixText::parse<double>(os.str(), ','), Matrix<double>(A.transposed()));
+
+		// The output of operator<<, blanks and empty lines
+		os.str({});
+		os << Matrix<int>({ { 1, 2, 3 }, { 4, 5, 6 } });
+		ASSERT_EQ(MatrixText::parse<int>(os.str()), Matrix<int>({ { 1, 2, 3 }, { 4, 5, 6 } }));
+		ASSERT_EQ(MatrixText::parse<float>("\n 1\t+2.5\r\n\n3  -4e1\n"),
+			Matrix<float>({ { 1.f, 2.5f }, { 3.f, -40.f } }));
+		ASSERT_EQ(MatrixText::parse<int>(" 1 ; 2 \n3;4", ';'), Matrix<int>({ { 1, 2 }, { 3, 4 } }));
+		ASSERT_EQ(MatrixText::parse<int>("").size(), std::make_pair(std::size_t(0), std::size_t(0)));
+
+		ASSERT_THROW(MatrixText::parse<int>("1,2\n3\n", ','), std::runtime_error);
+		ASSERT_THROW(MatrixText::parse<int>("1,2\n3,,\n", ','), std::runtime_error);
+		ASSERT_THROW(MatrixText::parse<int>("1 2.5"), std::runtime_error);
+		ASSERT_THROW(MatrixText::parse<unsigned>("-1"), std::runtime_error);
+		try
+		{
+			(void)MatrixText::parse<int>("1 2\n\n3 x\n");
+			FAIL();
+		}
+		catch (const std::runtime_error& error)
+		{
+			ASSERT_STREQ(error.what(), "text:3: invalid element 'x'");
+		}
+
+		// Large texts are parsed and written in parallel chunks, the results
+		// do not depend on the thread count
+		auto& pool = ThreadPool::instance();
+		Matrix<int> B(600, 300, fill_type::randi);
+		std::string text[2];
+		for (const std::size_t threads : { 1, 4 })
+		{
+			pool.set_thread_count(threads);
+			os.str({});
+			os << B;
+			text[threads == 4] = os.str();
+			ASSERT_EQ(MatrixText::parse<int>(os.str()), B);
+		}
+		pool.set_thread_count(0);
+		ASSERT_EQ(text[0], text[1]);
+
+		const auto path = (std::filesystem::temp_directory_path() / "matrix_text_test.csv").string();
+		MatrixText::save(path, A);
+		ASSERT_EQ(MatrixText::load<double>(path), A);
+		std::filesystem::remove(path);
+		ASSERT_THROW(MatrixText::load<double>(path), std::system_error);
+	}
+
+#if MATRIX_TRACING
+	TEST(MatrixGTest, TracingTest)
+	{
+		using Tracing::op;
+		using Tracing::totals;
+
+		const auto resource = std::pmr::get_default_resource();
+		Tracing::reset();
+		Tracing::enable();
+
+		Matrix<double> A(64, 32, fill_type::rand);
+		const Matrix<double> B(32, 48, fill_type::rand);
+		const Matrix<double> C = A * B;
+		A.transpose();
+
+		// A cyclic shift is not diagonal, 5 = 101b takes two squarings
+		// and one product
+		Matrix<int> shift(16, 16);
+		for (std::size_t i = 0; i < 16; ++i) shift[i][(i + 1) % 16] = 1;
+		const auto power = shift.power(5);
+
+		const auto lu = Matrix<double>(100, 100, fill_type::rand).lu();
+		Tracing::disable();
+		(void)(C * Matrix<double>(48, 4));
+
+		ASSERT_EQ(std::pmr::get_default_resource(), resource);
+		ASSERT_EQ(totals(op::multiply).calls, 1u);
+		ASSERT_EQ(totals(op::multiply).flops, 2u * 64 * 32 * 48);
+		ASSERT_EQ(totals(op::multiply).bytes, (64u * 32 + 32 * 48 + 64 * 48) * sizeof(double));
+		ASSERT_GE(totals(op::multiply).allocations, 1u);
+		ASSERT_GE(totals(op::multiply).allocated_bytes, 64u * 48 * sizeof(double));
+		ASSERT_EQ(totals(op::transpose).calls, 1u);
+		// Three random matrices and the identity L starts out as
+		ASSERT_EQ(totals(op::fill).calls, 4u);
+		ASSERT_EQ(totals(op::power).calls, 1u);
+		ASSERT_EQ(totals(op::power).flops, 3u * 2 * 16 * 16 * 16);
+		ASSERT_EQ(totals(op::lu).calls, 1u);
+		ASSERT_EQ(totals(op::lu_panel).calls, 2u);
+		ASSERT_EQ(totals(op::lu_trsm).calls, 1u);
+		ASSERT_EQ(totals(op::lu_update).calls, 1u);
+		ASSERT_GT(totals(op::lu).nanoseconds, 0u);
+		ASSERT_EQ(totals(op::lu).flops, 2u * 100 * 100 * 100 / 3);
+
+		std::ostringstream trace;
+		Tracing::write_chrome_trace(trace);
+		ASSERT_EQ(trace.str().rfind("{\"traceEvents\":[", 0), 0u);
+		ASSERT_NE(trace.str().find("{\"name\":\"lu_update\",\"cat\":\"matrix\",\"ph\":\"X\""),
+			std::string::npos);
+
+		std::ostringstream summary;
+		Tracing::write_summary(summary);
+		ASSERT_NE(summary.str().find("lu_panel"), std::string::npos);
+		ASSERT_EQ(summary.str().find("dot"), std::string::npos);
+
+		Tracing::reset();
+		ASSERT_EQ(totals(op::multiply).calls, 0u);
+		(void)C;
+		(void)power;
+		(void)lu;
+	}
+#endif
+
 	// Commented out because the test clutters Google-test screen
 
 	/*
@@ -0,0 +1,452 @@
+#pragma once
+
+// Low precision matrix products: int8 and int16 operands, int32 sums
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+#include "CpuFeatures.h"
+#include "GemmKernels.h"
+#include "MatrixScratch.h"
+#include "VectorOps.h"
+
+#if MATRIX_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/*
+* Both operands are packed into 32-bit words that hold consecutive
+* elements of the inner dimension:
+*
+*   pairs  two int16, int8 sign-extended. _mm*_madd_epi16 (or vpdpwssd)
+*          multiplies the pairs of a word of A and of B and adds them to
+*          one int32 sum, so one instruction does two multiply-adds per
+*          output and nothing saturates.
+*   quads  four int8 with AVX512-VNNI: vpdpbusd multiplies unsigned bytes
+*          of A with signed bytes of B. A is stored offset by 128, the
+*          128 * column sums of B are subtracted afterwards.
+*
+* pmaddubsw, the pre-VNNI byte instruction, is not used: its int16 pair
+* sums saturate for int8 operands.
+*
+* A is packed row by row, B in panels of NR columns, so that the micro-
+* kernel broadcasts a word of A and multiplies it with the NR words of the
+* panel, MR rows at a time. Every sum is formed modulo 2^32 whatever the
+* instruction set, so the results are exact whenever they fit in int32.
+*/
+namespace QuantizedKernels
+{
+	// Register tile: MR rows of A by the NR columns of a panel of B
+	inline constexpr std::size_t MR = 4;
+	inline constexpr std::size_t NR = 16;
+
+	// Rows of C per parallel task, a multiple of MR
+	inline constexpr std::size_t MC = 64;
+
+	template<typename T>
+	inline constexpr bool is_supported =
+		std::is_same_v<T, std::int8_t> || std::is_same_v<T, std::int16_t>;
+
+	enum class kernel { scalar, sse2, avx2, avx512bw, avx512vnni };
+
+	// Kernel of the active level, see CpuFeatures::avx512_subsets
+	inline kernel select()
+	{
+		switch (CpuFeatures::active_level())
+		{
+		case CpuFeatures::simd_level::avx512:
+		{
+			const auto& subsets = CpuFeatures::avx512_subsets();
+			if (subsets.bw && subsets.vnni) return kernel::avx512vnni;
+			if (subsets.bw) return kernel::avx512bw;
+			return kernel::avx2;
+		}
+		case CpuFeatures::simd_level::avx2: return kernel::avx2;
+		case CpuFeatures::simd_level::sse2: return kernel::sse2;
+		default: return kernel::scalar;
+		}
+	}
+
+	// Packed A and B of one product, words per row of A = words per
+	// column of B = words
+	struct Packed
+	{
+		bool quads;
+		std::size_t words;
+		std::pmr::vector<std::uint32_t> a;
+		std::pmr::vector<std::uint32_t> b;
+		std::pmr::vector<std::int32_t> column_sums;
+	};
+
+	// Word w of a sequence of elements get(p), zero beyond k
+	template<typename Get>
+	std::uint32_t pack_word(const bool quads, const std::size_t w,
+		const std::size_t k, const std::uint32_t offset, Get&& get)
+	{
+		std::uint32_t word = 0;
+		if (quads)
+		{
+			for (std::size_t t = 0; t < 4 && 4 * w + t < k; ++t)
+			{
+				word |= ((static_cast<std::uint32_t>(get(4 * w + t)) + offset) & 0xff) << (8 * t);
+			}
+			// Padding elements of A are offset as well, B is zero there
+			for (std::size_t t = k > 4 * w ? k - 4 * w : 0; t < 4; ++t)
+			{
+				word |= (offset & 0xff) << (8 * t);
+			}
+		}
+		else
+		{
+			for (std::size_t t = 0; t < 2 && 2 * w + t < k; ++t)
+			{
+				word |= (static_cast<std::uint32_t>(get(2 * w + t)) & 0xffff) << (16 * t);
+			}
+		}
+		return word;
+	}
+
+	template<typename T>
+	Packed pack(const std::size_t m, const std::size_t n, const std::size_t k,
+		const GemmKernels::Operand<T>& a, const GemmKernels::Operand<T>& b, const bool quads)
+	{
+		const auto resource = MatrixScratch::resource();
+		const auto words = quads ? (k + 3) / 4 : (k + 1) / 2;
+		const auto panels = (n + NR - 1) / NR;
+		Packed packed{ quads, words,
+			std::pmr::vector<std::uint32_t>(m * words, resource),
+			std::pmr::vector<std::uint32_t>(panels * words * NR, resource),
+			std::pmr::vector<std::int32_t>(quads ? panels * NR : 0, 0, resource) };
+
+		const std::uint32_t offset = quads ? 128 : 0;
+		VectorOperations::for_ranges(m, k, [&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				for (std::size_t w = 0; w < words; ++w)
+				{
+					packed.a[i * words + w] = pack_word(quads, w, k, offset,
+						[&](const std::size_t p) { return a(i, p); });
+				}
+			}
+		});
+
+		VectorOperations::for_ranges(panels, k * NR, [&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto q = begin; q < end; ++q)
+			{
+				std::uint32_t* panel = packed.b.data() + q * words * NR;
+				for (std::size_t c = 0; c < NR; ++c)
+				{
+					const auto j = q * NR + c;
+					if (j >= n)
+					{
+						for (std::size_t w = 0; w < words; ++w) panel[w * NR + c] = 0;
+						continue;
+					}
+					for (std::size_t w = 0; w < words; ++w)
+					{
+						panel[w * NR + c] = pack_word(quads, w, k, 0,
+							[&](const std::size_t p) { return b(p, j); });
+					}
+					if (quads)
+					{
+						std::int32_t sum = 0;
+						for (std::size_t p = 0; p < k; ++p) sum += b(p, j);
+						packed.column_sums[j] = sum;
+					}
+				}
+			}
+		});
+		return packed;
+	}
+
+	// The micro-kernels: tile[r * NR + c] = sum over the words of row r of
+	// A with column c of the panel, R <= MR rows
+
+	namespace Scalar
+	{
+		template<std::size_t R>
+		void tile(const std::size_t words, const std::uint32_t* a, const std::size_t lda,
+			const std::uint32_t* b, std::int32_t* out)
+		{
+			// Unsigned arithmetic wraps like the SIMD instructions
+			std::uint32_t acc[R][NR] = {};
+			for (std::size_t w = 0; w < words; ++w)
+			{
+				for (std::size_t r = 0; r < R; ++r)
+				{
+					const auto word = a[r * lda + w];
+					const auto a0 = static_cast<std::int16_t>(word & 0xffff);
+					const auto a1 = static_cast<std::int16_t>(word >> 16);
+					for (std::size_t c = 0; c < NR; ++c)
+					{
+						const auto b_word = b[w * NR + c];
+						acc[r][c] += static_cast<std::uint32_t>(a0 * static_cast<std::int16_t>(b_word & 0xffff)) +
+							static_cast<std::uint32_t>(a1 * static_cast<std::int16_t>(b_word >> 16));
+					}
+				}
+			}
+			for (std::size_t r = 0; r < R; ++r)
+			{
+				for (std::size_t c = 0; c < NR; ++c)
+				{
+					out[r * NR + c] = static_cast<std::int32_t>(acc[r][c]);
+				}
+			}
+		}
+	}
+
+#if MATRIX_SIMD_X86
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+	namespace Sse2
+	{
+		template<std::size_t R>
+		void tile(const std::size_t words, const std::uint32_t* a, const std::size_t lda,
+			const std::uint32_t* b, std::int32_t* out)
+		{
+			__m128i acc[R][4];
+			for (auto& row : acc)
+			{
+				for (auto& v : row) v = _mm_setzero_si128();
+			}
+			for (std::size_t w = 0; w < words; ++w)
+			{
+				__m128i panel[4];
+				for (std::size_t v = 0; v < 4; ++v)
+				{
+					panel[v] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + w * NR + 4 * v));
+				}
+				for (std::size_t r = 0; r < R; ++r)
+				{
+					const auto word = _mm_set1_epi32(static_cast<int>(a[r * lda + w]));
+					for (std::size_t v = 0; v < 4; ++v)
+					{
+						acc[r][v] = _mm_add_epi32(acc[r][v], _mm_madd_epi16(word, panel[v]));
+					}
+				}
+			}
+			for (std::size_t r = 0; r < R; ++r)
+			{
+				for (std::size_t v = 0; v < 4; ++v)
+				{
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + r * NR + 4 * v), acc[r][v]);
+				}
+			}
+		}
+	}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+	namespace Avx2
+	{
+		template<std::size_t R>
+		void tile(const std::size_t words, const std::uint32_t* a, const std::size_t lda,
+			const std::uint32_t* b, std::int32_t* out)
+		{
+			__m256i acc[R][2];
+			for (auto& row : acc)
+			{
+				for (auto& v : row) v = _mm256_setzero_si256();
+			}
+			for (std::size_t w = 0; w < words; ++w)
+			{
+				const auto lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + w * NR));
+				const auto hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + w * NR + 8));
+				for (std::size_t r = 0; r < R; ++r)
+				{
+					const auto word = _mm256_set1_epi32(static_cast<int>(a[r * lda + w]));
+					acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_madd_epi16(word, lo));
+					acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_madd_epi16(word, hi));
+				}
+			}
+			for (std::size_t r = 0; r < R; ++r)
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + r * NR), acc[r][0]);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + r * NR + 8), acc[r][1]);
+			}
+		}
+	}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bw"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#endif
+
+	namespace Avx512Bw
+	{
+		template<std::size_t R>
+		void tile(const std::size_t words, const std::uint32_t* a, const std::size_t lda,
+			const std::uint32_t* b, std::int32_t* out)
+		{
+			__m512i acc[R];
+			for (auto& v : acc) v = _mm512_setzero_si512();
+			for (std::size_t w = 0; w < words; ++w)
+			{
+				const auto panel = _mm512_loadu_si512(b + w * NR);
+				for (std::size_t r = 0; r < R; ++r)
+				{
+					const auto word = _mm512_set1_epi32(static_cast<int>(a[r * lda + w]));
+					acc[r] = _mm512_add_epi32(acc[r], _mm512_madd_epi16(word, panel));
+				}
+			}
+			for (std::size_t r = 0; r < R; ++r)
+			{
+				_mm512_storeu_si512(out + r * NR, acc[r]);
+			}
+		}
+	}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bw,avx512vnni"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vnni")
+#endif
+
+	namespace Avx512Vnni
+	{
+		// Quads multiply unsigned bytes of A with signed bytes of B, pairs
+		// int16 with int16
+		template<std::size_t R, bool Quads>
+		void tile(const std::size_t words, const std::uint32_t* a, const std::size_t lda,
+			const std::uint32_t* b, std::int32_t* out)
+		{
+			__m512i acc[R];
+			for (auto& v : acc) v = _mm512_setzero_si512();
+			for (std::size_t w = 0; w < words; ++w)
+			{
+				const auto panel = _mm512_loadu_si512(b + w * NR);
+				for (std::size_t r = 0; r < R; ++r)
+				{
+					const auto word = _mm512_set1_epi32(static_cast<int>(a[r * lda + w]));
+					acc[r] = Quads ? _mm512_dpbusd_epi32(acc[r], word, panel) :
+						_mm512_dpwssd_epi32(acc[r], word, panel);
+				}
+			}
+			for (std::size_t r = 0; r < R; ++r)
+			{
+				_mm512_storeu_si512(out + r * NR, acc[r]);
+			}
+		}
+	}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // MATRIX_SIMD_X86
+
+	template<std::size_t R>
+	void tile(const kernel k, const Packed& packed, const std::uint32_t* a,
+		const std::uint32_t* b, std::int32_t* out)
+	{
+		const auto words = packed.words;
+		switch (k)
+		{
+#if MATRIX_SIMD_X86
+		case kernel::avx512vnni:
+			return packed.quads ? Avx512Vnni::tile<R, true>(words, a, words, b, out) :
+				Avx512Vnni::tile<R, false>(words, a, words, b, out);
+		case kernel::avx512bw: return Avx512Bw::tile<R>(words, a, words, b, out);
+		case kernel::avx2: return Avx2::tile<R>(words, a, words, b, out);
+		case kernel::sse2: return Sse2::tile<R>(words, a, words, b, out);
+#endif
+		default: return Scalar::tile<R>(words, a, words, b, out);
+		}
+	}
+
+	/*
+	* C = A * B with int32 sums, A is m x k and B is k x n, both int8 or
+	* both int16. C is overwritten. Large products run on the thread pool,
+	* in tiles of MC rows and NR columns.
+	*/
+	template<typename T>
+	void gemm(const std::size_t m, const std::size_t n, const std::size_t k,
+		const GemmKernels::Operand<T>& a, const GemmKernels::Operand<T>& b,
+		std::int32_t* c, const std::size_t ldc)
+	{
+		static_assert(is_supported<T>, "int8_t or int16_t operands only");
+
+		const auto selected = select();
+		const bool quads = std::is_same_v<T, std::int8_t> && selected == kernel::avx512vnni;
+		const auto packed = pack(m, n, k, a, b, quads);
+
+		const auto row_blocks = (m + MC - 1) / MC;
+		const auto panels = (n + NR - 1) / NR;
+		VectorOperations::for_ranges(row_blocks * panels, MC * NR * k,
+			[&](const std::size_t begin, const std::size_t end)
+		{
+			std::int32_t out[MR * NR];
+			for (auto t = begin; t < end; ++t)
+			{
+				const auto q = t % panels;
+				const auto j0 = q * NR;
+				const auto cols = std::min(NR, n - j0);
+				const std::uint32_t* panel = packed.b.data() + q * packed.words * NR;
+				const auto i_end = std::min(m, t / panels * MC + MC);
+				for (auto i0 = t / panels * MC; i0 < i_end; i0 += MR)
+				{
+					const auto rows = std::min(MR, i_end - i0);
+					const std::uint32_t* rows_a = packed.a.data() + i0 * packed.words;
+					switch (rows)
+					{
+					case 4: tile<4>(selected, packed, rows_a, panel, out); break;
+					case 3: tile<3>(selected, packed, rows_a, panel, out); break;
+					case 2: tile<2>(selected, packed, rows_a, panel, out); break;
+					default: tile<1>(selected, packed, rows_a, panel, out); break;
+					}
+					for (std::size_t r = 0; r < rows; ++r)
+					{
+						std::int32_t* c_row = c + (i0 + r) * ldc + j0;
+						for (std::size_t col = 0; col < cols; ++col)
+						{
+							// Wraps like the sums, see the header comment
+							c_row[col] = quads ? static_cast<std::int32_t>(
+								static_cast<std::uint32_t>(out[r * NR + col]) -
+								128u * static_cast<std::uint32_t>(packed.column_sums[j0 + col])) :
+								out[r * NR + col];
+						}
+					}
+				}
+			}
+		});
+	}
+}
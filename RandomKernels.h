@@ -0,0 +1,111 @@
+#pragma once
+
+// Counter-based random fills
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include "SimdKernels.h"
+#include "VectorOps.h"
+
+// Distributions of Matrix::fill_random
+namespace Random
+{
+	// Whole numbers in [min, max]
+	struct uniform_int
+	{
+		int min;
+		int max;
+	};
+
+	// Reals in [min, max)
+	struct uniform_real
+	{
+		double min;
+		double max;
+	};
+
+	struct normal
+	{
+		double mean;
+		double stddev;
+	};
+}
+
+/*
+* Element k of a fill is computed from the Philox block with counter k
+* and the seed as key, see SimdKernels::philox_word. No generator state
+* is carried from one element to the next, so any part of the range can be
+* generated independently: the fills run on the thread pool and give the
+* same bits for every thread count and instruction set.
+*/
+namespace RandomKernels
+{
+	// Elements generated per call of the SIMD kernel
+	inline constexpr std::size_t chunk_size = 256;
+
+	// Seeds of the fills that are not given one. Different on every call
+	// and in every run.
+	inline std::uint64_t next_seed()
+	{
+		static std::atomic<std::uint64_t> seed{
+			(std::uint64_t(std::random_device{}()) << 32) ^ std::random_device{}() };
+		return seed.fetch_add(0x9E3779B97F4A7C15, std::memory_order_relaxed);
+	}
+
+	// Maps 64 random bits to a value of the distribution. Integers use the
+	// upper 32 bits scaled to the range, the bias is below range / 2^32.
+	template<typename T>
+	T draw(const Random::uniform_int& dist, const std::uint64_t bits)
+	{
+		const auto range = static_cast<std::uint64_t>(
+			static_cast<std::int64_t>(dist.max) - dist.min) + 1;
+		const auto offset = static_cast<std::int64_t>(((bits >> 32) * range) >> 32);
+		return static_cast<T>(static_cast<int>(dist.min + offset));
+	}
+
+	template<typename T>
+	T draw(const Random::uniform_real& dist, const std::uint64_t bits)
+	{
+		// 53 bits fill the mantissa of a double in [0, 1)
+		const double unit = static_cast<double>(bits >> 11) * 0x1.0p-53;
+		return static_cast<T>(dist.min + (dist.max - dist.min) * unit);
+	}
+
+	template<typename T>
+	T draw(const Random::normal& dist, const std::uint64_t bits)
+	{
+		// Box-Muller with the two 32-bit halves, u1 in (0, 1], u2 in [0, 1)
+		constexpr double two_pi = 6.283185307179586;
+		const double u1 = (static_cast<double>(bits >> 32) + 1.0) * 0x1.0p-32;
+		const double u2 = static_cast<double>(bits & 0xffffffff) * 0x1.0p-32;
+		return static_cast<T>(dist.mean +
+			dist.stddev * std::sqrt(-2.0 * std::log(u1)) * std::cos(two_pi * u2));
+	}
+
+	// dst[k] = draw(dist, philox_word(k, seed)) for k in [0, n)
+	template<typename T, typename Dist>
+	void fill(T* dst, const std::size_t n, const Dist& dist, const std::uint64_t seed)
+	{
+		// About the cost of a Philox block relative to an addition
+		constexpr std::size_t item_cost = 16;
+
+		VectorOperations::for_ranges(n, item_cost,
+			[=](const std::size_t begin, const std::size_t end)
+			{
+				std::uint64_t bits[chunk_size];
+				for (auto first = begin; first < end; first += chunk_size)
+				{
+					const auto count = std::min(chunk_size, end - first);
+					SimdKernels::philox(bits, first, count, seed);
+					for (std::size_t i = 0; i < count; ++i)
+					{
+						dst[first + i] = draw<T>(dist, bits[i]);
+					}
+				}
+			});
+	}
+}
@@ -0,0 +1,658 @@
+#pragma once
+
+// Explicit SSE2 / AVX2 / AVX-512 kernels for the element-wise operations
+// in VectorOperations, the random number generator of RandomKernels and
+// the products of MatrixBatch. The instruction set is chosen at runtime
+// (see CpuFeatures), so a single binary runs the widest kernel the CPU
+// supports.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "CpuFeatures.h"
+
+#if MATRIX_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace SimdKernels
+{
+	// Kernel element type for T, void if there are no kernels for T.
+	// Unsigned 32-bit integers keep an unsigned kernel type, so the scalar
+	// tails wrap around like the element type. The vector code is shared
+	// with int32_t as two's complement addition, subtraction and
+	// multiplication are sign agnostic.
+	template<typename T>
+	using kernel_type_t =
+		std::conditional_t<std::is_same_v<T, double>, double,
+		std::conditional_t<std::is_same_v<T, float>, float,
+		std::conditional_t<std::is_integral_v<T> && sizeof(T) == 4
+			&& !std::is_same_v<T, bool>,
+			std::conditional_t<std::is_signed_v<T>, std::int32_t, std::uint32_t>,
+		void>>>;
+
+	template<typename T>
+	inline constexpr bool is_supported = !std::is_void_v<kernel_type_t<T>>;
+
+	// Matrices per group of the interleaved batch layout (see
+	// matrix_batch.h), a multiple of every vector width
+	inline constexpr std::size_t batch_lanes = 16;
+
+	// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as
+	// 1, 2, 3"). The counter of a block is (counter, 0), the key is split
+	// into two 32-bit words. Returns the first two output words.
+	inline constexpr std::uint32_t philox_m0 = 0xD2511F53;
+	inline constexpr std::uint32_t philox_m1 = 0xCD9E8D57;
+	inline constexpr std::uint32_t philox_w0 = 0x9E3779B9;
+	inline constexpr std::uint32_t philox_w1 = 0xBB67AE85;
+
+	inline std::uint64_t philox_word(const std::uint64_t counter, const std::uint64_t key)
+	{
+		std::uint64_t x0 = counter & 0xffffffff, x1 = counter >> 32, x2 = 0, x3 = 0;
+		std::uint64_t k0 = key & 0xffffffff, k1 = key >> 32;
+		for (int round = 0; round < 10; ++round)
+		{
+			const auto p0 = philox_m0 * x0;
+			const auto p1 = philox_m1 * x2;
+			x0 = (p1 >> 32) ^ x1 ^ k0;
+			x1 = p1 & 0xffffffff;
+			x2 = (p0 >> 32) ^ x3 ^ k1;
+			x3 = p0 & 0xffffffff;
+			k0 = (k0 + philox_w0) & 0xffffffff;
+			k1 = (k1 + philox_w1) & 0xffffffff;
+		}
+		return x0 | x1 << 32;
+	}
+
+	// Width 1 traits for the portable path
+	namespace Scalar
+	{
+		template<typename T>
+		struct Vec
+		{
+			using type = T;
+			static constexpr std::size_t width = 1;
+			static constexpr bool has_mul = true;
+
+			static type load(const T* p) { return *p; }
+			static void store(T* p, const type v) { *p = v; }
+			static type set1(const T v) { return v; }
+			static type add(const type a, const type b) { return a + b; }
+			static type sub(const type a, const type b) { return a - b; }
+			static type mul(const type a, const type b) { return a * b; }
+			static bool all_eq(const type a, const type b) { return a == b; }
+		};
+
+		// 64-bit lanes holding 32-bit values, for the Philox rounds
+		template<>
+		struct Vec<std::uint64_t>
+		{
+			using type = std::uint64_t;
+			static constexpr std::size_t width = 1;
+
+			static void store(std::uint64_t* p, const type v) { *p = v; }
+			static type set1(const std::uint64_t v) { return v; }
+			static type iota() { return 0; }
+			static type add(const type a, const type b) { return a + b; }
+			static type and_(const type a, const type b) { return a & b; }
+			static type or_(const type a, const type b) { return a | b; }
+			static type xor_(const type a, const type b) { return a ^ b; }
+			static type shr32(const type a) { return a >> 32; }
+			static type shl32(const type a) { return a << 32; }
+			static type mul32(const type a, const type b)
+			{
+				return (a & 0xffffffff) * (b & 0xffffffff);
+			}
+		};
+
+#include "SimdLoops.inl"
+	}
+
+#if MATRIX_SIMD_X86
+
+	// SSE2
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+	namespace Sse2
+	{
+		template<typename T>
+		struct Vec;
+
+		template<>
+		struct Vec<double>
+		{
+			using type = __m128d;
+			static constexpr std::size_t width = 2;
+			static constexpr bool has_mul = true;
+
+			static type load(const double* p) { return _mm_loadu_pd(p); }
+			static void store(double* p, const type v) { _mm_storeu_pd(p, v); }
+			static type set1(const double v) { return _mm_set1_pd(v); }
+			static type add(const type a, const type b) { return _mm_add_pd(a, b); }
+			static type sub(const type a, const type b) { return _mm_sub_pd(a, b); }
+			static type mul(const type a, const type b) { return _mm_mul_pd(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm_movemask_pd(_mm_cmpeq_pd(a, b)) == 0x3;
+			}
+		};
+
+		template<>
+		struct Vec<float>
+		{
+			using type = __m128;
+			static constexpr std::size_t width = 4;
+			static constexpr bool has_mul = true;
+
+			static type load(const float* p) { return _mm_loadu_ps(p); }
+			static void store(float* p, const type v) { _mm_storeu_ps(p, v); }
+			static type set1(const float v) { return _mm_set1_ps(v); }
+			static type add(const type a, const type b) { return _mm_add_ps(a, b); }
+			static type sub(const type a, const type b) { return _mm_sub_ps(a, b); }
+			static type mul(const type a, const type b) { return _mm_mul_ps(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm_movemask_ps(_mm_cmpeq_ps(a, b)) == 0xf;
+			}
+		};
+
+		// SSE2 has no packed 32-bit multiply (pmulld is SSE4.1)
+		template<>
+		struct Vec<std::int32_t>
+		{
+			using type = __m128i;
+			static constexpr std::size_t width = 4;
+			static constexpr bool has_mul = false;
+
+			static type load(const std::int32_t* p)
+			{
+				return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			}
+			static void store(std::int32_t* p, const type v)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+			}
+			static type set1(const std::int32_t v) { return _mm_set1_epi32(v); }
+			static type add(const type a, const type b) { return _mm_add_epi32(a, b); }
+			static type sub(const type a, const type b) { return _mm_sub_epi32(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm_movemask_epi8(_mm_cmpeq_epi32(a, b)) == 0xffff;
+			}
+		};
+
+		// Unsigned lanes run the int32_t code
+		template<>
+		struct Vec<std::uint32_t> : Vec<std::int32_t>
+		{
+			static type load(const std::uint32_t* p)
+			{
+				return Vec<std::int32_t>::load(reinterpret_cast<const std::int32_t*>(p));
+			}
+			static void store(std::uint32_t* p, const type v)
+			{
+				Vec<std::int32_t>::store(reinterpret_cast<std::int32_t*>(p), v);
+			}
+			static type set1(const std::uint32_t v)
+			{
+				return Vec<std::int32_t>::set1(static_cast<std::int32_t>(v));
+			}
+		};
+
+		// 64-bit lanes holding 32-bit values, for the Philox rounds.
+		// pmuludq multiplies the low 32 bits of each 64-bit lane
+		template<>
+		struct Vec<std::uint64_t>
+		{
+			using type = __m128i;
+			static constexpr std::size_t width = 2;
+
+			static void store(std::uint64_t* p, const type v)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+			}
+			static type set1(const std::uint64_t v) { return _mm_set1_epi64x(static_cast<long long>(v)); }
+			static type iota() { return _mm_set_epi64x(1, 0); }
+			static type add(const type a, const type b) { return _mm_add_epi64(a, b); }
+			static type and_(const type a, const type b) { return _mm_and_si128(a, b); }
+			static type or_(const type a, const type b) { return _mm_or_si128(a, b); }
+			static type xor_(const type a, const type b) { return _mm_xor_si128(a, b); }
+			static type shr32(const type a) { return _mm_srli_epi64(a, 32); }
+			static type shl32(const type a) { return _mm_slli_epi64(a, 32); }
+			static type mul32(const type a, const type b) { return _mm_mul_epu32(a, b); }
+		};
+
+#include "SimdLoops.inl"
+	}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+	// AVX2
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+	namespace Avx2
+	{
+		template<typename T>
+		struct Vec;
+
+		template<>
+		struct Vec<double>
+		{
+			using type = __m256d;
+			static constexpr std::size_t width = 4;
+			static constexpr bool has_mul = true;
+
+			static type load(const double* p) { return _mm256_loadu_pd(p); }
+			static void store(double* p, const type v) { _mm256_storeu_pd(p, v); }
+			static type set1(const double v) { return _mm256_set1_pd(v); }
+			static type add(const type a, const type b) { return _mm256_add_pd(a, b); }
+			static type sub(const type a, const type b) { return _mm256_sub_pd(a, b); }
+			static type mul(const type a, const type b) { return _mm256_mul_pd(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)) == 0xf;
+			}
+		};
+
+		template<>
+		struct Vec<float>
+		{
+			using type = __m256;
+			static constexpr std::size_t width = 8;
+			static constexpr bool has_mul = true;
+
+			static type load(const float* p) { return _mm256_loadu_ps(p); }
+			static void store(float* p, const type v) { _mm256_storeu_ps(p, v); }
+			static type set1(const float v) { return _mm256_set1_ps(v); }
+			static type add(const type a, const type b) { return _mm256_add_ps(a, b); }
+			static type sub(const type a, const type b) { return _mm256_sub_ps(a, b); }
+			static type mul(const type a, const type b) { return _mm256_mul_ps(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)) == 0xff;
+			}
+		};
+
+		template<>
+		struct Vec<std::int32_t>
+		{
+			using type = __m256i;
+			static constexpr std::size_t width = 8;
+			static constexpr bool has_mul = true;
+
+			static type load(const std::int32_t* p)
+			{
+				return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			}
+			static void store(std::int32_t* p, const type v)
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+			}
+			static type set1(const std::int32_t v) { return _mm256_set1_epi32(v); }
+			static type add(const type a, const type b) { return _mm256_add_epi32(a, b); }
+			static type sub(const type a, const type b) { return _mm256_sub_epi32(a, b); }
+			static type mul(const type a, const type b) { return _mm256_mullo_epi32(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm256_movemask_epi8(_mm256_cmpeq_epi32(a, b)) == -1;
+			}
+		};
+
+		// Unsigned lanes run the int32_t code
+		template<>
+		struct Vec<std::uint32_t> : Vec<std::int32_t>
+		{
+			static type load(const std::uint32_t* p)
+			{
+				return Vec<std::int32_t>::load(reinterpret_cast<const std::int32_t*>(p));
+			}
+			static void store(std::uint32_t* p, const type v)
+			{
+				Vec<std::int32_t>::store(reinterpret_cast<std::int32_t*>(p), v);
+			}
+			static type set1(const std::uint32_t v)
+			{
+				return Vec<std::int32_t>::set1(static_cast<std::int32_t>(v));
+			}
+		};
+
+		// 64-bit lanes holding 32-bit values, for the Philox rounds
+		template<>
+		struct Vec<std::uint64_t>
+		{
+			using type = __m256i;
+			static constexpr std::size_t width = 4;
+
+			static void store(std::uint64_t* p, const type v)
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+			}
+			static type set1(const std::uint64_t v) { return _mm256_set1_epi64x(static_cast<long long>(v)); }
+			static type iota() { return _mm256_set_epi64x(3, 2, 1, 0); }
+			static type add(const type a, const type b) { return _mm256_add_epi64(a, b); }
+			static type and_(const type a, const type b) { return _mm256_and_si256(a, b); }
+			static type or_(const type a, const type b) { return _mm256_or_si256(a, b); }
+			static type xor_(const type a, const type b) { return _mm256_xor_si256(a, b); }
+			static type shr32(const type a) { return _mm256_srli_epi64(a, 32); }
+			static type shl32(const type a) { return _mm256_slli_epi64(a, 32); }
+			static type mul32(const type a, const type b) { return _mm256_mul_epu32(a, b); }
+		};
+
+#include "SimdLoops.inl"
+	}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+	// AVX-512 (foundation subset only)
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+	namespace Avx512
+	{
+		template<typename T>
+		struct Vec;
+
+		template<>
+		struct Vec<double>
+		{
+			using type = __m512d;
+			static constexpr std::size_t width = 8;
+			static constexpr bool has_mul = true;
+
+			static type load(const double* p) { return _mm512_loadu_pd(p); }
+			static void store(double* p, const type v) { _mm512_storeu_pd(p, v); }
+			static type set1(const double v) { return _mm512_set1_pd(v); }
+			static type add(const type a, const type b) { return _mm512_add_pd(a, b); }
+			static type sub(const type a, const type b) { return _mm512_sub_pd(a, b); }
+			static type mul(const type a, const type b) { return _mm512_mul_pd(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ) == 0xff;
+			}
+		};
+
+		template<>
+		struct Vec<float>
+		{
+			using type = __m512;
+			static constexpr std::size_t width = 16;
+			static constexpr bool has_mul = true;
+
+			static type load(const float* p) { return _mm512_loadu_ps(p); }
+			static void store(float* p, const type v) { _mm512_storeu_ps(p, v); }
+			static type set1(const float v) { return _mm512_set1_ps(v); }
+			static type add(const type a, const type b) { return _mm512_add_ps(a, b); }
+			static type sub(const type a, const type b) { return _mm512_sub_ps(a, b); }
+			static type mul(const type a, const type b) { return _mm512_mul_ps(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ) == 0xffff;
+			}
+		};
+
+		template<>
+		struct Vec<std::int32_t>
+		{
+			using type = __m512i;
+			static constexpr std::size_t width = 16;
+			static constexpr bool has_mul = true;
+
+			static type load(const std::int32_t* p) { return _mm512_loadu_si512(p); }
+			static void store(std::int32_t* p, const type v) { _mm512_storeu_si512(p, v); }
+			static type set1(const std::int32_t v) { return _mm512_set1_epi32(v); }
+			static type add(const type a, const type b) { return _mm512_add_epi32(a, b); }
+			static type sub(const type a, const type b) { return _mm512_sub_epi32(a, b); }
+			static type mul(const type a, const type b) { return _mm512_mullo_epi32(a, b); }
+			static bool all_eq(const type a, const type b)
+			{
+				return _mm512_cmpeq_epi32_mask(a, b) == 0xffff;
+			}
+		};
+
+		// Unsigned lanes run the int32_t code
+		template<>
+		struct Vec<std::uint32_t> : Vec<std::int32_t>
+		{
+			static type load(const std::uint32_t* p)
+			{
+				return Vec<std::int32_t>::load(reinterpret_cast<const std::int32_t*>(p));
+			}
+			static void store(std::uint32_t* p, const type v)
+			{
+				Vec<std::int32_t>::store(reinterpret_cast<std::int32_t*>(p), v);
+			}
+			static type set1(const std::uint32_t v)
+			{
+				return Vec<std::int32_t>::set1(static_cast<std::int32_t>(v));
+			}
+		};
+
+		// 64-bit lanes holding 32-bit values, for the Philox rounds
+		template<>
+		struct Vec<std::uint64_t>
+		{
+			using type = __m512i;
+			static constexpr std::size_t width = 8;
+
+			static void store(std::uint64_t* p, const type v)
+			{
+				_mm512_storeu_si512(p, v);
+			}
+			static type set1(const std::uint64_t v) { return _mm512_set1_epi64(static_cast<long long>(v)); }
+			static type iota() { return _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0); }
+			static type add(const type a, const type b) { return _mm512_add_epi64(a, b); }
+			static type and_(const type a, const type b) { return _mm512_and_si512(a, b); }
+			static type or_(const type a, const type b) { return _mm512_or_si512(a, b); }
+			static type xor_(const type a, const type b) { return _mm512_xor_si512(a, b); }
+			static type shr32(const type a) { return _mm512_srli_epi64(a, 32); }
+			static type shl32(const type a) { return _mm512_slli_epi64(a, 32); }
+			static type mul32(const type a, const type b) { return _mm512_mul_epu32(a, b); }
+		};
+
+#include "SimdLoops.inl"
+	}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // MATRIX_SIMD_X86
+
+	// Entry points. The arguments are reinterpreted as the kernel type and
+	// the loop of the active level is called.
+
+	template<typename T>
+	void add(T* dst, const T* lhs, const T* rhs, const std::size_t n)
+	{
+		using K = kernel_type_t<T>;
+		auto* d = reinterpret_cast<K*>(dst);
+		const auto* l = reinterpret_cast<const K*>(lhs);
+		const auto* r = reinterpret_cast<const K*>(rhs);
+
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return Avx512::add(d, l, r, n);
+		case CpuFeatures::simd_level::avx2: return Avx2::add(d, l, r, n);
+		case CpuFeatures::simd_level::sse2: return Sse2::add(d, l, r, n);
+#endif
+		default: return Scalar::add(d, l, r, n);
+		}
+	}
+
+	template<typename T>
+	void subtract(T* dst, const T* lhs, const T* rhs, const std::size_t n)
+	{
+		using K = kernel_type_t<T>;
+		auto* d = reinterpret_cast<K*>(dst);
+		const auto* l = reinterpret_cast<const K*>(lhs);
+		const auto* r = reinterpret_cast<const K*>(rhs);
+
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return Avx512::subtract(d, l, r, n);
+		case CpuFeatures::simd_level::avx2: return Avx2::subtract(d, l, r, n);
+		case CpuFeatures::simd_level::sse2: return Sse2::subtract(d, l, r, n);
+#endif
+		default: return Scalar::subtract(d, l, r, n);
+		}
+	}
+
+	template<typename T>
+	void scale(T* dst, const T scalar, const std::size_t n)
+	{
+		using K = kernel_type_t<T>;
+		auto* d = reinterpret_cast<K*>(dst);
+		const auto s = static_cast<K>(scalar);
+
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return Avx512::scale(d, s, n);
+		case CpuFeatures::simd_level::avx2: return Avx2::scale(d, s, n);
+		case CpuFeatures::simd_level::sse2: return Sse2::scale(d, s, n);
+#endif
+		default: return Scalar::scale(d, s, n);
+		}
+	}
+
+	template<typename T>
+	void axpy(T* dst, const T alpha, const T* x, const std::size_t n)
+	{
+		using K = kernel_type_t<T>;
+		auto* d = reinterpret_cast<K*>(dst);
+		const auto a = static_cast<K>(alpha);
+		const auto* src = reinterpret_cast<const K*>(x);
+
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return Avx512::axpy(d, a, src, n);
+		case CpuFeatures::simd_level::avx2: return Avx2::axpy(d, a, src, n);
+		case CpuFeatures::simd_level::sse2: return Sse2::axpy(d, a, src, n);
+#endif
+		default: return Scalar::axpy(d, a, src, n);
+		}
+	}
+
+	template<typename T>
+	bool equal(const T* lhs, const T* rhs, const std::size_t n)
+	{
+		using K = kernel_type_t<T>;
+		const auto* l = reinterpret_cast<const K*>(lhs);
+		const auto* r = reinterpret_cast<const K*>(rhs);
+
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return Avx512::equal(l, r, n);
+		case CpuFeatures::simd_level::avx2: return Avx2::equal(l, r, n);
+		case CpuFeatures::simd_level::sse2: return Sse2::equal(l, r, n);
+#endif
+		default: return Scalar::equal(l, r, n);
+		}
+	}
+
+	template<typename T>
+	bool all_equal(const T* src, const T value, const std::size_t n)
+	{
+		using K = kernel_type_t<T>;
+		const auto* s = reinterpret_cast<const K*>(src);
+		const auto v = static_cast<K>(value);
+
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return Avx512::all_equal(s, v, n);
+		case CpuFeatures::simd_level::avx2: return Avx2::all_equal(s, v, n);
+		case CpuFeatures::simd_level::sse2: return Sse2::all_equal(s, v, n);
+#endif
+		default: return Scalar::all_equal(s, v, n);
+		}
+	}
+
+	// c = a * b for a group of batch_lanes interleaved m x k and k x n
+	// matrices, see batch_gemm in SimdLoops.inl
+	template<typename T>
+	void batch_gemm(T* c, const T* a, const T* b,
+		const std::size_t m, const std::size_t k, const std::size_t n)
+	{
+		using K = kernel_type_t<T>;
+		auto* dst = reinterpret_cast<K*>(c);
+		const auto* lhs = reinterpret_cast<const K*>(a);
+		const auto* rhs = reinterpret_cast<const K*>(b);
+
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return Avx512::batch_gemm(dst, lhs, rhs, m, k, n);
+		case CpuFeatures::simd_level::avx2: return Avx2::batch_gemm(dst, lhs, rhs, m, k, n);
+		case CpuFeatures::simd_level::sse2: return Sse2::batch_gemm(dst, lhs, rhs, m, k, n);
+#endif
+		default: return Scalar::batch_gemm(dst, lhs, rhs, m, k, n);
+		}
+	}
+
+	// out[i] = philox_word(first + i, key) for i in [0, n). The same on
+	// every level, only the number of blocks per instruction differs.
+	inline void philox(std::uint64_t* out, const std::uint64_t first,
+		const std::size_t n, const std::uint64_t key)
+	{
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return Avx512::philox(out, first, n, key);
+		case CpuFeatures::simd_level::avx2: return Avx2::philox(out, first, n, key);
+		case CpuFeatures::simd_level::sse2: return Sse2::philox(out, first, n, key);
+#endif
+		default: return Scalar::philox(out, first, n, key);
+		}
+	}
+
+	template<typename T>
+	T dot(const T* lhs, const T* rhs, const std::size_t n)
+	{
+		using K = kernel_type_t<T>;
+		const auto* l = reinterpret_cast<const K*>(lhs);
+		const auto* r = reinterpret_cast<const K*>(rhs);
+
+		switch (CpuFeatures::active_level())
+		{
+#if MATRIX_SIMD_X86
+		case CpuFeatures::simd_level::avx512: return T(Avx512::dot(l, r, n));
+		case CpuFeatures::simd_level::avx2: return T(Avx2::dot(l, r, n));
+		case CpuFeatures::simd_level::sse2: return T(Sse2::dot(l, r, n));
+#endif
+		default: return T(Scalar::dot(l, r, n));
+		}
+	}
+}
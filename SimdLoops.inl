@@ -0,0 +1,238 @@
+// Element-wise SIMD loops.
+//
+// Deliberately without an include guard: SimdKernels.h includes this file
+// once per instruction set, inside a namespace providing the Vec<T> traits
+// and inside a matching target region, so the intrinsics inline into the
+// loops. Every loop finishes the tail with scalar code.
+
+template<typename T>
+inline void add(T* dst, const T* lhs, const T* rhs, const std::size_t n)
+{
+	using V = Vec<T>;
+	std::size_t i = 0;
+	for (; i + V::width <= n; i += V::width)
+	{
+		V::store(dst + i, V::add(V::load(lhs + i), V::load(rhs + i)));
+	}
+	for (; i < n; ++i)
+	{
+		dst[i] = lhs[i] + rhs[i];
+	}
+}
+
+template<typename T>
+inline void subtract(T* dst, const T* lhs, const T* rhs, const std::size_t n)
+{
+	using V = Vec<T>;
+	std::size_t i = 0;
+	for (; i + V::width <= n; i += V::width)
+	{
+		V::store(dst + i, V::sub(V::load(lhs + i), V::load(rhs + i)));
+	}
+	for (; i < n; ++i)
+	{
+		dst[i] = lhs[i] - rhs[i];
+	}
+}
+
+template<typename T>
+inline void scale(T* dst, const T scalar, const std::size_t n)
+{
+	using V = Vec<T>;
+	std::size_t i = 0;
+	if constexpr (V::has_mul)
+	{
+		const auto s = V::set1(scalar);
+		for (; i + V::width <= n; i += V::width)
+		{
+			V::store(dst + i, V::mul(V::load(dst + i), s));
+		}
+	}
+	for (; i < n; ++i)
+	{
+		dst[i] *= scalar;
+	}
+}
+
+// dst += alpha * x. Multiply and add are kept separate so that every level
+// rounds exactly like the scalar code.
+template<typename T>
+inline void axpy(T* dst, const T alpha, const T* x, const std::size_t n)
+{
+	using V = Vec<T>;
+	std::size_t i = 0;
+	if constexpr (V::has_mul)
+	{
+		const auto a = V::set1(alpha);
+		for (; i + V::width <= n; i += V::width)
+		{
+			V::store(dst + i,
+				V::add(V::load(dst + i), V::mul(a, V::load(x + i))));
+		}
+	}
+	for (; i < n; ++i)
+	{
+		dst[i] += alpha * x[i];
+	}
+}
+
+template<typename T>
+inline bool equal(const T* lhs, const T* rhs, const std::size_t n)
+{
+	using V = Vec<T>;
+	std::size_t i = 0;
+	for (; i + V::width <= n; i += V::width)
+	{
+		if (!V::all_eq(V::load(lhs + i), V::load(rhs + i))) return false;
+	}
+	for (; i < n; ++i)
+	{
+		if (!(lhs[i] == rhs[i])) return false;
+	}
+	return true;
+}
+
+template<typename T>
+inline bool all_equal(const T* src, const T value, const std::size_t n)
+{
+	using V = Vec<T>;
+	const auto v = V::set1(value);
+	std::size_t i = 0;
+	for (; i + V::width <= n; i += V::width)
+	{
+		if (!V::all_eq(V::load(src + i), v)) return false;
+	}
+	for (; i < n; ++i)
+	{
+		if (!(src[i] == value)) return false;
+	}
+	return true;
+}
+
+// Sum of lhs[i] * rhs[i]. The vector lanes accumulate separately, so the
+// rounding of floating point results depends on the level.
+template<typename T>
+inline T dot(const T* lhs, const T* rhs, const std::size_t n)
+{
+	using V = Vec<T>;
+	std::size_t i = 0;
+	T result = T(0);
+	if constexpr (V::has_mul)
+	{
+		auto acc = V::set1(T(0));
+		for (; i + V::width <= n; i += V::width)
+		{
+			acc = V::add(acc, V::mul(V::load(lhs + i), V::load(rhs + i)));
+		}
+		T lanes[V::width];
+		V::store(lanes, acc);
+		for (std::size_t l = 0; l < V::width; ++l)
+		{
+			result += lanes[l];
+		}
+	}
+	for (; i < n; ++i)
+	{
+		result += lhs[i] * rhs[i];
+	}
+	return result;
+}
+
+// out[i] = philox_word(first + i, key), one Philox block per 64-bit lane.
+// Integer arithmetic only, so every level produces the same bits.
+inline void philox(std::uint64_t* out, const std::uint64_t first,
+	const std::size_t n, const std::uint64_t key)
+{
+	using V = Vec<std::uint64_t>;
+	const auto mask = V::set1(0xffffffff);
+	const auto m0 = V::set1(philox_m0);
+	const auto m1 = V::set1(philox_m1);
+	const auto zero = V::set1(0);
+
+	std::size_t i = 0;
+	for (; i + V::width <= n; i += V::width)
+	{
+		const auto counter = V::add(V::set1(first + i), V::iota());
+		auto x0 = V::and_(counter, mask);
+		auto x1 = V::shr32(counter);
+		auto x2 = zero;
+		auto x3 = zero;
+		std::uint32_t k0 = static_cast<std::uint32_t>(key);
+		std::uint32_t k1 = static_cast<std::uint32_t>(key >> 32);
+		for (int round = 0; round < 10; ++round)
+		{
+			const auto p0 = V::mul32(x0, m0);
+			const auto p1 = V::mul32(x2, m1);
+			x0 = V::xor_(V::xor_(V::shr32(p1), x1), V::set1(k0));
+			x1 = V::and_(p1, mask);
+			x2 = V::xor_(V::xor_(V::shr32(p0), x3), V::set1(k1));
+			x3 = V::and_(p0, mask);
+			k0 += philox_w0;
+			k1 += philox_w1;
+		}
+		V::store(out + i, V::or_(x0, V::shl32(x1)));
+	}
+	for (; i < n; ++i)
+	{
+		out[i] = philox_word(first + i, key);
+	}
+}
+
+// c = a * b for a group of batch_lanes interleaved matrices, element
+// (i, j) of an r x s group is the run of batch_lanes values at
+// (i * s + j) * batch_lanes. Every lane sums its products in the order of
+// the inner index, so all levels round the same.
+template<typename T>
+inline void batch_gemm(T* c, const T* a, const T* b,
+	const std::size_t m, const std::size_t k, const std::size_t n)
+{
+	using V = Vec<T>;
+	constexpr auto lanes = batch_lanes;
+	if constexpr (V::has_mul)
+	{
+		static_assert(lanes % V::width == 0);
+		constexpr auto vectors = lanes / V::width;
+		for (std::size_t i = 0; i < m; ++i)
+		{
+			for (std::size_t j = 0; j < n; ++j)
+			{
+				typename V::type acc[vectors];
+				for (std::size_t v = 0; v < vectors; ++v) acc[v] = V::set1(T(0));
+				for (std::size_t p = 0; p < k; ++p)
+				{
+					const T* a_ip = a + (i * k + p) * lanes;
+					const T* b_pj = b + (p * n + j) * lanes;
+					for (std::size_t v = 0; v < vectors; ++v)
+					{
+						acc[v] = V::add(acc[v], V::mul(V::load(a_ip + v * V::width),
+							V::load(b_pj + v * V::width)));
+					}
+				}
+				for (std::size_t v = 0; v < vectors; ++v)
+				{
+					V::store(c + (i * n + j) * lanes + v * V::width, acc[v]);
+				}
+			}
+		}
+	}
+	else
+	{
+		for (std::size_t i = 0; i < m; ++i)
+		{
+			for (std::size_t j = 0; j < n; ++j)
+			{
+				T* c_ij = c + (i * n + j) * lanes;
+				std::fill(c_ij, c_ij + lanes, T(0));
+				for (std::size_t p = 0; p < k; ++p)
+				{
+					const T* a_ip = a + (i * k + p) * lanes;
+					const T* b_pj = b + (p * n + j) * lanes;
+					for (std::size_t l = 0; l < lanes; ++l)
+					{
+						c_ij[l] += a_ip[l] * b_pj[l];
+					}
+				}
+			}
+		}
+	}
+}
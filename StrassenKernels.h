@@ -0,0 +1,288 @@
+#pragma once
+
+// Strassen-Winograd matrix product for large products, opt-in
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include "GemmKernels.h"
+#include "VectorOps.h"
+
+/*
+* The Winograd variant of Strassen's algorithm: 7 half-size products and
+* 15 additions per level instead of 8 products, about O(n^2.81) overall.
+* It is off by default. set_crossover() switches it on for every gemm(),
+* and with it operator* and power(), whose operands are all at least
+* crossover() in every dimension. The products are split in halves until
+* the smallest dimension drops below the crossover, the halves go to the
+* classical kernels of GemmKernels.
+*
+* The operands are copied into a workspace, zero padded to sizes the
+* recursion can halve evenly. The workspace of each thread only grows,
+* reserve() allocates it ahead of the first product.
+*
+* The result is exact for integers (unsigned arithmetic wraps the same
+* way as the classical product, signed intermediates may overflow sooner)
+* and for Fraction. For float and double the error bound grows with the
+* recursion depth, roughly by a factor of 12 per level on top of the
+* classical kernel's, and the rounding differs from it.
+*/
+namespace StrassenKernels
+{
+	// Starting point for float, double and int. BM_Strassen sweeps the
+	// crossover, the best value depends on the cache sizes and the threads.
+	inline constexpr std::size_t default_crossover = 256;
+
+	inline std::atomic<std::size_t>& crossover_storage()
+	{
+		static std::atomic<std::size_t> crossover{ 0 };
+		return crossover;
+	}
+
+	// Smallest dimension of the products that are split, 0 if disabled
+	[[nodiscard]] inline std::size_t crossover() noexcept
+	{
+		return crossover_storage().load(std::memory_order_relaxed);
+	}
+
+	// 0 disables the algorithm, small values only make sense in tests
+	inline void set_crossover(const std::size_t crossover = default_crossover) noexcept
+	{
+		crossover_storage().store(crossover, std::memory_order_relaxed);
+	}
+
+	// Levels of recursion of an m x k times k x n product, 0 below the
+	// crossover
+	[[nodiscard]] inline std::size_t depth(const std::size_t m, const std::size_t n,
+		const std::size_t k) noexcept
+	{
+		const auto limit = crossover();
+		if (limit == 0) return 0;
+
+		std::size_t levels = 0;
+		for (auto s = std::min({ m, n, k }); s >= limit && s >= 2; s /= 2) ++levels;
+		return levels;
+	}
+
+	[[nodiscard]] inline bool applies(const std::size_t m, const std::size_t n,
+		const std::size_t k) noexcept
+	{
+		return depth(m, n, k) > 0;
+	}
+
+	// Rounds size up to a multiple of 2^levels
+	[[nodiscard]] inline std::size_t padded(const std::size_t size,
+		const std::size_t levels) noexcept
+	{
+		const auto unit = std::size_t(1) << levels;
+		return (size + unit - 1) / unit * unit;
+	}
+
+	// Elements of the temporaries of one product of padded sizes
+	[[nodiscard]] inline std::size_t temporaries(std::size_t m, std::size_t n,
+		std::size_t k, const std::size_t levels) noexcept
+	{
+		std::size_t size = 0;
+		for (auto l = levels; l > 0; --l)
+		{
+			m /= 2, n /= 2, k /= 2;
+			size += m * std::max(k, n) + k * n;
+		}
+		return size;
+	}
+
+	// Elements of the workspace of a product, the padded operands included
+	[[nodiscard]] inline std::size_t workspace_size(const std::size_t m,
+		const std::size_t n, const std::size_t k) noexcept
+	{
+		const auto levels = depth(m, n, k);
+		if (levels == 0) return 0;
+
+		const auto pm = padded(m, levels), pn = padded(n, levels), pk = padded(k, levels);
+		return pm * pk + pk * pn + pm * pn + temporaries(pm, pn, pk, levels);
+	}
+
+	// Per-thread workspace, see reserve()
+	template<typename T>
+	std::vector<T>& workspace()
+	{
+		thread_local std::vector<T> buffer;
+		return buffer;
+	}
+
+	// Grows the workspace of the calling thread for m x k times k x n
+	// products at the current crossover
+	template<typename T>
+	void reserve(const std::size_t m, const std::size_t n, const std::size_t k)
+	{
+		auto& buffer = workspace<T>();
+		buffer.resize(std::max(buffer.size(), workspace_size(m, n, k)));
+	}
+
+	// dst = lhs + rhs or dst = lhs - rhs for rows x cols blocks, dst may
+	// alias an operand
+	template<typename T>
+	void combine(const bool subtract, const std::size_t rows, const std::size_t cols,
+		T* dst, const std::size_t ldd, const T* lhs, const std::size_t ldl,
+		const T* rhs, const std::size_t ldr)
+	{
+		VectorOperations::for_ranges(rows, cols,
+			[&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				if (subtract)
+				{
+					VectorOperations::subtract(dst + i * ldd, lhs + i * ldl, rhs + i * ldr, cols);
+				}
+				else
+				{
+					VectorOperations::add(dst + i * ldd, lhs + i * ldl, rhs + i * ldr, cols);
+				}
+			}
+		});
+	}
+
+	/*
+	* c = a * b for padded row-major blocks, m, n and k are multiples of
+	* 2^levels. work holds temporaries(m, n, k, levels) elements.
+	*
+	* The schedule of Boyer, Dumas, Pernet and Zhou, "Memory efficient
+	* scheduling of Strassen-Winograd's matrix multiplication algorithm"
+	* (2009): the quadrants of c hold the partial results, so every level
+	* only needs the temporaries x (m/2 x max(k/2, n/2)) and y (k/2 x n/2).
+	*/
+	template<typename T>
+	void multiply_recursive(const std::size_t m, const std::size_t n, const std::size_t k,
+		const T* a, const std::size_t lda, const T* b, const std::size_t ldb,
+		T* c, const std::size_t ldc, const std::size_t levels, T* work)
+	{
+		using Operand = GemmKernels::Operand<T>;
+		if (levels == 0)
+		{
+			GemmKernels::gemm(m, n, k, T(1), Operand{ a, lda, 1 }, Operand{ b, ldb, 1 },
+				T(0), c, ldc);
+			return;
+		}
+
+		const auto m2 = m / 2, n2 = n / 2, k2 = k / 2;
+		const T* a11 = a;
+		const T* a12 = a + k2;
+		const T* a21 = a + m2 * lda;
+		const T* a22 = a21 + k2;
+		const T* b11 = b;
+		const T* b12 = b + n2;
+		const T* b21 = b + k2 * ldb;
+		const T* b22 = b21 + n2;
+		T* c11 = c;
+		T* c12 = c + n2;
+		T* c21 = c + m2 * ldc;
+		T* c22 = c21 + n2;
+
+		const auto ldx = std::max(k2, n2);
+		T* x = work;
+		T* y = x + m2 * ldx;
+		T* next = y + k2 * n2;
+		const auto product = [&](const T* lhs, const std::size_t ldl,
+			const T* rhs, const std::size_t ldr, T* dst, const std::size_t ldd)
+		{
+			multiply_recursive(m2, n2, k2, lhs, ldl, rhs, ldr, dst, ldd, levels - 1, next);
+		};
+		const auto add = [](const std::size_t rows, const std::size_t cols, T* dst,
+			const std::size_t ldd, const T* lhs, const std::size_t ldl,
+			const T* rhs, const std::size_t ldr)
+		{
+			combine(false, rows, cols, dst, ldd, lhs, ldl, rhs, ldr);
+		};
+		const auto subtract = [](const std::size_t rows, const std::size_t cols, T* dst,
+			const std::size_t ldd, const T* lhs, const std::size_t ldl,
+			const T* rhs, const std::size_t ldr)
+		{
+			combine(true, rows, cols, dst, ldd, lhs, ldl, rhs, ldr);
+		};
+
+		subtract(m2, k2, x, ldx, a11, lda, a21, lda);		// S3 = A11 - A21
+		subtract(k2, n2, y, n2, b22, ldb, b12, ldb);		// T3 = B22 - B12
+		product(x, ldx, y, n2, c21, ldc);					// P7 = S3 * T3
+		add(m2, k2, x, ldx, a21, lda, a22, lda);			// S1 = A21 + A22
+		subtract(k2, n2, y, n2, b12, ldb, b11, ldb);		// T1 = B12 - B11
+		product(x, ldx, y, n2, c22, ldc);					// P5 = S1 * T1
+		subtract(m2, k2, x, ldx, x, ldx, a11, lda);			// S2 = S1 - A11
+		subtract(k2, n2, y, n2, b22, ldb, y, n2);			// T2 = B22 - T1
+		product(x, ldx, y, n2, c12, ldc);					// P6 = S2 * T2
+		subtract(m2, k2, x, ldx, a12, lda, x, ldx);			// S4 = A12 - S2
+		product(x, ldx, b22, ldb, c11, ldc);				// P3 = S4 * B22
+		product(a11, lda, b11, ldb, x, ldx);				// P1 = A11 * B11
+		add(m2, n2, c12, ldc, x, ldx, c12, ldc);			// U2 = P1 + P6
+		add(m2, n2, c21, ldc, c12, ldc, c21, ldc);			// U3 = U2 + P7
+		add(m2, n2, c12, ldc, c12, ldc, c22, ldc);			// U4 = U2 + P5
+		add(m2, n2, c22, ldc, c21, ldc, c22, ldc);			// U7 = U3 + P5 = C22
+		add(m2, n2, c12, ldc, c12, ldc, c11, ldc);			// U5 = U4 + P3 = C12
+		subtract(k2, n2, y, n2, y, n2, b21, ldb);			// T4 = T2 - B21
+		product(a22, lda, y, n2, c11, ldc);					// P4 = A22 * T4
+		subtract(m2, n2, c21, ldc, c21, ldc, c11, ldc);		// U6 = U3 - P4 = C21
+		product(a12, lda, b21, ldb, c11, ldc);				// P2 = A12 * B21
+		add(m2, n2, c11, ldc, x, ldx, c11, ldc);			// U1 = P1 + P2 = C11
+	}
+
+	/*
+	* C = alpha * A * B + beta * C like GemmKernels::gemm, where C may have
+	* any strides. Only for products that applies() to.
+	*/
+	template<typename T>
+	void gemm(const std::size_t m, const std::size_t n, const std::size_t k,
+		const T alpha, const GemmKernels::Operand<T>& a, const GemmKernels::Operand<T>& b,
+		const T beta, T* c, const std::size_t c_row_stride, const std::size_t c_col_stride)
+	{
+		const auto levels = depth(m, n, k);
+		assert(levels > 0);
+
+		const auto pm = padded(m, levels), pn = padded(n, levels), pk = padded(k, levels);
+		reserve<T>(m, n, k);
+		T* pa = workspace<T>().data();
+		T* pb = pa + pm * pk;
+		T* pc = pb + pk * pn;
+
+		// Operands copied with zero padding, the padding of the product is
+		// never read
+		const auto pad = [](const std::size_t rows, const std::size_t cols,
+			const GemmKernels::Operand<T>& src, T* dst,
+			const std::size_t dst_rows, const std::size_t dst_cols)
+		{
+			VectorOperations::for_ranges(dst_rows, dst_cols,
+				[&](const std::size_t begin, const std::size_t end)
+			{
+				for (auto i = begin; i < end; ++i)
+				{
+					T* row = dst + i * dst_cols;
+					const auto copied = i < rows ? cols : 0;
+					for (std::size_t j = 0; j < copied; ++j) row[j] = src(i, j);
+					std::fill(row + copied, row + dst_cols, T(0));
+				}
+			});
+		};
+		pad(m, k, a, pa, pm, pk);
+		pad(k, n, b, pb, pk, pn);
+
+		multiply_recursive(pm, pn, pk, pa, pk, pb, pn, pc, pn, levels, pc + pm * pn);
+
+		const bool zero_beta = beta == T(0);
+		const bool unit_alpha = alpha == T(1);
+		VectorOperations::for_ranges(m, n, [&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				T* c_row = c + i * c_row_stride;
+				const T* p_row = pc + i * pn;
+				for (std::size_t j = 0; j < n; ++j)
+				{
+					const T product = unit_alpha ? p_row[j] : alpha * p_row[j];
+					T& dst = c_row[j * c_col_stride];
+					dst = zero_beta ? product : beta * dst + product;
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,422 @@
+#pragma once
+
+// Text output and parsing of raw row-major buffers
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+#include "VectorOps.h"
+
+namespace TextKernels
+{
+	// Layout of written text
+	struct Format
+	{
+		// Between the elements of a row
+		char delimiter = ' ';
+
+		// Digits after the point of floating point elements. Negative for
+		// the shortest representation that reads back to the same value.
+		int precision = 2;
+
+		// Pads the columns to their widest element and frames the rows
+		// with '|', the layout of operator<<
+		bool aligned = true;
+	};
+
+	// Comma-separated values that read back exactly
+	inline constexpr Format csv{ ',', -1, false };
+
+	// Approximate work of formatting or parsing one element, in the units
+	// of VectorOperations::for_ranges
+	inline constexpr std::size_t element_cost = 16;
+
+	// Rows are formatted in blocks of about this many elements, one block
+	// is written to the stream while it is buffered
+	inline constexpr std::size_t block_elements = std::size_t(1) << 16;
+
+	// Text is parsed in chunks of at least this many bytes
+	inline constexpr std::size_t chunk_bytes = std::size_t(1) << 16;
+
+	/*
+	* Formats value with std::to_chars, floating point numbers in fixed
+	* notation with precision digits after the point. Other types, like
+	* Fraction, go through their operator<<. The result points into buffer
+	* and is valid until its next use.
+	*/
+	template<typename T>
+	std::string_view format(const T& value, const int precision, std::string& buffer)
+	{
+		if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+		{
+			buffer.resize(std::numeric_limits<T>::digits10 + 3);
+			const auto result = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+			return { buffer.data(), static_cast<std::size_t>(result.ptr - buffer.data()) };
+		}
+		else if constexpr (std::is_floating_point_v<T>)
+		{
+			// Integer digits, sign, point and fraction digits. The shortest
+			// representation is never longer than the scientific one.
+			const auto digits = std::max(precision, std::numeric_limits<T>::max_digits10);
+			buffer.resize(std::numeric_limits<T>::max_exponent10 + digits + 8);
+			const auto result = precision < 0 ?
+				std::to_chars(buffer.data(), buffer.data() + buffer.size(), value) :
+				std::to_chars(buffer.data(), buffer.data() + buffer.size(), value,
+					std::chars_format::fixed, precision);
+			return { buffer.data(), static_cast<std::size_t>(result.ptr - buffer.data()) };
+		}
+		else
+		{
+			thread_local std::ostringstream stream;
+			stream.str({});
+			stream << value;
+			buffer = stream.str();
+			return buffer;
+		}
+	}
+
+	/*
+	* Length of format(value, precision, buffer). Fixed notation is
+	* measured from the integer digits, only values so close to a power of
+	* ten that the rounding may add a digit are formatted.
+	*/
+	template<typename T>
+	std::size_t width(const T& value, const int precision, std::string& buffer)
+	{
+		if constexpr (std::is_floating_point_v<T>)
+		{
+			const auto magnitude = std::fabs(static_cast<double>(value));
+			if (precision >= 0 && precision <= 15 && magnitude < 1e15)
+			{
+				std::size_t digits = 1;
+				double power = 10;
+				for (; magnitude >= power; power *= 10) ++digits;
+
+				// Rounding to precision digits carries into a new digit from
+				// power - half on
+				double half = 0.5;
+				for (int d = 0; d < precision; ++d) half /= 10;
+				const auto distance = magnitude - (power - half);
+				if (std::fabs(distance) > power * 1e-9)
+				{
+					if (distance > 0) ++digits;
+					return std::signbit(value) + digits +
+						(precision > 0 ? 1 + static_cast<std::size_t>(precision) : 0);
+				}
+			}
+		}
+		return format(value, precision, buffer).size();
+	}
+
+	/*
+	* Writes the rows x cols elements at data, element (i, j) at
+	* data[i * row_stride + j * col_stride], as lines of text.
+	*
+	* Aligned rows have a fixed length once the column widths are known, so
+	* a first pass measures the columns. The rows of a block are then
+	* formatted in parallel and the block goes to the stream in one write,
+	* the stream's own formatting state is neither used nor changed.
+	*/
+	template<typename T>
+	void write(std::ostream& os, const T* data, const std::size_t rows,
+		const std::size_t cols, const std::size_t row_stride,
+		const std::size_t col_stride, const Format& format)
+	{
+		const auto at = [=](const std::size_t i, const std::size_t j) -> const T&
+		{
+			return data[i * row_stride + j * col_stride];
+		};
+
+		std::vector<std::size_t> widths(format.aligned ? cols : 0);
+		if (format.aligned)
+		{
+			std::mutex mutex;
+			VectorOperations::for_ranges(rows, cols * element_cost,
+				[&](const std::size_t begin, const std::size_t end)
+			{
+				std::string buffer;
+				std::vector<std::size_t> local(cols);
+				for (std::size_t i = begin; i < end; ++i)
+				{
+					for (std::size_t j = 0; j < cols; ++j)
+					{
+						local[j] = std::max(local[j],
+							TextKernels::width(at(i, j), format.precision, buffer));
+					}
+				}
+				std::lock_guard<std::mutex> lock(mutex);
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					widths[j] = std::max(widths[j], local[j]);
+				}
+			});
+		}
+
+		const auto format_row = [&](const std::size_t i, std::string& line, std::string& buffer)
+		{
+			line.clear();
+			if (format.aligned) line += "| ";
+			for (std::size_t j = 0; j < cols; ++j)
+			{
+				if (j > 0) line += format.delimiter;
+				const auto text = TextKernels::format(at(i, j), format.precision, buffer);
+				if (format.aligned) line.append(widths[j] - text.size(), ' ');
+				line += text;
+			}
+			line += format.aligned ? " |\n" : "\n";
+		};
+
+		// The lines keep their capacity from block to block
+		const auto block = std::max<std::size_t>(block_elements / std::max<std::size_t>(cols, 1), 1);
+		std::vector<std::string> lines(std::min(block, rows));
+		for (std::size_t first = 0; first < rows && os; first += block)
+		{
+			const auto count = std::min(block, rows - first);
+			VectorOperations::for_ranges(count, cols * element_cost,
+				[&](const std::size_t begin, const std::size_t end)
+			{
+				std::string buffer;
+				for (std::size_t r = begin; r < end; ++r)
+				{
+					format_row(first + r, lines[r], buffer);
+				}
+			});
+
+			std::string text;
+			std::size_t length = 0;
+			for (std::size_t r = 0; r < count; ++r) length += lines[r].size();
+			text.reserve(length);
+			for (std::size_t r = 0; r < count; ++r) text += lines[r];
+			os.write(text.data(), static_cast<std::streamsize>(text.size()));
+		}
+	}
+
+	// Lines and rows before a chunk of text, and the first error in it
+	struct Chunk
+	{
+		std::size_t begin = 0;
+		std::size_t end = 0;
+		std::size_t first_line = 0;
+		std::size_t first_row = 0;
+		std::size_t rows = 0;
+		std::size_t lines = 0;
+		std::size_t error_line = 0;
+		std::string error;
+	};
+
+	// Shape of a text matrix, see scan()
+	struct Scan
+	{
+		std::size_t rows = 0;
+		std::size_t cols = 0;
+		std::vector<Chunk> chunks;
+	};
+
+	// Blanks between elements. '|' counts as a blank when the elements are
+	// separated by whitespace, so the output of operator<< reads back.
+	inline bool is_blank(const char c, const char delimiter)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || (delimiter == ' ' && c == '|');
+	}
+
+	// Calls field(first, last) for the elements of the line [first, last)
+	// and returns their number. Blanks around the elements are skipped.
+	template<typename Field>
+	std::size_t split(const char* first, const char* last, const char delimiter, Field&& field)
+	{
+		std::size_t count = 0;
+		const auto blank = [delimiter](const char c) { return is_blank(c, delimiter); };
+		if (delimiter == ' ')
+		{
+			for (;;)
+			{
+				first = std::find_if_not(first, last, blank);
+				if (first == last) return count;
+				const auto end = std::find_if(first, last, blank);
+				field(first, end);
+				++count;
+				first = end;
+			}
+		}
+
+		// An empty line has no elements, a delimiter ends an empty one
+		if (std::find_if_not(first, last, blank) == last) return 0;
+		for (;;)
+		{
+			const auto end = std::find(first, last, delimiter);
+			auto begin = std::find_if_not(first, end, blank);
+			auto stop = end;
+			while (stop != begin && blank(stop[-1])) --stop;
+			field(begin, stop);
+			++count;
+			if (end == last) return count;
+			first = end + 1;
+		}
+	}
+
+	/*
+	* Splits text into chunks of whole lines and counts their rows, lines
+	* without elements are skipped. The number of columns is that of the
+	* first row, parse() checks the others. delimiter ' ' separates the
+	* elements by any run of blanks, every other character by itself.
+	*/
+	inline Scan scan(const std::string_view text, const char delimiter)
+	{
+		Scan result;
+		auto& pool = ThreadPool::instance();
+		const auto parts = std::max<std::size_t>(
+			std::min(pool.thread_count() * 4, text.size() / chunk_bytes), 1);
+
+		// Chunk boundaries move forward to the next line
+		std::size_t begin = 0;
+		for (std::size_t p = 1; p <= parts && begin < text.size(); ++p)
+		{
+			auto end = p == parts ? text.size() : std::max(begin, text.size() * p / parts);
+			if (end < text.size())
+			{
+				end = text.find('\n', end);
+				end = end == std::string_view::npos ? text.size() : end + 1;
+			}
+			Chunk chunk;
+			chunk.begin = begin;
+			chunk.end = end;
+			result.chunks.push_back(chunk);
+			begin = end;
+		}
+
+		VectorOperations::for_ranges(result.chunks.size(), chunk_bytes,
+			[&](const std::size_t chunk_begin, const std::size_t chunk_end)
+		{
+			for (std::size_t c = chunk_begin; c < chunk_end; ++c)
+			{
+				auto& chunk = result.chunks[c];
+				auto first = text.data() + chunk.begin;
+				const auto last = text.data() + chunk.end;
+				while (first != last)
+				{
+					const auto end = std::find(first, last, '\n');
+					if (std::find_if_not(first, end, [delimiter](const char ch)
+						{ return is_blank(ch, delimiter); }) != end)
+					{
+						++chunk.rows;
+					}
+					++chunk.lines;
+					first = end == last ? last : end + 1;
+				}
+			}
+		});
+
+		std::size_t lines = 0;
+		for (auto& chunk : result.chunks)
+		{
+			chunk.first_row = result.rows;
+			chunk.first_line = lines;
+			result.rows += chunk.rows;
+			lines += chunk.lines;
+		}
+
+		// Columns of the first row
+		for (std::size_t first = 0; first < text.size() && result.rows > 0;)
+		{
+			auto end = text.find('\n', first);
+			if (end == std::string_view::npos) end = text.size();
+			result.cols = split(text.data() + first, text.data() + end, delimiter,
+				[](const char*, const char*) {});
+			if (result.cols > 0) break;
+			first = end + 1;
+		}
+		return result;
+	}
+
+	// Reads one element with std::from_chars, a leading '+' is allowed
+	template<typename T>
+	bool parse_element(const char* first, const char* last, T& value)
+	{
+		static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>,
+			"only integral and floating point elements can be parsed");
+
+		if (first != last && *first == '+' && last - first > 1 && first[1] != '-') ++first;
+		if (first == last) return false;
+		const auto result = std::from_chars(first, last, value);
+		return result.ec == std::errc() && result.ptr == last;
+	}
+
+	/*
+	* Parses the rows found by scan() into dst, row i at dst + i * ld.
+	* The chunks are parsed in parallel. Throws std::runtime_error for the
+	* first invalid element or row of another length, the message starts
+	* with source and the line number.
+	*/
+	template<typename T>
+	void parse(const std::string_view text, const char delimiter, Scan& scan,
+		T* dst, const std::size_t ld, const std::string& source)
+	{
+		const auto cols = scan.cols;
+		VectorOperations::for_ranges(scan.chunks.size(), chunk_bytes,
+			[&](const std::size_t chunk_begin, const std::size_t chunk_end)
+		{
+			for (std::size_t c = chunk_begin; c < chunk_end; ++c)
+			{
+				auto& chunk = scan.chunks[c];
+				auto first = text.data() + chunk.begin;
+				const auto last = text.data() + chunk.end;
+				auto row = chunk.first_row;
+				auto line = chunk.first_line;
+				while (first != last && chunk.error.empty())
+				{
+					const auto end = std::find(first, last, '\n');
+					++line;
+
+					// Elements past the row are counted but not stored
+					bool valid = true;
+					std::string invalid;
+					std::size_t j = 0;
+					const auto count = split(first, end, delimiter,
+						[&](const char* begin, const char* stop)
+					{
+						if (j < cols && valid && !parse_element(begin, stop, dst[row * ld + j]))
+						{
+							valid = false;
+							invalid.assign(begin, stop);
+						}
+						++j;
+					});
+
+					if (count > 0 && count != cols)
+					{
+						chunk.error = "expected " + std::to_string(cols) +
+							" elements, found " + std::to_string(count);
+						chunk.error_line = line;
+					}
+					else if (!valid)
+					{
+						chunk.error = "invalid element '" + invalid + "'";
+						chunk.error_line = line;
+					}
+					if (count > 0) ++row;
+					first = end == last ? last : end + 1;
+				}
+			}
+		});
+
+		for (const auto& chunk : scan.chunks)
+		{
+			if (!chunk.error.empty())
+			{
+				throw std::runtime_error(source + ":" +
+					std::to_string(chunk.error_line) + ": " + chunk.error);
+			}
+		}
+	}
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+// Library-owned work-stealing thread pool used by the parallel kernels
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// The pool the library kernels run on. Starts with one thread per
+	// hardware thread (the calling thread counts as one).
+	static ThreadPool& instance()
+	{
+		static ThreadPool pool(0);
+		return pool;
+	}
+
+	// 0 threads means std::thread::hardware_concurrency()
+	explicit ThreadPool(const std::size_t threads)
+	{
+		start(threads);
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		stop();
+	}
+
+	/*
+	* Resizes the pool, 0 selects the hardware concurrency and 1 disables
+	* threading: all work then runs on the calling thread. Must not be
+	* called while parallel work is running.
+	*/
+	void set_thread_count(const std::size_t threads)
+	{
+		stop();
+		start(threads);
+	}
+
+	// Number of threads taking part in parallel work, including the caller
+	[[nodiscard]] std::size_t thread_count() const noexcept
+	{
+		return workers_.size() + 1;
+	}
+
+	/*
+	* In deterministic mode kernels only split work in ways that do not
+	* change the floating point summation order, so results are identical
+	* for every thread count. Otherwise e.g. GEMM may split the inner
+	* dimension and sum partial products when the output is too small.
+	*/
+	void set_deterministic(const bool deterministic) noexcept
+	{
+		deterministic_.store(deterministic, std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] bool deterministic() const noexcept
+	{
+		return deterministic_.load(std::memory_order_relaxed);
+	}
+
+	/*
+	* Calls func(i) for every i in [0, count) and returns when all calls
+	* are done. The calls are spread over the worker queues, idle threads
+	* steal from the others and the calling thread takes part. Calls from
+	* inside a task run inline. func must not throw.
+	*/
+	template<typename Func>
+	void parallel_for(const std::size_t count, Func&& func)
+	{
+		if (count == 0) return;
+		if (count == 1 || workers_.empty() || inside_task())
+		{
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				func(i);
+			}
+			return;
+		}
+
+		using FuncType = std::remove_reference_t<Func>;
+		Job job;
+		job.context = const_cast<void*>(static_cast<const void*>(&func));
+		job.invoke = [](void* context, const std::size_t index)
+		{
+			(*static_cast<FuncType*>(context))(index);
+		};
+		job.remaining.store(count, std::memory_order_relaxed);
+
+		// Round-robin over the queues, the last one belongs to the caller
+		const auto queues = queues_.size();
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			auto& queue = *queues_[i % queues];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.tasks.push_back({ &job, i });
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+			queued_.fetch_add(count, std::memory_order_release);
+		}
+		sleep_cv_.notify_all();
+
+		// Help until there is nothing left to take, then wait for the
+		// tasks other threads are still running. The count is only
+		// trusted under job.mutex, see run().
+		Task task;
+		while (job.remaining.load(std::memory_order_acquire) != 0 &&
+			find_task(queues - 1, task))
+		{
+			run(task);
+		}
+		std::unique_lock<std::mutex> lock(job.mutex);
+		job.done.wait(lock, [&job]
+		{
+			return job.remaining.load(std::memory_order_acquire) == 0;
+		});
+	}
+
+private:
+	struct Job
+	{
+		void* context = nullptr;
+		void (*invoke)(void*, std::size_t) = nullptr;
+		std::atomic<std::size_t> remaining{ 0 };
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+
+	struct Task
+	{
+		Job* job = nullptr;
+		std::size_t index = 0;
+	};
+
+	// Owners take from the back, thieves from the front
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::thread> workers_;
+	std::vector<std::unique_ptr<Queue>> queues_;
+
+	std::atomic<std::size_t> queued_{ 0 };
+	std::mutex sleep_mutex_;
+	std::condition_variable sleep_cv_;
+	bool stopping_ = false;
+
+	std::atomic<bool> deterministic_{ false };
+
+	static bool& inside_task()
+	{
+		thread_local bool inside = false;
+		return inside;
+	}
+
+	void start(std::size_t threads)
+	{
+		if (threads == 0)
+		{
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		stopping_ = false;
+
+		// One queue per worker plus one for the submitting thread
+		for (std::size_t i = 0; i < threads; ++i)
+		{
+			queues_.push_back(std::make_unique<Queue>());
+		}
+		for (std::size_t i = 0; i + 1 < threads; ++i)
+		{
+			workers_.emplace_back([this, i] { worker_loop(i); });
+		}
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+			stopping_ = true;
+		}
+		sleep_cv_.notify_all();
+		for (auto& worker : workers_)
+		{
+			worker.join();
+		}
+		workers_.clear();
+		queues_.clear();
+	}
+
+	// Own queue first (back), then steal from the others (front)
+	bool find_task(const std::size_t own, Task& task)
+	{
+		{
+			auto& queue = *queues_[own];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty())
+			{
+				task = queue.tasks.back();
+				queue.tasks.pop_back();
+				queued_.fetch_sub(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		for (std::size_t offset = 1; offset < queues_.size(); ++offset)
+		{
+			auto& queue = *queues_[(own + offset) % queues_.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty())
+			{
+				task = queue.tasks.front();
+				queue.tasks.pop_front();
+				queued_.fetch_sub(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void run(const Task& task)
+	{
+		auto& inside = inside_task();
+		const bool was_inside = inside;
+		inside = true;
+		task.job->invoke(task.job->context, task.index);
+		inside = was_inside;
+
+		// Every task but the last one just counts down
+		auto& job = *task.job;
+		auto remaining = job.remaining.load(std::memory_order_relaxed);
+		while (remaining > 1)
+		{
+			if (job.remaining.compare_exchange_weak(remaining, remaining - 1,
+				std::memory_order_acq_rel, std::memory_order_relaxed))
+			{
+				return;
+			}
+		}
+
+		// The last task counts down and wakes up the submitting thread
+		// under the job mutex. The submitter only returns after reading
+		// the count under the same mutex, so the Job on its stack outlives
+		// this block.
+		std::lock_guard<std::mutex> lock(job.mutex);
+		job.remaining.fetch_sub(1, std::memory_order_acq_rel);
+		job.done.notify_all();
+	}
+
+	void worker_loop(const std::size_t own)
+	{
+		for (;;)
+		{
+			Task task;
+			if (find_task(own, task))
+			{
+				run(task);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleep_mutex_);
+			sleep_cv_.wait(lock, [this]
+			{
+				return stopping_ ||
+					queued_.load(std::memory_order_acquire) != 0;
+			});
+			if (stopping_) return;
+		}
+	}
+};
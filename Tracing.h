@@ -0,0 +1,431 @@
+#pragma once
+
+// Opt-in instrumentation of the library operations
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/*
+* Trace points are compiled in when MATRIX_TRACING is defined as 1 before
+* the library is included, e.g. with -DMATRIX_TRACING=1. Otherwise the
+* MATRIX_TRACE_* macros expand to nothing and their arguments are never
+* evaluated.
+*
+* Compiled in, recording still has to be switched on with
+* Tracing::enable(). Until then every trace point costs one relaxed
+* atomic load. While enabled, each traced call records its wall time, the
+* FLOPs and bytes it touches by the usual operation counts, and the heap
+* allocations made on its thread through the memory resources of the
+* library. Calls nest, so the counts of a call include its callees.
+*/
+#ifndef MATRIX_TRACING
+#define MATRIX_TRACING 0
+#endif
+
+namespace Tracing
+{
+	enum class op : std::size_t
+	{
+		multiply, add, subtract, scale, axpy, dot, equal, all_equal,
+		transpose, power, fill, lu, lu_panel, lu_trsm, lu_update,
+		count
+	};
+
+	inline constexpr const char* names[] = {
+		"multiply", "add", "subtract", "scale", "axpy", "dot", "equal", "all_equal",
+		"transpose", "power", "fill", "lu", "lu_panel", "lu_trsm", "lu_update"
+	};
+	static_assert(std::size(names) == static_cast<std::size_t>(op::count));
+
+	// Events recorded per thread for the Chrome trace, later calls only
+	// reach the counters
+	inline constexpr std::size_t max_events = std::size_t(1) << 20;
+
+	// Totals of one operation
+	struct Counters
+	{
+		std::uint64_t calls = 0;
+		std::uint64_t nanoseconds = 0;
+		std::uint64_t flops = 0;
+		std::uint64_t bytes = 0;
+		std::uint64_t allocations = 0;
+		std::uint64_t allocated_bytes = 0;
+	};
+
+	// One traced call, times in nanoseconds since the last reset()
+	struct Event
+	{
+		op operation;
+		std::uint64_t start;
+		Counters counts;
+	};
+}
+
+namespace TracingDetail
+{
+	using Clock = std::chrono::steady_clock;
+
+	// Allocations of the current thread, see CountingResource
+	struct HeapCounts
+	{
+		std::uint64_t allocations = 0;
+		std::uint64_t bytes = 0;
+	};
+	inline thread_local HeapCounts heap_counts;
+
+	// Forwards to upstream and counts the allocations of each thread
+	class CountingResource : public std::pmr::memory_resource
+	{
+	public:
+		explicit CountingResource(std::pmr::memory_resource* upstream) noexcept :
+			upstream_(upstream)
+		{}
+
+		[[nodiscard]] std::pmr::memory_resource* upstream() const noexcept { return upstream_; }
+
+	private:
+		std::pmr::memory_resource* upstream_;
+
+		void* do_allocate(const std::size_t bytes, const std::size_t alignment) override
+		{
+			++heap_counts.allocations;
+			heap_counts.bytes += bytes;
+			return upstream_->allocate(bytes, alignment);
+		}
+
+		void do_deallocate(void* p, const std::size_t bytes, const std::size_t alignment) override
+		{
+			upstream_->deallocate(p, bytes, alignment);
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+	};
+
+	class Scope;
+
+	/*
+	* Counters of one thread. Only the owning thread writes them, so plain
+	* relaxed loads and stores suffice and readers never block it. The
+	* states outlive their threads, their counts stay in the totals.
+	*/
+	struct ThreadState
+	{
+		explicit ThreadState(const std::size_t thread_id) :
+			id(thread_id)
+		{}
+
+		std::size_t id;
+		std::array<std::array<std::atomic<std::uint64_t>, 6>,
+			static_cast<std::size_t>(Tracing::op::count)> counters{};
+		std::vector<Tracing::Event> events;
+		std::atomic<std::uint64_t> dropped{ 0 };
+		Scope* current = nullptr;
+
+		void record(const Tracing::Event& event)
+		{
+			auto& c = counters[static_cast<std::size_t>(event.operation)];
+			const std::uint64_t values[] = { 1, event.counts.nanoseconds, event.counts.flops,
+				event.counts.bytes, event.counts.allocations, event.counts.allocated_bytes };
+			for (std::size_t i = 0; i < c.size(); ++i)
+			{
+				c[i].store(c[i].load(std::memory_order_relaxed) + values[i],
+					std::memory_order_relaxed);
+			}
+			if (events.size() < Tracing::max_events)
+			{
+				events.push_back(event);
+			}
+			else
+			{
+				dropped.store(dropped.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+			}
+		}
+	};
+
+	struct Registry
+	{
+		std::atomic<bool> enabled{ false };
+		Clock::time_point epoch = Clock::now();
+
+		// Wraps the default resource while enabled
+		std::mutex mutex;
+		std::unique_ptr<CountingResource> counting;
+		std::pmr::memory_resource* previous = nullptr;
+		std::vector<std::unique_ptr<ThreadState>> threads;
+
+		ThreadState* add_thread()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			threads.push_back(std::make_unique<ThreadState>(threads.size()));
+			return threads.back().get();
+		}
+	};
+
+	inline Registry& registry()
+	{
+		static Registry instance;
+		return instance;
+	}
+
+	inline ThreadState& thread_state()
+	{
+		thread_local ThreadState* state = registry().add_thread();
+		return *state;
+	}
+
+	// Records a traced call on destruction, see MATRIX_TRACE_SCOPE
+	class Scope
+	{
+	public:
+		Scope(const Tracing::op operation, const std::uint64_t flops,
+			const std::uint64_t bytes)
+		{
+			if (!registry().enabled.load(std::memory_order_relaxed)) return;
+
+			state_ = &thread_state();
+			parent_ = state_->current;
+			state_->current = this;
+			operation_ = operation;
+			flops_ = flops;
+			bytes_ = bytes;
+			allocations_ = heap_counts.allocations;
+			allocated_bytes_ = heap_counts.bytes;
+			start_ = Clock::now();
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		~Scope()
+		{
+			if (state_ == nullptr) return;
+
+			const auto end = Clock::now();
+			const auto since = [](const Clock::time_point time)
+			{
+				return static_cast<std::uint64_t>(std::chrono::duration_cast<
+					std::chrono::nanoseconds>(time - registry().epoch).count());
+			};
+			Tracing::Event event{ operation_, since(start_), {} };
+			event.counts.calls = 1;
+			event.counts.nanoseconds = since(end) - event.start;
+			event.counts.flops = flops_;
+			event.counts.bytes = bytes_;
+			event.counts.allocations = heap_counts.allocations - allocations_;
+			event.counts.allocated_bytes = heap_counts.bytes - allocated_bytes_;
+			state_->current = parent_;
+			state_->record(event);
+		}
+
+		// Work only known while the call runs
+		void count(const std::uint64_t flops, const std::uint64_t bytes) noexcept
+		{
+			flops_ += flops;
+			bytes_ += bytes;
+		}
+
+	private:
+		ThreadState* state_ = nullptr;
+		Scope* parent_ = nullptr;
+		Tracing::op operation_{};
+		std::uint64_t flops_ = 0;
+		std::uint64_t bytes_ = 0;
+		std::uint64_t allocations_ = 0;
+		std::uint64_t allocated_bytes_ = 0;
+		Clock::time_point start_;
+	};
+}
+
+namespace Tracing
+{
+	using TracingDetail::Scope;
+
+	// Adds work to the innermost traced call of this thread
+	inline void count(const std::uint64_t flops, const std::uint64_t bytes) noexcept
+	{
+		using namespace TracingDetail;
+		if (!registry().enabled.load(std::memory_order_relaxed)) return;
+		if (auto* scope = thread_state().current) scope->count(flops, bytes);
+	}
+
+	/*
+	* Heap the library's own scratch pools draw from when tracing is
+	* compiled in, counting like the default resource does while enabled.
+	*/
+	inline std::pmr::memory_resource* heap_resource()
+	{
+		static TracingDetail::CountingResource heap(std::pmr::new_delete_resource());
+		return &heap;
+	}
+
+	/*
+	* Starts recording. The default memory resource is wrapped in a counting
+	* one until disable(). Memory allocated in between goes back through the
+	* wrapper, so the default resource at the first enable() stays its
+	* upstream for good.
+	*/
+	inline void enable()
+	{
+		using namespace TracingDetail;
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		if (r.enabled.load(std::memory_order_relaxed)) return;
+		if (!r.counting)
+		{
+			r.counting = std::make_unique<CountingResource>(std::pmr::get_default_resource());
+		}
+		r.previous = std::pmr::set_default_resource(r.counting.get());
+		r.enabled.store(true, std::memory_order_relaxed);
+	}
+
+	inline void disable()
+	{
+		using namespace TracingDetail;
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		if (!r.enabled.load(std::memory_order_relaxed)) return;
+		r.enabled.store(false, std::memory_order_relaxed);
+		std::pmr::set_default_resource(r.previous);
+	}
+
+	[[nodiscard]] inline bool enabled() noexcept
+	{
+		return TracingDetail::registry().enabled.load(std::memory_order_relaxed);
+	}
+
+	// Clears the counters and events. No traced call may be running.
+	inline void reset()
+	{
+		using namespace TracingDetail;
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (auto& thread : r.threads)
+		{
+			for (auto& counters : thread->counters)
+			{
+				for (auto& counter : counters) counter.store(0, std::memory_order_relaxed);
+			}
+			thread->events.clear();
+			thread->dropped.store(0, std::memory_order_relaxed);
+		}
+		r.epoch = Clock::now();
+	}
+
+	// Totals of operation over all threads, may be read at any time
+	[[nodiscard]] inline Counters totals(const op operation)
+	{
+		using namespace TracingDetail;
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		Counters result;
+		for (const auto& thread : r.threads)
+		{
+			const auto& c = thread->counters[static_cast<std::size_t>(operation)];
+			result.calls += c[0].load(std::memory_order_relaxed);
+			result.nanoseconds += c[1].load(std::memory_order_relaxed);
+			result.flops += c[2].load(std::memory_order_relaxed);
+			result.bytes += c[3].load(std::memory_order_relaxed);
+			result.allocations += c[4].load(std::memory_order_relaxed);
+			result.allocated_bytes += c[5].load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+	// Table of the operations that were called, times are inclusive
+	inline void write_summary(std::ostream& os)
+	{
+		const auto flags = os.flags();
+		const auto precision = os.precision();
+		os << std::left << std::setw(12) << "operation" << std::right
+			<< std::setw(10) << "calls" << std::setw(12) << "total ms"
+			<< std::setw(12) << "mean us" << std::setw(10) << "GFLOP/s"
+			<< std::setw(10) << "GB/s" << std::setw(10) << "allocs"
+			<< std::setw(12) << "alloc MiB" << '\n' << std::fixed;
+		for (std::size_t i = 0; i < static_cast<std::size_t>(op::count); ++i)
+		{
+			const auto c = totals(static_cast<op>(i));
+			if (c.calls == 0) continue;
+
+			const auto ns = static_cast<double>(std::max<std::uint64_t>(c.nanoseconds, 1));
+			os << std::left << std::setw(12) << names[i] << std::right
+				<< std::setw(10) << c.calls
+				<< std::setw(12) << std::setprecision(3) << ns / 1e6
+				<< std::setw(12) << ns / 1e3 / static_cast<double>(c.calls)
+				<< std::setw(10) << std::setprecision(2) << static_cast<double>(c.flops) / ns
+				<< std::setw(10) << static_cast<double>(c.bytes) / ns
+				<< std::setw(10) << c.allocations
+				<< std::setw(12) << static_cast<double>(c.allocated_bytes) / (1 << 20) << '\n';
+		}
+		os.flags(flags);
+		os.precision(precision);
+	}
+
+	/*
+	* Writes the recorded events in the Chrome trace event format, for
+	* chrome://tracing or https://ui.perfetto.dev. One track per thread, the
+	* counts of every call are its arguments. No traced call may be running.
+	*/
+	inline void write_chrome_trace(std::ostream& os)
+	{
+		using namespace TracingDetail;
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+
+		const auto flags = os.flags();
+		const auto precision = os.precision();
+		os << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+		bool first = true;
+		for (const auto& thread : r.threads)
+		{
+			for (const auto& event : thread->events)
+			{
+				os << (first ? "\n" : ",\n")
+					<< "{\"name\":\"" << names[static_cast<std::size_t>(event.operation)]
+					<< "\",\"cat\":\"matrix\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread->id
+					<< ",\"ts\":" << static_cast<double>(event.start) / 1e3
+					<< ",\"dur\":" << static_cast<double>(event.counts.nanoseconds) / 1e3
+					<< ",\"args\":{\"flops\":" << event.counts.flops
+					<< ",\"bytes\":" << event.counts.bytes
+					<< ",\"allocations\":" << event.counts.allocations
+					<< ",\"allocated_bytes\":" << event.counts.allocated_bytes << "}}";
+				first = false;
+			}
+		}
+		os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+		os.flags(flags);
+		os.precision(precision);
+	}
+}
+
+#if MATRIX_TRACING
+#define MATRIX_TRACE_CONCAT_(a, b) a##b
+#define MATRIX_TRACE_CONCAT(a, b) MATRIX_TRACE_CONCAT_(a, b)
+
+// Traces the rest of the enclosing block as a call of Tracing::op::operation
+#define MATRIX_TRACE_SCOPE(operation, flops, bytes) \
+	Tracing::Scope MATRIX_TRACE_CONCAT(matrix_trace_scope_, __LINE__)( \
+		Tracing::op::operation, static_cast<std::uint64_t>(flops), \
+		static_cast<std::uint64_t>(bytes))
+
+// Adds work to the innermost traced call, see Tracing::count
+#define MATRIX_TRACE_COUNT(flops, bytes) \
+	Tracing::count(static_cast<std::uint64_t>(flops), static_cast<std::uint64_t>(bytes))
+#else
+#define MATRIX_TRACE_SCOPE(operation, flops, bytes) static_cast<void>(0)
+#define MATRIX_TRACE_COUNT(flops, bytes) static_cast<void>(0)
+#endif
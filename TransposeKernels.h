@@ -0,0 +1,177 @@
+#pragma once
+
+// Transposes of raw row-major buffers
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+#include "MatrixScratch.h"
+
+namespace TransposeKernels
+{
+	// Blocks of at most this many rows and columns are handled with plain
+	// loops, they fit into L1 together with their mirror block
+	inline constexpr std::size_t leaf_size = 32;
+
+	// Rectangular matrices up to this many elements are transposed through
+	// a scratch copy, larger ones by cycle-following
+	inline constexpr std::size_t cycle_threshold = std::size_t(1) << 18;
+
+	// dst = src^T for a rows x cols block. Cache-oblivious: the longer side
+	// is halved until the block is a leaf, so both the reads and the
+	// writes stay within a few cache lines at every level.
+	template<typename T>
+	void transpose_copy(
+		const std::size_t rows, const std::size_t cols,
+		const T* src, const std::size_t lds, T* dst, const std::size_t ldd)
+	{
+		if (rows <= leaf_size && cols <= leaf_size)
+		{
+			for (std::size_t i = 0; i < rows; ++i)
+			{
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					dst[j * ldd + i] = src[i * lds + j];
+				}
+			}
+		}
+		else if (rows >= cols)
+		{
+			const auto half = rows / 2;
+			transpose_copy(half, cols, src, lds, dst, ldd);
+			transpose_copy(rows - half, cols, src + half * lds, lds,
+				dst + half, ldd);
+		}
+		else
+		{
+			const auto half = cols / 2;
+			transpose_copy(rows, half, src, lds, dst, ldd);
+			transpose_copy(rows, cols - half, src + half, lds,
+				dst + half * ldd, ldd);
+		}
+	}
+
+	// Swaps the rows x cols block a with the transpose of the cols x rows
+	// block b, recursively like transpose_copy
+	template<typename T>
+	void swap_transposed(
+		const std::size_t rows, const std::size_t cols,
+		T* a, T* b, const std::size_t ld)
+	{
+		if (rows <= leaf_size && cols <= leaf_size)
+		{
+			for (std::size_t i = 0; i < rows; ++i)
+			{
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					std::swap(a[i * ld + j], b[j * ld + i]);
+				}
+			}
+		}
+		else if (rows >= cols)
+		{
+			const auto half = rows / 2;
+			swap_transposed(half, cols, a, b, ld);
+			swap_transposed(rows - half, cols, a + half * ld, b + half, ld);
+		}
+		else
+		{
+			const auto half = cols / 2;
+			swap_transposed(rows, half, a, b, ld);
+			swap_transposed(rows, cols - half, a + half, b + half * ld, ld);
+		}
+	}
+
+	// In-place transpose of the n x n block at a. The diagonal blocks are
+	// transposed recursively, the off-diagonal ones swapped.
+	template<typename T>
+	void transpose_square(const std::size_t n, T* a, const std::size_t ld)
+	{
+		if (n <= leaf_size)
+		{
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				for (std::size_t j = i + 1; j < n; ++j)
+				{
+					std::swap(a[i * ld + j], a[j * ld + i]);
+				}
+			}
+			return;
+		}
+		const auto half = n / 2;
+		transpose_square(half, a, ld);
+		transpose_square(n - half, a + half * ld + half, ld);
+		swap_transposed(half, n - half, a + half, a + half * ld, ld);
+	}
+
+	/*
+	* In-place transpose of a dense rows x cols matrix, afterwards it is
+	* cols x rows. The element at position p moves to p * rows mod
+	* (rows * cols - 1); the permutation is applied cycle by cycle with one
+	* bit per element to mark the finished positions.
+	*/
+	template<typename T>
+	void transpose_cycles(const std::size_t rows, const std::size_t cols, T* a)
+	{
+		const auto size = rows * cols;
+		if (rows <= 1 || cols <= 1) return;
+
+		std::pmr::vector<std::uint64_t> done((size + 63) / 64, 0,
+			MatrixScratch::resource());
+		const auto is_done = [&done](const std::size_t p)
+		{
+			return (done[p / 64] >> (p % 64)) & 1;
+		};
+		const auto mark = [&done](const std::size_t p)
+		{
+			done[p / 64] |= std::uint64_t(1) << (p % 64);
+		};
+
+		// The first and the last element stay in place
+		const auto last = size - 1;
+		for (std::size_t start = 1; start < last; ++start)
+		{
+			if (is_done(start)) continue;
+
+			// Pull the elements along the cycle into the free slot
+			T carried = std::move(a[start]);
+			auto p = start;
+			for (;;)
+			{
+				// The element ending up at p comes from p * cols mod last
+				const auto src = static_cast<std::size_t>(
+					(static_cast<unsigned long long>(p) * cols) % last);
+				mark(p);
+				if (src == start) break;
+				a[p] = std::move(a[src]);
+				p = src;
+			}
+			a[p] = std::move(carried);
+		}
+	}
+
+	// In-place transpose of a dense rows x cols matrix
+	template<typename T>
+	void transpose(const std::size_t rows, const std::size_t cols, T* a)
+	{
+		if (rows == cols)
+		{
+			transpose_square(rows, a, cols);
+		}
+		else if (rows * cols <= cycle_threshold)
+		{
+			// Small enough for a scratch copy, which is much faster than
+			// following the cycles
+			const std::pmr::vector<T> copy(a, a + rows * cols,
+				MatrixScratch::resource());
+			transpose_copy(rows, cols, copy.data(), cols, a, rows);
+		}
+		else
+		{
+			transpose_cycles(rows, cols, a);
+		}
+	}
+}
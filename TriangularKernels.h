@@ -0,0 +1,181 @@
+#pragma once
+
+// Triangular solves on raw row-major buffers
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include "GemmKernels.h"
+#include "VectorOps.h"
+
+namespace TriangularKernels
+{
+	// Rows per diagonal block of the blocked solves. Within a block the
+	// right-hand sides are updated row by row, blocks below (or above) are
+	// updated with one GEMM.
+	inline constexpr std::size_t block_size = 64;
+
+	// Divides a row of B by a diagonal entry. Integral types divide every
+	// element like trsv, the rest multiply by the reciprocal.
+	template<typename T>
+	void divide_row(T* b_k, const T diag, const std::size_t nrhs)
+	{
+		assert(diag != T(0));
+		if constexpr (std::is_integral_v<T>)
+		{
+			for (std::size_t j = 0; j < nrhs; ++j)
+			{
+				b_k[j] /= diag;
+			}
+		}
+		else
+		{
+			VectorOperations::scale(b_k, T(1) / diag, nrhs);
+		}
+	}
+
+	// Solves the diagonal block rows [k0, k_end) of L * X = B in place.
+	// Every update is an axpy over a whole row of B.
+	template<typename T>
+	void lower_block(
+		const std::size_t k0, const std::size_t k_end, const std::size_t nrhs,
+		const GemmKernels::Operand<T>& a, const bool unit,
+		T* b, const std::size_t ldb)
+	{
+		using namespace VectorOperations;
+		for (auto k = k0; k < k_end; ++k)
+		{
+			T* b_k = b + k * ldb;
+			if (!unit)
+			{
+				divide_row(b_k, a(k, k), nrhs);
+			}
+			for (auto i = k + 1; i < k_end; ++i)
+			{
+				const T l_ik = a(i, k);
+				if (l_ik == T(0)) continue;
+				axpy(b + i * ldb, T(0) - l_ik, b_k, nrhs);
+			}
+		}
+	}
+
+	// Upper triangular counterpart of lower_block, rows are solved from
+	// the bottom up
+	template<typename T>
+	void upper_block(
+		const std::size_t k0, const std::size_t k_end, const std::size_t nrhs,
+		const GemmKernels::Operand<T>& a, const bool unit,
+		T* b, const std::size_t ldb)
+	{
+		using namespace VectorOperations;
+		for (auto k = k_end; k-- > k0;)
+		{
+			T* b_k = b + k * ldb;
+			if (!unit)
+			{
+				divide_row(b_k, a(k, k), nrhs);
+			}
+			for (auto i = k0; i < k; ++i)
+			{
+				const T u_ik = a(i, k);
+				if (u_ik == T(0)) continue;
+				axpy(b + i * ldb, T(0) - u_ik, b_k, nrhs);
+			}
+		}
+	}
+
+	// Solves L * X = B in place. L is n x n lower triangular, only its
+	// lower triangle is read. B is n x nrhs with contiguous rows, L may
+	// have any strides (e.g. the transpose of an upper triangle).
+	template<typename T>
+	void trsm_lower(
+		const std::size_t n, const std::size_t nrhs,
+		const GemmKernels::Operand<T>& a, const bool unit,
+		T* b, const std::size_t ldb)
+	{
+		using Operand = GemmKernels::Operand<T>;
+
+		for (std::size_t k0 = 0; k0 < n; k0 += block_size)
+		{
+			const auto k_end = std::min(k0 + block_size, n);
+			lower_block(k0, k_end, nrhs, a, unit, b, ldb);
+
+			// B[k_end:n] -= L[k_end:n, k0:k_end] * X[k0:k_end]
+			if (k_end < n)
+			{
+				GemmKernels::gemm(n - k_end, nrhs, k_end - k0, T(-1),
+					Operand{ &a(k_end, k0), a.row_stride, a.col_stride },
+					Operand{ b + k0 * ldb, ldb, 1 },
+					T(1), b + k_end * ldb, ldb);
+			}
+		}
+	}
+
+	// Solves U * X = B in place. U is n x n upper triangular, only its
+	// upper triangle is read. B is n x nrhs.
+	template<typename T>
+	void trsm_upper(
+		const std::size_t n, const std::size_t nrhs,
+		const GemmKernels::Operand<T>& a, const bool unit,
+		T* b, const std::size_t ldb)
+	{
+		using Operand = GemmKernels::Operand<T>;
+
+		// Blocks from the bottom up, the last one may be partial
+		for (auto k_end = n; k_end > 0;)
+		{
+			const auto k0 = k_end > block_size ? k_end - block_size : 0;
+			upper_block(k0, k_end, nrhs, a, unit, b, ldb);
+
+			// B[0:k0] -= U[0:k0, k0:k_end] * X[k0:k_end]
+			if (k0 > 0)
+			{
+				GemmKernels::gemm(k0, nrhs, k_end - k0, T(-1),
+					Operand{ &a(0, k0), a.row_stride, a.col_stride },
+					Operand{ b + k0 * ldb, ldb, 1 },
+					T(1), b, ldb);
+			}
+			k_end = k0;
+		}
+	}
+
+	// Single right-hand side. Each unknown is a dot product with a
+	// contiguous row of the triangle.
+	template<typename T>
+	void trsv_lower(
+		const std::size_t n, const T* a, const std::size_t lda,
+		const bool unit, T* x)
+	{
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			const T* row = a + i * lda;
+			T value = x[i] - VectorOperations::dot(row, x, i);
+			if (!unit)
+			{
+				assert(row[i] != T(0));
+				value = value / row[i];
+			}
+			x[i] = value;
+		}
+	}
+
+	template<typename T>
+	void trsv_upper(
+		const std::size_t n, const T* a, const std::size_t lda,
+		const bool unit, T* x)
+	{
+		for (auto i = n; i-- > 0;)
+		{
+			const T* row = a + i * lda;
+			T value = x[i] - VectorOperations::dot(row + i + 1, x + i + 1,
+				n - i - 1);
+			if (!unit)
+			{
+				assert(row[i] != T(0));
+				value = value / row[i];
+			}
+			x[i] = value;
+		}
+	}
+}
@@ -6,6 +6,9 @@
 #include <vector>
 #include <algorithm>
 #include <cassert>
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+#include "Tracing.h"
 
 
 namespace VectorOperations
@@ -15,7 +18,7 @@ namespace VectorOperations
 	template<typename T>
 	struct Plus
 	{
-		constexpr T operator()(const T& lhs, const T& rhs)
+		constexpr T operator()(const T& lhs, const T& rhs) const
 		{
 			return lhs + rhs;
 		}
@@ -24,21 +27,193 @@ namespace VectorOperations
 	template<typename T>
 	struct Minus
 	{
-		constexpr T operator()(const T& lhs, const T& rhs)
+		constexpr T operator()(const T& lhs, const T& rhs) const
 		{
 			return lhs - rhs;
 		}
 	};
 
+	// Kernels over raw contiguous ranges. The std::vector operations below
+	// and the Matrix storage are both built on these. dst may alias either
+	// operand. Arithmetic types with SIMD kernels are dispatched at runtime
+	// (see SimdKernels), the rest use the generic loops.
+
+	// Work of at least this many elements is split over the thread pool
+	inline constexpr std::size_t parallel_threshold = std::size_t(1) << 16;
+
+	/*
+	* Calls func(begin, end) on consecutive parts of [0, n), where every item
+	* costs item_cost elements of work. Large ranges are spread over the
+	* thread pool. Each item is handled by exactly one call, so the results
+	* do not depend on the number of threads.
+	*/
+	template<typename Func>
+	void for_ranges(const std::size_t n, const std::size_t item_cost,
+		Func&& func)
+	{
+		auto& pool = ThreadPool::instance();
+		const auto work = n * item_cost;
+		if (pool.thread_count() == 1 || work < parallel_threshold)
+		{
+			func(std::size_t(0), n);
+			return;
+		}
+
+		// A few parts per thread so stealing can balance the load, but
+		// none smaller than a quarter of the threshold
+		const auto parts = std::min(pool.thread_count() * 4,
+			work / (parallel_threshold / 4));
+		const auto part = std::max<std::size_t>((n + parts - 1) / parts, 1);
+		pool.parallel_for((n + part - 1) / part, [&](const std::size_t p)
+		{
+			const auto begin = p * part;
+			func(begin, std::min(begin + part, n));
+		});
+	}
+
+	// dst contains the sums of the elements of lhs and rhs
+	template<typename T>
+	void add(T* dst, const T* lhs, const T* rhs, const std::size_t n)
+	{
+		MATRIX_TRACE_SCOPE(add, n, 3 * n * sizeof(T));
+		for_ranges(n, 1, [=](const std::size_t begin, const std::size_t end)
+		{
+			if constexpr (SimdKernels::is_supported<T>)
+			{
+				SimdKernels::add(dst + begin, lhs + begin, rhs + begin,
+					end - begin);
+			}
+			else
+			{
+				std::transform(lhs + begin, lhs + end, rhs + begin,
+					dst + begin, Plus<T>());
+			}
+		});
+	}
+
+	// dst contains the differences of the elements of lhs and rhs
+	template<typename T>
+	void subtract(T* dst, const T* lhs, const T* rhs, const std::size_t n)
+	{
+		MATRIX_TRACE_SCOPE(subtract, n, 3 * n * sizeof(T));
+		for_ranges(n, 1, [=](const std::size_t begin, const std::size_t end)
+		{
+			if constexpr (SimdKernels::is_supported<T>)
+			{
+				SimdKernels::subtract(dst + begin, lhs + begin, rhs + begin,
+					end - begin);
+			}
+			else
+			{
+				std::transform(lhs + begin, lhs + end, rhs + begin,
+					dst + begin, Minus<T>());
+			}
+		});
+	}
+
+	// Multiplies every element of dst by scalar
+	template<typename T>
+	void scale(T* dst, const T scalar, const std::size_t n)
+	{
+		MATRIX_TRACE_SCOPE(scale, n, 2 * n * sizeof(T));
+		for_ranges(n, 1, [=](const std::size_t begin, const std::size_t end)
+		{
+			if constexpr (SimdKernels::is_supported<T>)
+			{
+				SimdKernels::scale(dst + begin, scalar, end - begin);
+			}
+			else
+			{
+				for (std::size_t i = begin; i < end; ++i)
+				{
+					dst[i] *= scalar;
+				}
+			}
+		});
+	}
+
+	// dst += alpha * x
+	template<typename T>
+	void axpy(T* dst, const T alpha, const T* x, const std::size_t n)
+	{
+		MATRIX_TRACE_SCOPE(axpy, 2 * n, 3 * n * sizeof(T));
+		for_ranges(n, 1, [=](const std::size_t begin, const std::size_t end)
+		{
+			if constexpr (SimdKernels::is_supported<T>)
+			{
+				SimdKernels::axpy(dst + begin, alpha, x + begin, end - begin);
+			}
+			else
+			{
+				for (std::size_t i = begin; i < end; ++i)
+				{
+					dst[i] += alpha * x[i];
+				}
+			}
+		});
+	}
+
+	// Sum of the element-wise products of two ranges
+	template<typename T>
+	[[nodiscard]] T dot(const T* lhs, const T* rhs, const std::size_t n)
+	{
+		MATRIX_TRACE_SCOPE(dot, 2 * n, 2 * n * sizeof(T));
+		if constexpr (SimdKernels::is_supported<T>)
+		{
+			return SimdKernels::dot(lhs, rhs, n);
+		}
+		else
+		{
+			T result(0);
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				result += lhs[i] * rhs[i];
+			}
+			return result;
+		}
+	}
+
+	// Element-wise comparison of two ranges
+	template<typename T>
+	[[nodiscard]] bool equal(const T* lhs, const T* rhs, const std::size_t n)
+	{
+		MATRIX_TRACE_SCOPE(equal, 0, 2 * n * sizeof(T));
+		if constexpr (SimdKernels::is_supported<T>)
+		{
+			return SimdKernels::equal(lhs, rhs, n);
+		}
+		else
+		{
+			return std::equal(lhs, lhs + n, rhs);
+		}
+	}
+
+	// Checks if all of the elements equal value
+	template<typename T>
+	[[nodiscard]] bool all_equal(const T* src, const T value, const std::size_t n)
+	{
+		MATRIX_TRACE_SCOPE(all_equal, 0, n * sizeof(T));
+		if constexpr (SimdKernels::is_supported<T>)
+		{
+			return SimdKernels::all_equal(src, value, n);
+		}
+		else
+		{
+			return std::all_of(src, src + n,
+				[&value](const T& element)
+				{
+					return element == value;
+				});
+		}
+	}
+
 	// lhs contains the sums of the elements of lhs and rhs 
 	template<typename T>
 	std::vector<T>& operator+=(std::vector<T>& lhs, const std::vector<T>& rhs)
 	{
 		assert(lhs.size() == rhs.size());
 
-		std::transform(lhs.begin(), lhs.end(), rhs.cbegin(),
-			lhs.begin(), Plus<T>());
-
+		add(lhs.data(), lhs.data(), rhs.data(), lhs.size());
 		return lhs;
 	}
 
@@ -49,11 +224,8 @@ namespace VectorOperations
 	{
 		assert(lhs.size() == rhs.size());
 
-		std::vector<T> result;
-		result.reserve(lhs.size());
-
-		std::transform(lhs.begin(), lhs.end(), rhs.cbegin(),
-			std::back_inserter(result), Plus<T>());
+		std::vector<T> result(lhs.size());
+		add(result.data(), lhs.data(), rhs.data(), lhs.size());
 
 		return result;
 	}
@@ -64,9 +236,7 @@ namespace VectorOperations
 	{
 		assert(lhs.size() == rhs.size());
 
-		std::transform(lhs.begin(), lhs.end(), rhs.cbegin(),
-			lhs.begin(), Minus<T>());
-
+		subtract(lhs.data(), lhs.data(), rhs.data(), lhs.size());
 		return lhs;
 	}
 
@@ -77,11 +247,8 @@ namespace VectorOperations
 	{
 		assert(lhs.size() == rhs.size());
 
-		std::vector<T> result;
-		result.reserve(lhs.size());
-
-		std::transform(lhs.begin(), lhs.end(), rhs.cbegin(),
-			std::back_inserter(result), Minus<T>());
+		std::vector<T> result(lhs.size());
+		subtract(result.data(), lhs.data(), rhs.data(), lhs.size());
 
 		return result;
 	};
@@ -0,0 +1,370 @@
+#pragma once
+
+// Fixed-size matrices for small, hot sizes like 3x3 and 4x4
+
+#include <array>
+#include <utility>
+#include "matrix.h"
+
+namespace FixedDetail
+{
+	// Calls func(std::integral_constant<std::size_t, I>) for I in
+	// [0, Count). The calls are expanded at compile time, so the loops of
+	// the FixedMatrix kernels are fully unrolled.
+	template<typename Func, std::size_t... I>
+	constexpr void unroll(Func&& func, std::index_sequence<I...>)
+	{
+		(func(std::integral_constant<std::size_t, I>{}), ...);
+	}
+
+	template<std::size_t Count, typename Func>
+	constexpr void unroll(Func&& func)
+	{
+		unroll(func, std::make_index_sequence<Count>{});
+	}
+
+	// std::abs is not constexpr before C++23
+	template<typename T>
+	constexpr T magnitude(const T& value)
+	{
+		return value < T(0) ? T(0) - value : value;
+	}
+}
+
+/*
+* N x M matrix with the extents in the type. The elements live in a
+* std::array, so there are no heap allocations, and everything except the
+* random fills can be evaluated at compile time. Size mismatches of the
+* operations are compile errors.
+* The API follows Matrix. The kernels are unrolled completely, so the type
+* is meant for small sizes; larger matrices belong in Matrix.
+*/
+template<typename T, std::size_t N, std::size_t M = N>
+class FixedMatrix
+{
+public:
+	using value_type = T;
+
+	static constexpr std::size_t rows = N;
+	static constexpr std::size_t cols = M;
+
+	// Zero-initialized
+	constexpr FixedMatrix() :
+		data_{}
+	{}
+
+	constexpr explicit FixedMatrix(const fill_type fill_type) :
+		data_{}
+	{
+		fill(fill_type);
+	}
+
+	// Row by row, FixedMatrix<int, 2> m({ { 1, 2 }, { 3, 4 } }). Too many
+	// rows or elements do not compile, missing ones are zero.
+	constexpr FixedMatrix(const T (&init)[N][M]) :
+		data_{}
+	{
+		FixedDetail::unroll<N * M>([&](auto ij)
+		{
+			data_[ij] = init[ij / M][ij % M];
+		});
+	}
+
+	// From a Matrix of the same size, the size is checked at runtime
+	explicit FixedMatrix(const Matrix<T>& matrix) :
+		data_{}
+	{
+		assert(matrix.size() == size());
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			std::copy(matrix[i].begin(), matrix[i].end(),
+				data_.begin() + i * M);
+		}
+	}
+
+	// To a Matrix, always possible
+	operator Matrix<T>() const
+	{
+		Matrix<T> result(N, M);
+		std::copy(data_.cbegin(), data_.cend(), result.data());
+		return result;
+	}
+
+	// Element (i, j) and m[i][j] access. Bounds are only checked by assert.
+	constexpr T& operator()(const std::size_t i, const std::size_t j)
+	{
+		assert(i < N && j < M);
+		return data_[i * M + j];
+	}
+
+	constexpr const T& operator()(const std::size_t i, const std::size_t j) const
+	{
+		assert(i < N && j < M);
+		return data_[i * M + j];
+	}
+
+	constexpr T* operator[](const std::size_t index)
+	{
+		assert(index < N);
+		return data_.data() + index * M;
+	}
+
+	constexpr const T* operator[](const std::size_t index) const
+	{
+		assert(index < N);
+		return data_.data() + index * M;
+	}
+
+	constexpr T coeff(const std::size_t i, const std::size_t j) const
+	{
+		return data_[i * M + j];
+	}
+
+	constexpr T* data() noexcept { return data_.data(); }
+	constexpr const T* data() const noexcept { return data_.data(); }
+
+	// Fills the matrix according to the fill_type, see Matrix::fill().
+	// The random fills are not constexpr.
+	constexpr FixedMatrix& fill(const fill_type fill_type)
+	{
+		if (fill_type == fill_type::zeros || fill_type == fill_type::ones)
+		{
+			const T value(static_cast<int>(fill_type));
+			FixedDetail::unroll<N * M>([&](auto ij) { data_[ij] = value; });
+		}
+		else if (fill_type == fill_type::identity)
+		{
+			FixedDetail::unroll<N * M>([&](auto ij)
+			{
+				data_[ij] = ij / M == ij % M ? T(1) : T(0);
+			});
+		}
+		else
+		{
+			*this = FixedMatrix(Matrix<T>(N, M, fill_type));
+		}
+		return *this;
+	}
+
+
+	// Arithmetic operations
+
+	constexpr FixedMatrix& operator+=(const FixedMatrix& rhs)
+	{
+		FixedDetail::unroll<N * M>([&](auto ij) { data_[ij] += rhs.data_[ij]; });
+		return *this;
+	}
+
+	constexpr FixedMatrix& operator-=(const FixedMatrix& rhs)
+	{
+		static_assert(std::is_signed<T>() || std::is_class<T>(),
+			"subtraction is not defined for unsigned integral type");
+
+		FixedDetail::unroll<N * M>([&](auto ij) { data_[ij] -= rhs.data_[ij]; });
+		return *this;
+	}
+
+	friend constexpr FixedMatrix operator+(FixedMatrix lhs, const FixedMatrix& rhs)
+	{
+		return lhs += rhs;
+	}
+
+	friend constexpr FixedMatrix operator-(FixedMatrix lhs, const FixedMatrix& rhs)
+	{
+		return lhs -= rhs;
+	}
+
+	// Unlike the Matrix overload, scalar products return a new matrix
+	friend constexpr FixedMatrix operator*(const T scalar, FixedMatrix rhs)
+	{
+		FixedDetail::unroll<N * M>([&](auto ij) { rhs.data_[ij] *= scalar; });
+		return rhs;
+	}
+
+	friend constexpr FixedMatrix operator*(FixedMatrix lhs, const T scalar)
+	{
+		return scalar * lhs;
+	}
+
+	// N x M times M x K. The inner dimensions are matched by the type.
+	template<std::size_t K>
+	friend constexpr FixedMatrix<T, N, K> operator*(
+		const FixedMatrix& lhs, const FixedMatrix<T, M, K>& rhs)
+	{
+		FixedMatrix<T, N, K> result;
+		FixedDetail::unroll<N * K>([&](auto ij)
+		{
+			constexpr std::size_t i = decltype(ij)::value / K;
+			constexpr std::size_t j = decltype(ij)::value % K;
+
+			T sum(0);
+			FixedDetail::unroll<M>([&](auto p)
+			{
+				sum += lhs.data_[i * M + p] * rhs.coeff(p, j);
+			});
+			result(i, j) = sum;
+		});
+		return result;
+	}
+
+	// Square matrices only, the product has the same size
+	constexpr FixedMatrix& operator*=(const FixedMatrix& rhs)
+	{
+		static_assert(N == M, "*= requires a square matrix");
+		return *this = *this * rhs;
+	}
+
+	// Matrix to the power of a positive whole number by repeated squaring
+	[[nodiscard]] constexpr FixedMatrix power(int exponent) const
+	{
+		static_assert(N == M, "power requires a square matrix");
+		assert(exponent >= 0);
+
+		FixedMatrix result(fill_type::identity);
+		FixedMatrix base = *this;
+		while (exponent > 0)
+		{
+			if (exponent & 1) result *= base;
+			exponent >>= 1;
+			if (exponent > 0) base *= base;
+		}
+		return result;
+	}
+
+	[[nodiscard]] constexpr T trace() const
+	{
+		static_assert(N == M, "trace requires a square matrix");
+
+		T result(0);
+		FixedDetail::unroll<N>([&](auto i) { result += data_[i * M + i]; });
+		return result;
+	}
+
+	// The extents are part of the type, so the transpose is a new M x N
+	// matrix instead of an in-place operation as for Matrix
+	[[nodiscard]] constexpr FixedMatrix<T, M, N> transpose() const
+	{
+		FixedMatrix<T, M, N> result;
+		FixedDetail::unroll<N * M>([&](auto ij)
+		{
+			result(ij % M, ij / M) = data_[ij];
+		});
+		return result;
+	}
+
+	// Same as Matrix::LU_T
+	using LU_T =
+		std::conditional_t<std::is_floating_point_v<T>, T, Fraction>;
+
+	// Result of the LU-factorization, see Matrix::LU
+	struct LU
+	{
+		FixedMatrix<LU_T, N, N> L;
+		FixedMatrix<LU_T, N, M> U;
+		std::array<std::size_t, N> P;
+	};
+
+	/**
+	 * \brief Computes LU-factorization with partial pivoting
+	 * \return LU-struct with members L, U and P, P * A = L * U
+	 */
+	[[nodiscard]] constexpr LU lu() const
+	{
+		LU result{ FixedMatrix<LU_T, N, N>(fill_type::identity), {}, {} };
+		auto& U = result.U;
+		auto& P = result.P;
+
+		FixedDetail::unroll<N * M>([&](auto ij)
+		{
+			U.data()[ij] = static_cast<LU_T>(data_[ij]);
+		});
+		FixedDetail::unroll<N>([&](auto i) { P[i] = i; });
+
+		constexpr auto steps = N < M ? N : M;
+		for (std::size_t k = 0; k < steps; ++k)
+		{
+			// Same pivot choice as Matrix::lu()
+			auto pivot_row = k;
+			if constexpr (std::is_floating_point_v<LU_T>)
+			{
+				for (auto i = k + 1; i < N; ++i)
+				{
+					if (FixedDetail::magnitude(U(i, k)) >
+						FixedDetail::magnitude(U(pivot_row, k)))
+					{
+						pivot_row = i;
+					}
+				}
+			}
+			else
+			{
+				while (pivot_row < N && U(pivot_row, k) == LU_T(0)) ++pivot_row;
+				if (pivot_row == N) pivot_row = k;
+			}
+			if (U(pivot_row, k) == LU_T(0)) continue;
+
+			if (pivot_row != k)
+			{
+				// The multipliers already in L follow their rows
+				for (std::size_t j = 0; j < M; ++j)
+				{
+					const auto tmp = U(k, j);
+					U(k, j) = U(pivot_row, j);
+					U(pivot_row, j) = tmp;
+				}
+				for (std::size_t j = 0; j < k; ++j)
+				{
+					const auto tmp = result.L(k, j);
+					result.L(k, j) = result.L(pivot_row, j);
+					result.L(pivot_row, j) = tmp;
+				}
+				const auto tmp = P[k];
+				P[k] = P[pivot_row];
+				P[pivot_row] = tmp;
+			}
+
+			for (auto i = k + 1; i < N; ++i)
+			{
+				const LU_T factor = U(i, k) / U(k, k);
+				result.L(i, k) = factor;
+				U(i, k) = LU_T(0);
+				if (factor == LU_T(0)) continue;
+
+				for (auto j = k + 1; j < M; ++j)
+				{
+					U(i, j) = U(i, j) - factor * U(k, j);
+				}
+			}
+		}
+		return result;
+	}
+
+	friend constexpr bool operator==(const FixedMatrix& lhs, const FixedMatrix& rhs)
+	{
+		bool equal = true;
+		FixedDetail::unroll<N * M>([&](auto ij)
+		{
+			equal = equal && lhs.data_[ij] == rhs.data_[ij];
+		});
+		return equal;
+	}
+
+	friend constexpr bool operator!=(const FixedMatrix& lhs, const FixedMatrix& rhs)
+	{
+		return !(lhs == rhs);
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, const FixedMatrix& obj)
+	{
+		return os << static_cast<Matrix<T>>(obj);
+	}
+
+	[[nodiscard]] static constexpr std::pair<std::size_t, std::size_t>
+	size() noexcept
+	{
+		return { N, M };
+	}
+
+private:
+	std::array<T, N * M> data_;
+};
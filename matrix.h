@@ -2,6 +2,9 @@
 
 #include "pch.h"
 #include "VectorOps.h"
+#include "RandomKernels.h"
+#include "MatrixExpr.h"
+#include "MatrixScratch.h"
 
 /*
 * -- Fill types are --
@@ -23,6 +26,13 @@ enum class fill_type
 	rand
 };
 
+// Operand flags of gemm
+enum class op_type
+{
+	none,
+	transpose
+};
+
 template<typename T>
 class Matrix;
 
@@ -30,85 +40,289 @@ class Matrix;
 template<typename T>
 Matrix<T> operator*(const Matrix<T>& lhs, const Matrix<T>& rhs);
 
+// Keeps a parameter out of template argument deduction, so that matrices
+// convert to views implicitly (std::type_identity_t in C++20)
+template<typename T>
+struct non_deduced
+{
+	using type = T;
+};
+
+template<typename T>
+using non_deduced_t = typename non_deduced<T>::type;
+
+/*
+* BLAS-style general matrix product into a caller-provided C:
+*	C = alpha * op(A) * op(B) + beta * C
+* A and B are matrices or views (see MatrixView.h). op_type::transpose
+* uses the transpose of the operand without materializing it. C must
+* already be sized and must not overlap A or B. With beta == 0 the
+* previous contents of C are not read.
+*/
+template<typename T>
+void gemm(const non_deduced_t<T> alpha,
+	const non_deduced_t<MatrixView<const T>> A, const op_type op_a,
+	const non_deduced_t<MatrixView<const T>> B, const op_type op_b,
+	const non_deduced_t<T> beta, Matrix<T>& C);
+
+// C as a view, e.g. a block of a larger Matrix
+template<typename T>
+void gemm(const non_deduced_t<T> alpha,
+	const non_deduced_t<MatrixView<const T>> A, const op_type op_a,
+	const non_deduced_t<MatrixView<const T>> B, const op_type op_b,
+	const non_deduced_t<T> beta, const MatrixView<T> C);
+
+// Flags of the triangular solves
+enum class triangle_type
+{
+	lower,
+	upper
+};
+
+enum class diag_type
+{
+	non_unit,
+	unit	// Diagonal is taken to be ones and is not read
+};
+
+// Solves A * X = B in place of B. A is square and triangular, only the
+// referenced triangle is read. A may be a view, B a Matrix or a view.
+// For integral types the divisions by the diagonal truncate, the result
+// is exact when X is integral.
+template<typename T>
+void trsm(const triangle_type uplo, const diag_type diag,
+	const non_deduced_t<MatrixView<const T>> A, Matrix<T>& B);
+
+template<typename T>
+void trsm(const triangle_type uplo, const diag_type diag,
+	const non_deduced_t<MatrixView<const T>> A, const MatrixView<T> B);
+
+// Single right-hand side version of trsm
+template<typename T>
+void trsv(const triangle_type uplo, const diag_type diag,
+	const non_deduced_t<MatrixView<const T>> A, std::vector<T>& b);
+
 template<typename T>
 std::ostream& operator<<(std::ostream& os, const Matrix<T>& obj);
 
+// Views need the declarations above
+#include "MatrixView.h"
+
 
 // TODO: Matrix Base Class
 
 template<typename T> 
-class Matrix
+class Matrix : public MatrixExpr<Matrix<T>>
 {
 public:
+	using value_type = T;
+
+	// The storage is allocated through a std::pmr memory resource. Every
+	// constructor takes an optional allocator, a memory_resource* converts
+	// to it implicitly. The default is std::pmr::get_default_resource().
+	// Results of member operations are allocated from the resource of
+	// *this, results of the operators from the left-hand operand's.
+	using allocator_type = std::pmr::polymorphic_allocator<T>;
+
 	// Non-initializing constructors:
 
 	// Square Matrix constructor
-	explicit Matrix(const std::size_t n);
+	explicit Matrix(const std::size_t n, const allocator_type& alloc = {});
 
 	// Non-square Matrix constructor
-	explicit Matrix(const std::size_t n, const std::size_t m);
+	explicit Matrix(const std::size_t n, const std::size_t m,
+		const allocator_type& alloc = {});
 
 
 	// Filling constructors:
 
 	// Fills a square Matrix with the fill_type
-	explicit Matrix(const std::size_t n, const fill_type fill_type);
+	explicit Matrix(const std::size_t n, const fill_type fill_type,
+		const allocator_type& alloc = {});
 
 	// Fill a non-square Matrix with the fill_type
-	explicit Matrix(
-		const std::size_t n, const std::size_t m, fill_type fill_type);
+	explicit Matrix(const std::size_t n, const std::size_t m,
+		fill_type fill_type, const allocator_type& alloc = {});
 
 	// std::initializer_list and vector constructors. Implicit conversions are
 	// allowed. Copies do not matter as the elements are trivially copyable.
 
 	// Size and elements are derived from the initializer list. 
-	Matrix(std::initializer_list<std::initializer_list<T>> init_list);
+	Matrix(std::initializer_list<std::initializer_list<T>> init_list,
+		const allocator_type& alloc = {});
 
 	// Size is derived from the vector
-	Matrix(const std::vector<std::vector<T>>& vectors);
+	Matrix(const std::vector<std::vector<T>>& vectors,
+		const allocator_type& alloc = {});
+
+	// Evaluates an element-wise expression (see MatrixExpr.h) in a single
+	// pass. Implicit so that Matrix m = a + b - c; works.
+	template <typename E, typename = std::enable_if_t<
+		std::is_same_v<T, typename E::value_type>>>
+	Matrix(const MatrixExpr<E>& expr, const allocator_type& alloc = {});
+
+	// Copy into another memory resource
+	Matrix(const Matrix& other, const allocator_type& alloc);
+
+	// Destructor, copy and move operations are implicit. As with the
+	// std::pmr containers, copies use the default resource and moves keep
+	// the resource.
 
-	// Destructor, copy and move operations are implicit
+	// Assigns an element-wise expression. The expression may refer to *this.
+	template <typename E, typename = std::enable_if_t<
+		std::is_same_v<T, typename E::value_type>>>
+	Matrix& operator=(const MatrixExpr<E>& expr);
 
 	// Conversion from integral types to Fraction
 	template <typename U = T>
 	operator std::enable_if_t<std::is_integral_v<U>, Matrix<Fraction>>() const
 	{
 		// Construct a Fraction Matrix
-		Matrix<Fraction> frac_mat(col_size_, row_size_);
+		Matrix<Fraction> frac_mat(col_size_, row_size_,
+			get_allocator().resource());
 
-		// Assign values from *this
-		for (unsigned i = 0; i < col_size_; ++i)
-		{
-			for (unsigned j = 0; j < row_size_; ++j)
-			{
-				frac_mat[i][j] = vectors_[i][j];
-			}
-		}
+		// Assign values from *this. Both buffers are dense.
+		std::copy(data_.cbegin(), data_.cend(), frac_mat.data());
 		return frac_mat;
 	}
 	
-	// Returns a ref to the corresponding row. Does basic bounds checking.
-	std::vector<T>& operator[](const std::size_t index)
+	// Proxy for a single row of the contiguous buffer. Keeps the m[i][j]
+	// syntax working without handing out the underlying storage.
+	template <typename Elem>
+	class RowProxy
+	{
+	public:
+		RowProxy(Elem* row, const std::size_t size) noexcept :
+			row_(row),
+			size_(size)
+		{}
+
+		Elem& operator[](const std::size_t index) const
+		{
+			assert(index < size_);
+			return row_[index];
+		}
+
+		[[nodiscard]] std::size_t size() const noexcept { return size_; }
+
+		Elem* begin() const noexcept { return row_; }
+		Elem* end() const noexcept { return row_ + size_; }
+
+	private:
+		Elem* row_;
+		std::size_t size_;
+	};
+
+	using Row = RowProxy<T>;
+	using ConstRow = RowProxy<const T>;
+
+	// Returns a proxy to the corresponding row. Does basic bounds checking.
+	Row operator[](const std::size_t index)
 	{
 		assert(index <= col_size_ - 1);
-		return vectors_[index];
+		return Row(data_.data() + index * stride_, row_size_);
 	}
 
-	// Returns a const-ref to the corresponding row. Basic bounds checking
+	// Returns a const proxy to the corresponding row. Basic bounds checking
 	// is performed.
-	const std::vector<T>& operator[](const std::size_t index) const
+	ConstRow operator[](const std::size_t index) const
 	{
 		assert(index <= col_size_ - 1);
-		return vectors_[index];
+		return ConstRow(data_.data() + index * stride_, row_size_);
+	}
+
+	// Element access for expressions
+	T coeff(const std::size_t i, const std::size_t j) const
+	{
+		return data_[i * stride_ + j];
+	}
+
+	// Raw access to the row-major buffer for external kernels. Element (i, j)
+	// is located at data()[i * stride() + j].
+	T* data() noexcept { return data_.data(); }
+	const T* data() const noexcept { return data_.data(); }
+
+	// Distance between the starts of two consecutive rows, in elements.
+	[[nodiscard]] std::size_t stride() const noexcept { return stride_; }
+
+	// Views into the storage, see MatrixView.h. They stay valid until the
+	// Matrix is resized, transposed or destroyed.
+
+	MatrixView<T> view() noexcept { return *this; }
+	MatrixView<const T> view() const noexcept { return *this; }
+
+	[[nodiscard]] MatrixView<T> submatrix(const std::size_t i0,
+		const std::size_t j0, const std::size_t rows, const std::size_t cols)
+	{
+		return view().submatrix(i0, j0, rows, cols);
+	}
+
+	[[nodiscard]] MatrixView<const T> submatrix(const std::size_t i0,
+		const std::size_t j0, const std::size_t rows, const std::size_t cols) const
+	{
+		return view().submatrix(i0, j0, rows, cols);
+	}
+
+	[[nodiscard]] MatrixView<T> row(const std::size_t i) { return view().row(i); }
+	[[nodiscard]] MatrixView<const T> row(const std::size_t i) const
+	{
+		return view().row(i);
+	}
+
+	[[nodiscard]] MatrixView<T> column(const std::size_t j)
+	{
+		return view().column(j);
+	}
+
+	[[nodiscard]] MatrixView<const T> column(const std::size_t j) const
+	{
+		return view().column(j);
+	}
+
+	[[nodiscard]] MatrixView<T> diagonal() noexcept { return view().diagonal(); }
+	[[nodiscard]] MatrixView<const T> diagonal() const noexcept
+	{
+		return view().diagonal();
+	}
+
+	// Expression interface, see MatrixExpr.h
+	[[nodiscard]] bool aliases(const MatrixView<const T>& dst) const
+	{
+		return MatrixExprDetail::overlaps(view(), dst);
+	}
+
+	[[nodiscard]] allocator_type get_allocator() const noexcept
+	{
+		return data_.get_allocator();
 	}
 	
 	/*Fills the matrix according to the fill_type
-	 * Min and max can be specified with set_rand_limits() or set_rand_min()/
-	 * set_rand_max(). For char-types printable characters are in range
-	 * [41, 126]
+	 * Min and max of the random fills can be specified with
+	 * set_rand_limits(). Without a seed every call draws different numbers.
 	 */
 	Matrix& fill(fill_type fill_type);
 
+	// Same, the random fills are reproducible: equal seeds give equal
+	// matrices, see fill_random()
+	Matrix& fill(fill_type fill_type, const std::uint64_t seed);
+
+	/*Fills the matrix with numbers drawn from dist, one of
+	 * Random::uniform_int{ min, max }, Random::uniform_real{ min, max } and
+	 * Random::normal{ mean, stddev }. Element k of the storage only depends
+	 * on seed and k, so the result is bit-identical for every thread count
+	 * and instruction set. See RandomKernels.h.
+	 */
+	template<typename Dist>
+	Matrix& fill_random(const Dist& dist,
+		const std::uint64_t seed = RandomKernels::next_seed());
+
+	// Limits of fill_type::randi and fill_type::rand, [0, 10] by default
+	static void set_rand_limits(const int min, const int max)
+	{
+		assert(min <= max);
+		rand_limits_.store({ min, max });
+	}
+
 
 	// Arithmetic operations. Declaring operations friend allows implicit
 	// conversions both ways, here it has nothing to do with access-specifying.
@@ -118,10 +332,11 @@ public:
 	{
 		assert(lhs.size() == rhs.size());
 
-		// TODO: Optimize *=
-		// Lazy way:
-		Matrix<T> result = lhs * rhs;
-		lhs.vectors_ = result.vectors_;
+		// The product can't be formed in place. It goes to a temporary of
+		// lhs's resource whose buffer then replaces the old one.
+		Matrix<T> product(lhs.col_size_, rhs.row_size_, lhs.get_allocator());
+		gemm(T(1), lhs, op_type::none, rhs, op_type::none, T(0), product);
+		lhs.data_.swap(product.data_);
 
 		return lhs;
 	}
@@ -131,7 +346,8 @@ public:
 		using namespace VectorOperations;
 		assert(lhs.size() == rhs.size());
 
-		lhs.vectors_ += rhs.vectors_;
+		add(lhs.data_.data(), lhs.data_.data(), rhs.data_.data(),
+			lhs.data_.size());
 		return lhs;
 	}
 	
@@ -143,30 +359,21 @@ public:
 		using namespace VectorOperations;
 		assert(lhs.size() == rhs.size());
 
-		lhs.vectors_ -= rhs.vectors_;
+		subtract(lhs.data_.data(), lhs.data_.data(), rhs.data_.data(),
+			lhs.data_.size());
 		return lhs;
 	}
 	
-	friend Matrix operator+(const Matrix& lhs, const Matrix& rhs)
-	{
-		using namespace VectorOperations;
-		assert(lhs.size() == rhs.size());
+	// Element-wise expressions on the right-hand side are evaluated
+	// directly into lhs
+	template <typename E>
+	Matrix& operator+=(const MatrixExpr<E>& rhs);
 
-		// New Matrix is constructed from the rvalue-expression
-		return lhs.vectors_ + rhs.vectors_;
-	}
+	template <typename E>
+	Matrix& operator-=(const MatrixExpr<E>& rhs);
 
-	friend Matrix operator-(const Matrix& lhs, const Matrix& rhs)
-	{
-		static_assert(std::is_signed<T>() || std::is_class<T>(),
-			"subtraction is not defined for unsigned integral type");
-		
-		using namespace VectorOperations;
-		assert(lhs.size() == rhs.size());
-
-		// See above
-		return lhs.vectors_ - rhs.vectors_;
-	}
+	// Matrix + Matrix, Matrix - Matrix and scalar products with const
+	// operands are lazy expressions, see MatrixExpr.h.
 
 	// Matrix multiplication
 	friend Matrix<T> operator*<T>(const Matrix<T>& lhs, const Matrix<T>& rhs);
@@ -174,18 +381,18 @@ public:
 	// Scalar multiplication
 	friend Matrix& operator*(const T scalar, Matrix<T>& rhs)
 	{
-		for (auto& vector : rhs.vectors_)
-		{
-			for (T& element : vector)
-			{
-				element *= scalar;
-			}
-		}
+		VectorOperations::scale(rhs.data_.data(), scalar, rhs.data_.size());
 		return rhs;
 	}
 
 	// Matrix to the power of a positive whole number. Returns a new Matrix.
-	Matrix power(const int exponent);
+	// Computed by repeated squaring, diagonal matrices element-wise.
+	[[nodiscard]] Matrix power(const int exponent) const;
+
+	// Same, but writes into result, which is resized as needed and keeps
+	// its allocator. Repeated calls with the same result reuse its buffer.
+	// result may be *this.
+	Matrix& power(const int exponent, Matrix& result) const;
 
 	// Computes the trace of the matrix
 	T trace()
@@ -196,16 +403,28 @@ public:
 		T result(0);
 		for (unsigned i=0, j=0; i < col_size_; ++i, ++j)
 		{
-			result += vectors_[i][j];
+			result += data_[i * stride_ + j];
 		}
 		return result;
 	}
 	
 	// TODO: Linear algebra
 
-	// Transposes the matrix
+	// Transposes the matrix in place: blocked and cache-oblivious for
+	// square matrices, cycle-following for large rectangular ones
 	Matrix& transpose();
 
+	// Lazy transpose, a view that swaps the strides (see MatrixView.h)
+	[[nodiscard]] MatrixView<T> transposed() noexcept
+	{
+		return view().transposed();
+	}
+
+	[[nodiscard]] MatrixView<const T> transposed() const noexcept
+	{
+		return view().transposed();
+	}
+
 	// Is used to determine the types of LU etc.
 	// Fraction for integrals and float, double etc. for floating points
 
@@ -217,33 +436,73 @@ public:
 	// Struct for holding result of the LU-factorization
 	struct LU
 	{
-		// Constructor initializes L as square identity matrix and U as
-		// the matrix we want to calculate LU for
-		explicit LU(const Matrix<LU_T>& mat) :
-			L(mat.size().first, fill_type::identity),
-			U(mat)
-		{}
-
-		// L is square and lower triangular
+		// L is square and unit lower triangular
 		Matrix<LU_T> L;
 
 		// U is upper triangular
 		Matrix<LU_T> U;
+
+		// Row permutation of the partial pivoting: P * A = L * U, where
+		// row i of P * A is row P[i] of A. See permute_rows().
+		std::vector<std::size_t> P;
+
+		// Solves A * X = B with the factorization of a square A. The
+		// factorization can be reused, each column of B costs O(n^2).
+		[[nodiscard]] Matrix<LU_T> solve(const MatrixView<const LU_T> B) const
+		{
+			// Singular matrices trip the assertion in trsm
+			assert(U.size().first == U.size().second);
+			assert(B.size().first == P.size());
+
+			const auto cols = B.size().second;
+			Matrix<LU_T> X(P.size(), cols);
+			for (std::size_t i = 0; i < P.size(); ++i)
+			{
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					X[i][j] = B(P[i], j);
+				}
+			}
+			trsm(triangle_type::lower, diag_type::unit, L, X);
+			trsm(triangle_type::upper, diag_type::non_unit, U, X);
+			return X;
+		}
+
+		// Also takes integral matrices, which convert to Fraction
+		[[nodiscard]] Matrix<LU_T> solve(const Matrix<LU_T>& B) const
+		{
+			return solve(B.view());
+		}
+
+		// Single right-hand side
+		[[nodiscard]] std::vector<LU_T> solve(const std::vector<LU_T>& b) const
+		{
+			assert(U.size().first == U.size().second);
+			assert(b.size() == P.size());
+
+			std::vector<LU_T> x(b.size());
+			for (std::size_t i = 0; i < x.size(); ++i)
+			{
+				x[i] = b[P[i]];
+			}
+			trsv(triangle_type::lower, diag_type::unit, L, x);
+			trsv(triangle_type::upper, diag_type::non_unit, U, x);
+			return x;
+		}
 	};
 
 	// Floating point and integral type lu() are not the same. SFINAE is used.
 	
 	/**
-	 * \brief Computes LU-factorization
-	 * \return LU-struct with members L and U.
+	 * \brief Computes LU-factorization with partial pivoting
+	 * \return LU-struct with members L, U and P.
 	 */
 	template <typename U = T>
 	[[nodiscard]]
 	std::enable_if_t<!std::is_floating_point_v<U>, LU>
 	lu() const
 	{
-		LU lu(static_cast<Matrix<Fraction>>(*this));
-		return compute_lu(lu, 1);
+		return compute_lu(convert_to<LU_T>(get_allocator().resource()));
 	}
 
 	template <typename U = T>
@@ -251,15 +510,93 @@ public:
 	std::enable_if_t<std::is_floating_point_v<U>, LU>
 	lu() const
 	{
-		LU lu(*this);
-		return compute_lu(lu, 1);
+		return compute_lu(Matrix(*this, get_allocator()));
+	}
+
+	// Returns a new Matrix whose row i is row perm[i] of *this
+	[[nodiscard]] Matrix permute_rows(
+		const std::vector<std::size_t>& perm) const;
+
+	// Result of the fraction-free (Bareiss) elimination of an integral
+	// Matrix. All arithmetic is done in W with exact divisions. The values
+	// are minors of the Matrix, so W has to be wide enough for them; a
+	// big integer type can be used for W.
+	template <typename W>
+	struct Bareiss
+	{
+		// Fraction-free row echelon form of P * A
+		Matrix<W> R;
+
+		// Row permutation, see LU::P
+		std::vector<std::size_t> P;
+
+		std::size_t rank;
+
+		// Zero unless the Matrix is square and non-singular
+		W determinant;
+	};
+
+	// Exact solution of A * X = B, i.e. A^-1 * B = X / denominator
+	template <typename W>
+	struct ExactSolution
+	{
+		Matrix<W> X;
+		W denominator;
+	};
+
+	/**
+	 * \brief Fraction-free Gaussian elimination (Bareiss algorithm)
+	 * \return Bareiss-struct with the echelon form, rank and determinant
+	 * \throw std::overflow_error if a minor doesn't fit in the built-in
+	 * integer type W (also for determinant, rank and solve_exact)
+	 */
+	template <typename W = long long, typename U = T>
+	[[nodiscard]]
+	std::enable_if_t<std::is_integral_v<U>, Bareiss<W>>
+	bareiss() const
+	{
+		return compute_bareiss<W>(get_allocator().resource());
 	}
 
+	// Determinant, computed exactly with bareiss() for integral types
+	template <typename W = long long, typename U = T>
+	[[nodiscard]]
+	std::enable_if_t<std::is_integral_v<U>, W>
+	determinant() const
+	{
+		assert(col_size_ == row_size_);
+		return compute_bareiss<W>(MatrixScratch::resource()).determinant;
+	}
+
+	// Determinant from the LU-factorization for the rest of the types
+	template <typename U = T>
+	[[nodiscard]]
+	std::enable_if_t<!std::is_integral_v<U>, LU_T>
+	determinant() const;
+
+	template <typename W = long long, typename U = T>
+	[[nodiscard]]
+	std::enable_if_t<std::is_integral_v<U>, std::size_t>
+	rank() const
+	{
+		return compute_bareiss<W>(MatrixScratch::resource()).rank;
+	}
+
+	/**
+	 * \brief Solves A * X = B exactly in integer arithmetic
+	 * \return X and denominator such that A^-1 * B = X / denominator
+	 */
+	template <typename W = long long, typename U = T>
+	[[nodiscard]]
+	std::enable_if_t<std::is_integral_v<U>, ExactSolution<W>>
+	solve_exact(const Matrix& B) const;
+
 	// Equality operators.	
 
 	friend bool operator==(const Matrix& lhs, const Matrix& rhs)
 	{
-		return lhs.vectors_ == rhs.vectors_;
+		return lhs.size() == rhs.size() && VectorOperations::equal(
+			lhs.data_.data(), rhs.data_.data(), lhs.data_.size());
 	}
 
 	friend bool operator!=(const Matrix& lhs, const Matrix& rhs)
@@ -290,23 +627,36 @@ public:
 	}
 
 private:
-	// Matrix is represented as a vector
-	std::vector<std::vector<T>> vectors_;
+	// Matrix is represented as a single row-major buffer. Owned storage is
+	// always dense, i.e. stride_ == row_size_.
+	std::pmr::vector<T> data_;
 
 	// Matrix's size
 	std::size_t col_size_;
 	std::size_t row_size_;
 
-	// TODO: mutable RandLimits
+	// Row stride of data_
+	std::size_t stride_;
+
 	struct RandLimits
 	{
-		int min{ 0 };
-		int max{ 10 };
+		int min;
+		int max;
 	};
-	inline static RandLimits rand_limits_;
+	inline static std::atomic<RandLimits> rand_limits_{ RandLimits{ 0, 10 } };
+
+	// Reshapes to n x m, reusing the buffer when possible. Element values
+	// are unspecified afterwards.
+	void resize(const std::size_t n, const std::size_t m);
 
 	// Size-checking (initList / vector constructors)
-	[[nodiscard]] bool check_matrix_rows() const;
+	template <typename Rows>
+	[[nodiscard]] static bool check_matrix_rows(
+		const Rows& rows, const std::size_t row_size);
+
+	// Copies the rows of an initList / vector into data_
+	template <typename Rows>
+	void assign_rows(const Rows& rows);
 	
 	// Fillers methods
 	
@@ -314,23 +664,62 @@ private:
 	// as ones.
 	void fill_identity();
 
-	// Fills matrix with random whole numbers / reals
-	void fill_randi();
-	void fill_rand();
 
-	// Combines the functionality of the previous two functions
-	template<typename Dist>
-	void fill_random(const Dist& number_dist);
+	// Right-looking blocked LU with partial pivoting. Factors A in place
+	// and splits the result into L and U.
+	static LU compute_lu(Matrix<LU_T> A);
 
-	// Recursive functions that compute the LU-fact using Doolittle algorithm.
-	// These templates are enabled by return type.
+	// Element-wise copy into a Matrix of another type
+	template <typename W>
+	[[nodiscard]] Matrix<W> convert_to(
+		std::pmr::memory_resource* resource) const;
 
-	LU& compute_lu(LU& lu, const unsigned n) const;
+	// bareiss() with R allocated from resource
+	template <typename W>
+	[[nodiscard]] Bareiss<W> compute_bareiss(
+		std::pmr::memory_resource* resource) const;
+
+	// Bookkeeping of bareiss_eliminate
+	template <typename W>
+	struct BareissSteps
+	{
+		std::size_t rank;
+		int sign;
+		W last_pivot;
+	};
+
+	// Bareiss elimination of M in place. Pivots are only taken from the
+	// first pivot_cols columns, the rest (e.g. right-hand sides) just
+	// follow along. perm receives the row permutation.
+	template <typename W>
+	static BareissSteps<W> bareiss_eliminate(Matrix<W>& M,
+		const std::size_t pivot_cols, std::vector<std::size_t>& perm);
+
+	// Arithmetic of the exact algorithms. For built-in integer types
+	// results that don't fit throw std::overflow_error instead of
+	// wrapping, other working types just use their operators.
+	template <typename W>
+	[[nodiscard]] static W exact_mul(const W& lhs, const W& rhs);
+
+	template <typename W>
+	[[nodiscard]] static W exact_sub(const W& lhs, const W& rhs);
+
+	template <typename W>
+	[[nodiscard]] static W exact_div(const W& lhs, const W& rhs);
 };
 
 // Alias for LU-struct
 template<typename T>
 using LU_t = typename Matrix<T>::LU;
 
+// Solves the linear system A * X = B through the LU-factorization of A.
+// Factorize once with lu() and call LU::solve() to reuse it. Integral
+// systems are solved exactly in Fraction.
+template<typename T>
+Matrix<typename Matrix<T>::LU_T> solve(const Matrix<T>& A, const Matrix<T>& B)
+{
+	return A.lu().solve(B);
+}
+
 // Less clutter from the definitions
 #include "matrix_defs.h"
\ No newline at end of file
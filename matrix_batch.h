@@ -0,0 +1,522 @@
+#pragma once
+
+// Batches of many small matrices of the same size
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <memory_resource>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "matrix.h"
+
+/*
+* count matrices of rows x cols in an interleaved structure-of-arrays
+* layout. The matrices are split into groups of lanes; within a group,
+* element (i, j) of every matrix is one run of lanes values:
+*
+*   element (i, j) of matrix b is at
+*   data()[((b / lanes) * rows * cols + i * cols + j) * lanes + b % lanes]
+*
+* The kernels work on one group at a time, which stays in the L1 or L2
+* cache for the sizes this is meant for (up to about 16 x 16), and
+* vectorize over the lanes instead of over the tiny rows. The groups are
+* spread over the thread pool. The lanes of the last group beyond count
+* take part in every kernel but are never visible.
+*/
+template<typename T>
+class MatrixBatch
+{
+public:
+	using value_type = T;
+	using allocator_type = std::pmr::polymorphic_allocator<T>;
+
+	static constexpr std::size_t lanes = SimdKernels::batch_lanes;
+
+	// Result of lu(), the factorization of every matrix of the batch
+	struct LU
+	{
+		// The multipliers of L below the diagonal, its unit diagonal is not
+		// stored, and U on and above it
+		MatrixBatch factors;
+
+		// Partial pivoting: step k swapped row k of matrix b with row
+		// pivots[(b / lanes * rows + k) * lanes + b % lanes]
+		std::pmr::vector<std::size_t> pivots;
+
+		// Solves A * X = B for every matrix, B is a batch of the same count
+		[[nodiscard]] MatrixBatch solve(const MatrixBatch& B) const;
+	};
+
+	// count zero matrices
+	MatrixBatch(const std::size_t count, const std::size_t rows,
+		const std::size_t cols, const allocator_type& alloc = {}) :
+		count_(count),
+		rows_(rows),
+		cols_(cols),
+		data_(groups() * rows * cols * lanes, T(0), alloc)
+	{}
+
+	// Copies of the matrices, which all have the same size
+	explicit MatrixBatch(const std::vector<Matrix<T>>& matrices,
+		const allocator_type& alloc = {});
+
+	[[nodiscard]] std::size_t count() const noexcept { return count_; }
+
+	// Size of every matrix
+	[[nodiscard]] std::pair<std::size_t, std::size_t> size() const noexcept
+	{
+		return { rows_, cols_ };
+	}
+
+	[[nodiscard]] std::size_t groups() const noexcept
+	{
+		return (count_ + lanes - 1) / lanes;
+	}
+
+	T* data() noexcept { return data_.data(); }
+	const T* data() const noexcept { return data_.data(); }
+
+	[[nodiscard]] allocator_type get_allocator() const noexcept
+	{
+		return data_.get_allocator();
+	}
+
+	// Element (i, j) of matrix b
+	T& operator()(const std::size_t b, const std::size_t i, const std::size_t j)
+	{
+		assert(b < count_ && i < rows_ && j < cols_);
+		return data_[index(b, i, j)];
+	}
+
+	const T& operator()(const std::size_t b, const std::size_t i, const std::size_t j) const
+	{
+		assert(b < count_ && i < rows_ && j < cols_);
+		return data_[index(b, i, j)];
+	}
+
+	// Copy of matrix b
+	[[nodiscard]] Matrix<T> matrix(const std::size_t b) const;
+
+	// Overwrites matrix b
+	void assign(const std::size_t b, const MatrixView<const T> matrix);
+
+	// Products of the matrices with the same index
+	friend MatrixBatch operator*(const MatrixBatch& lhs, const MatrixBatch& rhs)
+	{
+		assert(lhs.count_ == rhs.count_ && lhs.cols_ == rhs.rows_);
+
+		MatrixBatch result(lhs.count_, lhs.rows_, rhs.cols_, lhs.get_allocator());
+		VectorOperations::for_ranges(lhs.groups(), lhs.rows_ * lhs.cols_ * rhs.cols_ * lanes,
+			[&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto g = begin; g < end; ++g)
+			{
+				group_gemm(result.group(g), lhs.group(g), rhs.group(g),
+					lhs.rows_, lhs.cols_, rhs.cols_);
+			}
+		});
+		return result;
+	}
+
+	// The transposes, a new batch of cols x rows matrices
+	[[nodiscard]] MatrixBatch transpose() const;
+
+	// The traces of the square matrices
+	[[nodiscard]] std::vector<T> trace() const;
+
+	// The powers of the square matrices, by repeated squaring like
+	// Matrix::power. Each group keeps its workspaces in the cache.
+	[[nodiscard]] MatrixBatch power(const int exponent) const;
+
+	// LU-factorizations with partial pivoting of the square matrices,
+	// floating point only. Like Matrix::lu(), singular columns are
+	// skipped, solving with them gives infinities or NaN.
+	[[nodiscard]] LU lu() const;
+
+	friend bool operator==(const MatrixBatch& lhs, const MatrixBatch& rhs)
+	{
+		if (lhs.count_ != rhs.count_ || lhs.size() != rhs.size()) return false;
+		for (std::size_t b = 0; b < lhs.count_; ++b)
+		{
+			for (std::size_t e = 0; e < lhs.rows_ * lhs.cols_; ++e)
+			{
+				if (!(lhs.data_[lhs.index(b, 0, e)] == rhs.data_[rhs.index(b, 0, e)]))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	friend bool operator!=(const MatrixBatch& lhs, const MatrixBatch& rhs)
+	{
+		return !(lhs == rhs);
+	}
+
+private:
+	std::size_t count_;
+	std::size_t rows_;
+	std::size_t cols_;
+	std::pmr::vector<T> data_;
+
+	// Element e = i * cols + j may run past the row, see operator==
+	[[nodiscard]] std::size_t index(const std::size_t b, const std::size_t i,
+		const std::size_t j) const noexcept
+	{
+		return ((b / lanes) * rows_ * cols_ + i * cols_ + j) * lanes + b % lanes;
+	}
+
+	T* group(const std::size_t g) noexcept { return data_.data() + g * rows_ * cols_ * lanes; }
+	const T* group(const std::size_t g) const noexcept
+	{
+		return data_.data() + g * rows_ * cols_ * lanes;
+	}
+
+	// c = a * b for one group
+	static void group_gemm(T* c, const T* a, const T* b,
+		const std::size_t m, const std::size_t k, const std::size_t n)
+	{
+		if constexpr (SimdKernels::is_supported<T>)
+		{
+			SimdKernels::batch_gemm(c, a, b, m, k, n);
+		}
+		else
+		{
+			for (std::size_t i = 0; i < m; ++i)
+			{
+				for (std::size_t j = 0; j < n; ++j)
+				{
+					T* c_ij = c + (i * n + j) * lanes;
+					std::fill(c_ij, c_ij + lanes, T(0));
+					for (std::size_t p = 0; p < k; ++p)
+					{
+						const T* a_ip = a + (i * k + p) * lanes;
+						const T* b_pj = b + (p * n + j) * lanes;
+						for (std::size_t l = 0; l < lanes; ++l)
+						{
+							c_ij[l] += a_ip[l] * b_pj[l];
+						}
+					}
+				}
+			}
+		}
+	}
+};
+
+template<typename T>
+MatrixBatch<T>::MatrixBatch(const std::vector<Matrix<T>>& matrices,
+	const allocator_type& alloc) :
+	MatrixBatch(matrices.size(),
+		matrices.empty() ? 0 : matrices.front().size().first,
+		matrices.empty() ? 0 : matrices.front().size().second, alloc)
+{
+	for (std::size_t b = 0; b < count_; ++b)
+	{
+		assign(b, matrices[b]);
+	}
+}
+
+template<typename T>
+Matrix<T> MatrixBatch<T>::matrix(const std::size_t b) const
+{
+	assert(b < count_);
+
+	Matrix<T> result(rows_, cols_, get_allocator().resource());
+	for (std::size_t i = 0; i < rows_; ++i)
+	{
+		for (std::size_t j = 0; j < cols_; ++j)
+		{
+			result[i][j] = data_[index(b, i, j)];
+		}
+	}
+	return result;
+}
+
+template<typename T>
+void MatrixBatch<T>::assign(const std::size_t b, const MatrixView<const T> matrix)
+{
+	assert(b < count_ && matrix.size() == size());
+
+	for (std::size_t i = 0; i < rows_; ++i)
+	{
+		for (std::size_t j = 0; j < cols_; ++j)
+		{
+			data_[index(b, i, j)] = matrix(i, j);
+		}
+	}
+}
+
+template<typename T>
+MatrixBatch<T> MatrixBatch<T>::transpose() const
+{
+	MatrixBatch result(count_, cols_, rows_, get_allocator());
+	VectorOperations::for_ranges(groups(), rows_ * cols_ * lanes,
+		[&](const std::size_t begin, const std::size_t end)
+	{
+		for (auto g = begin; g < end; ++g)
+		{
+			const T* src = group(g);
+			T* dst = result.group(g);
+			for (std::size_t i = 0; i < rows_; ++i)
+			{
+				for (std::size_t j = 0; j < cols_; ++j)
+				{
+					std::copy_n(src + (i * cols_ + j) * lanes, lanes,
+						dst + (j * rows_ + i) * lanes);
+				}
+			}
+		}
+	});
+	return result;
+}
+
+template<typename T>
+std::vector<T> MatrixBatch<T>::trace() const
+{
+	assert(rows_ == cols_);
+
+	std::vector<T> padded(groups() * lanes, T(0));
+	VectorOperations::for_ranges(groups(), rows_ * lanes,
+		[&](const std::size_t begin, const std::size_t end)
+	{
+		for (auto g = begin; g < end; ++g)
+		{
+			T* sums = padded.data() + g * lanes;
+			for (std::size_t i = 0; i < rows_; ++i)
+			{
+				const T* diagonal = group(g) + (i * cols_ + i) * lanes;
+				for (std::size_t l = 0; l < lanes; ++l)
+				{
+					sums[l] += diagonal[l];
+				}
+			}
+		}
+	});
+	padded.resize(count_);
+	return padded;
+}
+
+template<typename T>
+MatrixBatch<T> MatrixBatch<T>::power(const int exponent) const
+{
+	// Negative exponents are not defined
+	assert(exponent >= 0);
+	// Square matrices only
+	assert(rows_ == cols_);
+
+	const auto n = rows_;
+	const auto elements = n * n * lanes;
+	MatrixBatch result(count_, n, n, get_allocator());
+
+	// The products of the highest power of two
+	std::size_t products = 0;
+	for (auto e = exponent; e > 1; e >>= 1) products += 2;
+
+	VectorOperations::for_ranges(groups(), products * n * n * n * lanes,
+		[&](const std::size_t begin, const std::size_t end)
+	{
+		// Workspaces of one group, like in Matrix::power the products go to
+		// the spare one, which then swaps places with its operand
+		std::pmr::vector<T> base(elements, MatrixScratch::resource());
+		std::pmr::vector<T> accumulator(elements, MatrixScratch::resource());
+		std::pmr::vector<T> spare(elements, MatrixScratch::resource());
+
+		for (auto g = begin; g < end; ++g)
+		{
+			T* dst = result.group(g);
+			if (exponent == 0)
+			{
+				for (std::size_t i = 0; i < n; ++i)
+				{
+					std::fill_n(dst + (i * n + i) * lanes, lanes, T(1));
+				}
+				continue;
+			}
+
+			std::copy_n(group(g), elements, base.begin());
+			bool accumulated = false;
+			for (auto e = exponent; e > 0; e >>= 1)
+			{
+				if (e & 1)
+				{
+					if (accumulated)
+					{
+						group_gemm(spare.data(), accumulator.data(), base.data(), n, n, n);
+						accumulator.swap(spare);
+					}
+					else
+					{
+						std::copy(base.begin(), base.end(), accumulator.begin());
+						accumulated = true;
+					}
+				}
+				if (e > 1)
+				{
+					group_gemm(spare.data(), base.data(), base.data(), n, n, n);
+					base.swap(spare);
+				}
+			}
+			std::copy(accumulator.begin(), accumulator.end(), dst);
+		}
+	});
+	return result;
+}
+
+template<typename T>
+typename MatrixBatch<T>::LU MatrixBatch<T>::lu() const
+{
+	static_assert(std::is_floating_point_v<T>,
+		"batched LU needs floating point elements");
+	assert(rows_ == cols_);
+
+	const auto n = rows_;
+	LU result{ *this, std::pmr::vector<std::size_t>(groups() * n * lanes, get_allocator()) };
+
+	VectorOperations::for_ranges(groups(), n * n * n * lanes,
+		[&](const std::size_t begin, const std::size_t end)
+	{
+		for (auto g = begin; g < end; ++g)
+		{
+			T* a = result.factors.group(g);
+			std::size_t* pivots = result.pivots.data() + g * n * lanes;
+			const auto at = [a, n](const std::size_t i, const std::size_t j)
+			{
+				return a + (i * n + j) * lanes;
+			};
+
+			for (std::size_t k = 0; k < n; ++k)
+			{
+				// Largest magnitude in column k of every lane
+				std::size_t* pivot = pivots + k * lanes;
+				T largest[lanes];
+				for (std::size_t l = 0; l < lanes; ++l)
+				{
+					pivot[l] = k;
+					largest[l] = std::abs(at(k, k)[l]);
+				}
+				for (auto i = k + 1; i < n; ++i)
+				{
+					for (std::size_t l = 0; l < lanes; ++l)
+					{
+						if (std::abs(at(i, k)[l]) > largest[l])
+						{
+							largest[l] = std::abs(at(i, k)[l]);
+							pivot[l] = i;
+						}
+					}
+				}
+				for (std::size_t l = 0; l < lanes; ++l)
+				{
+					if (pivot[l] == k) continue;
+					for (std::size_t j = 0; j < n; ++j)
+					{
+						std::swap(at(k, j)[l], at(pivot[l], j)[l]);
+					}
+				}
+
+				// Singular lanes get zero multipliers, their column is zero
+				T inverse[lanes];
+				for (std::size_t l = 0; l < lanes; ++l)
+				{
+					inverse[l] = at(k, k)[l] == T(0) ? T(0) : T(1) / at(k, k)[l];
+				}
+				for (auto i = k + 1; i < n; ++i)
+				{
+					T* multiplier = at(i, k);
+					for (std::size_t l = 0; l < lanes; ++l)
+					{
+						multiplier[l] = multiplier[l] * inverse[l];
+					}
+					for (auto j = k + 1; j < n; ++j)
+					{
+						T* row_i = at(i, j);
+						const T* row_k = at(k, j);
+						for (std::size_t l = 0; l < lanes; ++l)
+						{
+							row_i[l] -= multiplier[l] * row_k[l];
+						}
+					}
+				}
+			}
+		}
+	});
+	return result;
+}
+
+template<typename T>
+MatrixBatch<T> MatrixBatch<T>::LU::solve(const MatrixBatch& B) const
+{
+	const auto n = factors.rows_;
+	const auto cols = B.cols_;
+	assert(B.count_ == factors.count_ && B.rows_ == n);
+
+	MatrixBatch X(B);
+	VectorOperations::for_ranges(X.groups(), n * n * cols * lanes,
+		[&](const std::size_t begin, const std::size_t end)
+	{
+		for (auto g = begin; g < end; ++g)
+		{
+			const T* a = factors.group(g);
+			const std::size_t* pivot = pivots.data() + g * n * lanes;
+			T* x = X.group(g);
+
+			// The row interchanges in the order of the elimination
+			for (std::size_t k = 0; k < n; ++k)
+			{
+				for (std::size_t l = 0; l < lanes; ++l)
+				{
+					const auto p = pivot[k * lanes + l];
+					if (p == k) continue;
+					for (std::size_t j = 0; j < cols; ++j)
+					{
+						std::swap(x[(k * cols + j) * lanes + l], x[(p * cols + j) * lanes + l]);
+					}
+				}
+			}
+
+			// L * Y = P * B, then U * X = Y
+			const auto eliminate = [&](const std::size_t i, const std::size_t p)
+			{
+				const T* factor = a + (i * n + p) * lanes;
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					T* x_ij = x + (i * cols + j) * lanes;
+					const T* x_pj = x + (p * cols + j) * lanes;
+					for (std::size_t l = 0; l < lanes; ++l)
+					{
+						x_ij[l] -= factor[l] * x_pj[l];
+					}
+				}
+			};
+			for (std::size_t i = 1; i < n; ++i)
+			{
+				for (std::size_t p = 0; p < i; ++p) eliminate(i, p);
+			}
+			for (auto i = n; i-- > 0;)
+			{
+				for (auto p = i + 1; p < n; ++p) eliminate(i, p);
+				const T* diagonal = a + (i * n + i) * lanes;
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					T* x_ij = x + (i * cols + j) * lanes;
+					for (std::size_t l = 0; l < lanes; ++l)
+					{
+						x_ij[l] /= diagonal[l];
+					}
+				}
+			}
+		}
+	});
+	return X;
+}
+
+// Solves A * X = B for every pair of matrices, see MatrixBatch::lu()
+template<typename T>
+[[nodiscard]] MatrixBatch<T> solve(const MatrixBatch<T>& A, const MatrixBatch<T>& B)
+{
+	return A.lu().solve(B);
+}
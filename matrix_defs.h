@@ -8,73 +8,194 @@
 #pragma once
 
 #include <algorithm>
+#include <limits>
+#include <stdexcept>
 #include "matrix.h"
+#include "GemmKernels.h"
+#include "StrassenKernels.h"
+#include "TextKernels.h"
+#include "TransposeKernels.h"
+#include "TriangularKernels.h"
 
 // TODO: constraints for type T (MSVC Preview concepts)
 
 template <typename T>
-Matrix<T>::Matrix(const std::size_t n) :
-	vectors_(n, std::vector<T>(n)),
+Matrix<T>::Matrix(const std::size_t n, const allocator_type& alloc) :
+	data_(n * n, alloc),
 	col_size_(n),
-	row_size_(n)
+	row_size_(n),
+	stride_(n)
 {}
 
 template <typename T>
-Matrix<T>::Matrix(const std::size_t n, const std::size_t m) :
-	vectors_(n, std::vector<T>(m)),
+Matrix<T>::Matrix(const std::size_t n, const std::size_t m,
+	const allocator_type& alloc) :
+	data_(n * m, alloc),
 	col_size_(n),
-	row_size_(m)
+	row_size_(m),
+	stride_(m)
 {}
 
 template <typename T>
-Matrix<T>::Matrix(const std::size_t n, const fill_type fill_type) :
-	vectors_(n, std::vector<T>(n)),
+Matrix<T>::Matrix(const std::size_t n, const fill_type fill_type,
+	const allocator_type& alloc) :
+	data_(n * n, alloc),
 	col_size_(n),
-	row_size_(n)
+	row_size_(n),
+	stride_(n)
 {
 	fill(fill_type);
 }
 
 template <typename T>
-Matrix<T>::Matrix(const std::size_t n, const std::size_t m, fill_type fill_type) :
-	vectors_(n, std::vector<T>(m)),
+Matrix<T>::Matrix(const std::size_t n, const std::size_t m, fill_type fill_type,
+	const allocator_type& alloc) :
+	data_(n * m, alloc),
 	col_size_(n),
-	row_size_(m)
+	row_size_(m),
+	stride_(m)
 {
 	fill(fill_type);
 }
 
 template <typename T>
-Matrix<T>::Matrix(std::initializer_list<std::initializer_list<T>> init_list) :
-	vectors_(init_list.begin(), init_list.end()),
+Matrix<T>::Matrix(std::initializer_list<std::initializer_list<T>> init_list,
+	const allocator_type& alloc) :
+	data_(alloc),
 	col_size_(init_list.size()),
-	row_size_(init_list.begin()->size())
+	row_size_(init_list.begin()->size()),
+	stride_(row_size_)
 {
 	// Assert that the i-lists' sizes are consistent.
-	assert(check_matrix_rows());
+	assert(check_matrix_rows(init_list, row_size_));
+	assign_rows(init_list);
 }
 
 template <typename T>
-Matrix<T>::Matrix(const std::vector<std::vector<T>>& vectors) :
-	vectors_(vectors),
-	col_size_(vectors_.size()),
-	row_size_(vectors_.begin()->size())
+Matrix<T>::Matrix(const std::vector<std::vector<T>>& vectors,
+	const allocator_type& alloc) :
+	data_(alloc),
+	col_size_(vectors.size()),
+	row_size_(vectors.begin()->size()),
+	stride_(row_size_)
 {
 	// Assert that the vectors' sizes are consistent.
-	assert(check_matrix_rows());
+	assert(check_matrix_rows(vectors, row_size_));
+	assign_rows(vectors);
+}
+
+template <typename T>
+template <typename E, typename>
+Matrix<T>::Matrix(const MatrixExpr<E>& expr, const allocator_type& alloc) :
+	data_(expr.self().size().first * expr.self().size().second, alloc),
+	col_size_(expr.self().size().first),
+	row_size_(expr.self().size().second),
+	stride_(row_size_)
+{
+	evaluate(expr, data_.data(), stride_);
+}
+
+template <typename T>
+Matrix<T>::Matrix(const Matrix& other, const allocator_type& alloc) :
+	data_(other.data_, alloc),
+	col_size_(other.col_size_),
+	row_size_(other.row_size_),
+	stride_(other.stride_)
+{}
+
+template <typename T>
+template <typename E, typename>
+Matrix<T>& Matrix<T>::operator=(const MatrixExpr<E>& expr)
+{
+	// Expressions reading *this at other positions (views, e.g. a
+	// transpose) are evaluated into a new buffer. Otherwise every element
+	// only reads its own position and evaluating in place is safe.
+	if (expr.self().aliases(view()))
+	{
+		return *this = Matrix(expr, get_allocator());
+	}
+	if (size() != expr.self().size())
+	{
+		// Cannot alias *this, as all operands share the expression's size
+		std::tie(col_size_, row_size_) = expr.self().size();
+		stride_ = row_size_;
+		data_.assign(col_size_ * row_size_, T());
+	}
+	evaluate(expr, data_.data(), stride_);
+	return *this;
+}
+
+template <typename T>
+template <typename E>
+Matrix<T>& Matrix<T>::operator+=(const MatrixExpr<E>& rhs)
+{
+	const auto& expr = rhs.self();
+	assert(size() == expr.size());
+	if (expr.aliases(view()))
+	{
+		return *this += Matrix(expr, MatrixScratch::resource());
+	}
+
+	VectorOperations::for_ranges(col_size_, row_size_,
+		[&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				T* row = data_.data() + i * stride_;
+				for (std::size_t j = 0; j < row_size_; ++j)
+				{
+					row[j] += expr.coeff(i, j);
+				}
+			}
+		});
+	return *this;
+}
+
+template <typename T>
+template <typename E>
+Matrix<T>& Matrix<T>::operator-=(const MatrixExpr<E>& rhs)
+{
+	static_assert(std::is_signed<T>() || std::is_class<T>(),
+		"subtraction is not defined for unsigned integral type");
+
+	const auto& expr = rhs.self();
+	assert(size() == expr.size());
+	if (expr.aliases(view()))
+	{
+		return *this -= Matrix(expr, MatrixScratch::resource());
+	}
+
+	VectorOperations::for_ranges(col_size_, row_size_,
+		[&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				T* row = data_.data() + i * stride_;
+				for (std::size_t j = 0; j < row_size_; ++j)
+				{
+					row[j] -= expr.coeff(i, j);
+				}
+			}
+		});
+	return *this;
 }
 
 template <typename T>
 Matrix<T>& Matrix<T>::fill(fill_type fill_type)
 {
+	return fill(fill_type, RandomKernels::next_seed());
+}
+
+template <typename T>
+Matrix<T>& Matrix<T>::fill(fill_type fill_type, const std::uint64_t seed)
+{
+	MATRIX_TRACE_SCOPE(fill, 0, data_.size() * sizeof(T));
+
 	// 0 and 1 are zero-fill and ones-fill.
 	if (fill_type <= fill_type::ones)
 	{
-		for (auto& vector : vectors_)
-		{
-			std::fill(vector.begin(), vector.end(),
-				static_cast<T>(static_cast<int>(fill_type)));
-		}
+		std::fill(data_.begin(), data_.end(),
+			static_cast<T>(static_cast<int>(fill_type)));
 	}
 	else if (fill_type == fill_type::identity)
 	{
@@ -82,11 +203,15 @@ Matrix<T>& Matrix<T>::fill(fill_type fill_type)
 	}
 	else if (fill_type == fill_type::randi)
 	{
-		fill_randi();
+		const auto [min, max] = rand_limits_.load();
+		RandomKernels::fill(data_.data(), data_.size(),
+			Random::uniform_int{ min, max }, seed);
 	}
 	else if (fill_type == fill_type::rand)
 	{
-		fill_rand();
+		const auto [min, max] = rand_limits_.load();
+		RandomKernels::fill(data_.data(), data_.size(),
+			Random::uniform_real{ double(min), double(max) }, seed);
 	}
 	return *this;
 }
@@ -97,134 +222,295 @@ Matrix<T> operator*(const Matrix<T>& lhs, const Matrix<T>& rhs)
 	// Matrix multiplication is defined for:
 	assert(lhs.row_size_ == rhs.col_size_);
 
+	MATRIX_TRACE_SCOPE(multiply,
+		2 * lhs.col_size_ * lhs.row_size_ * rhs.row_size_,
+		(lhs.data_.size() + rhs.data_.size() + lhs.col_size_ * rhs.row_size_) * sizeof(T));
+
 	// New matrix size : NxM * MxP = NxP.
-	const auto new_col_size = lhs.col_size_;
-	const auto new_row_size = rhs.row_size_;
-	
-	// result is initialized to zero.
-	Matrix<T> result(new_col_size, new_row_size);
+	Matrix<T> result(lhs.col_size_, rhs.row_size_, lhs.get_allocator());
+	gemm(T(1), lhs, op_type::none, rhs, op_type::none, T(0), result);
 
-	// Matrix multiplication
-	for (unsigned i = 0; i < new_col_size; ++i)
+	return result;
+}
+
+template <typename T>
+void gemm(const non_deduced_t<T> alpha,
+	const non_deduced_t<MatrixView<const T>> A, const op_type op_a,
+	const non_deduced_t<MatrixView<const T>> B, const op_type op_b,
+	const non_deduced_t<T> beta, Matrix<T>& C)
+{
+	gemm<T>(alpha, A, op_a, B, op_b, beta, C.view());
+}
+
+template <typename T>
+void gemm(const non_deduced_t<T> alpha,
+	const non_deduced_t<MatrixView<const T>> A, const op_type op_a,
+	const non_deduced_t<MatrixView<const T>> B, const op_type op_b,
+	const non_deduced_t<T> beta, const MatrixView<T> C)
+{
+	using Operand = GemmKernels::Operand<T>;
+
+	// Logical sizes of op(A) and op(B)
+	const auto [a_rows, a_cols] = A.size();
+	const auto [b_rows, b_cols] = B.size();
+	const bool trans_a = op_a == op_type::transpose;
+	const bool trans_b = op_b == op_type::transpose;
+
+	const auto m = trans_a ? a_cols : a_rows;
+	const auto k = trans_a ? a_rows : a_cols;
+	const auto n = trans_b ? b_rows : b_cols;
+
+	// Inner dimensions have to agree and C has to be m x n
+	assert(k == (trans_b ? b_cols : b_rows));
+	assert(C.size() == std::make_pair(m, n));
+	assert(!MatrixExprDetail::spans_overlap(C.view(), A) &&
+		!MatrixExprDetail::spans_overlap(C.view(), B));
+
+	// A transpose only swaps the strides, see GemmKernels::Operand
+	const auto operand = [](const MatrixView<const T>& v, const bool trans)
+	{
+		return trans ?
+			Operand{ v.data(), v.col_stride(), v.row_stride() } :
+			Operand{ v.data(), v.row_stride(), v.col_stride() };
+	};
+	const auto a = operand(A, trans_a);
+	const auto b = operand(B, trans_b);
+
+	// Large enough products with the opt-in Strassen-Winograd algorithm
+	if (StrassenKernels::applies(m, n, k))
+	{
+		StrassenKernels::gemm(m, n, k, alpha, a, b, beta,
+			C.data(), C.row_stride(), C.col_stride());
+		return;
+	}
+
+	if (C.col_stride() == 1 || n <= 1)
 	{
-		for (unsigned j = 0; j < new_row_size; ++j)
+		GemmKernels::gemm(m, n, k, alpha, a, b, beta, C.data(), C.row_stride());
+	}
+	else if (C.row_stride() == 1 || m <= 1)
+	{
+		// Columns of C are contiguous: C^T = op(B)^T * op(A)^T
+		GemmKernels::gemm(n, m, k, alpha,
+			Operand{ b.ptr, b.col_stride, b.row_stride },
+			Operand{ a.ptr, a.col_stride, a.row_stride },
+			beta, C.data(), C.col_stride());
+	}
+	else
+	{
+		// No unit stride at all, the product goes through a scratch buffer
+		Matrix<T> product(m, n, MatrixScratch::resource());
+		if (beta != T(0))
 		{
-			for (unsigned k = 0; k < lhs.row_size_; ++k)
-			{
-				result[i][j] += lhs[i][k] * rhs[k][j];
-			}
+			product.view().assign(C);
 		}
+		GemmKernels::gemm(m, n, k, alpha, a, b, beta, product.data(), n);
+		C.assign(product);
 	}
-	return result;
 }
 
 template <typename T>
-Matrix<T> Matrix<T>::power(const int exponent)
+void trsm(const triangle_type uplo, const diag_type diag,
+	const non_deduced_t<MatrixView<const T>> A, Matrix<T>& B)
 {
-	// Negative exponents are not defined
-	assert(exponent >= 0);
+	trsm<T>(uplo, diag, A, B.view());
+}
 
-	if (exponent == 0)
+template <typename T>
+void trsm(const triangle_type uplo, const diag_type diag,
+	const non_deduced_t<MatrixView<const T>> A, const MatrixView<T> B)
+{
+	const auto n = A.size().first;
+	const auto nrhs = B.size().second;
+	assert(A.size().second == n && B.size().first == n);
+
+	// The kernels update whole rows of B
+	if (B.col_stride() != 1 && nrhs > 1)
 	{
-		// 0 exponent is the identity matrix
-		auto copy_mat = *this;
-		return copy_mat.fill(fill_type::identity);
+		Matrix<T> rows(B, MatrixScratch::resource());
+		trsm<T>(uplo, diag, A, rows.view());
+		B.assign(rows);
+		return;
 	}
-	// Else the result is given by successive matrix products
-	Matrix<T> result = *this;
 
-	for (auto e = 1; e < exponent; ++e)
+	const GemmKernels::Operand<T> a{ A.data(), A.row_stride(), A.col_stride() };
+	const bool unit = diag == diag_type::unit;
+	if (uplo == triangle_type::lower)
 	{
-		result *= (*this);
+		TriangularKernels::trsm_lower(n, nrhs, a, unit, B.data(), B.row_stride());
+	}
+	else
+	{
+		TriangularKernels::trsm_upper(n, nrhs, a, unit, B.data(), B.row_stride());
 	}
-	return result;
 }
 
 template <typename T>
-Matrix<T>& Matrix<T>::transpose()
+void trsv(const triangle_type uplo, const diag_type diag,
+	const non_deduced_t<MatrixView<const T>> A, std::vector<T>& b)
 {
-	// Construct an empty vector (transposed result)
-	std::vector<std::vector<T>> t_vector(
-		row_size_, std::vector<T>(col_size_));
+	const auto n = A.size().first;
+	assert(A.size().second == n && b.size() == n);
 
-	for (unsigned i = 0; i < col_size_; ++i)
+	// The kernels take dot products with contiguous rows of A
+	if (A.col_stride() != 1 && n > 1)
 	{
-		for (unsigned j = 0; j < row_size_; ++j)
-		{
-			t_vector[j][i] += vectors_[i][j];
-		}
+		const Matrix<T> rows(A, MatrixScratch::resource());
+		trsv<T>(uplo, diag, rows, b);
+		return;
 	}
-	// Replace the old vector and swap the sizes
-	vectors_ = std::move(t_vector);
-	std::swap(col_size_, row_size_);
 
-	return *this;
+	const bool unit = diag == diag_type::unit;
+	if (uplo == triangle_type::lower)
+	{
+		TriangularKernels::trsv_lower(n, A.data(), A.row_stride(), unit, b.data());
+	}
+	else
+	{
+		TriangularKernels::trsv_upper(n, A.data(), A.row_stride(), unit, b.data());
+	}
 }
 
 template <typename T>
-std::ostream& operator<<(std::ostream& os, const Matrix<T>& obj)
+Matrix<T> Matrix<T>::power(const int exponent) const
 {
-	bool float_format = false;
+	Matrix<T> result(0, get_allocator());
+	power(exponent, result);
+	return result;
+}
 
-	// Change state of the stream
-	if constexpr (std::is_floating_point<T>())
+template <typename T>
+Matrix<T>& Matrix<T>::power(const int exponent, Matrix<T>& result) const
+{
+	// Negative exponents are not defined
+	assert(exponent >= 0);
+	// Square matrices only
+	assert(col_size_ == row_size_);
+
+	// The products are counted as they happen
+	MATRIX_TRACE_SCOPE(power, 0, 0);
+
+	const auto n = col_size_;
+	if (exponent == 0)
 	{
-		os << std::fixed << std::setprecision(2) << std::setfill(' ');
-		float_format = true;
+		// 0 exponent is the identity matrix
+		result.resize(n, n);
+		result.fill_identity();
+		return result;
 	}
-	else
+	if (exponent == 1)
+	{
+		if (&result != this)
+		{
+			result.resize(n, n);
+			std::copy(data_.cbegin(), data_.cend(), result.data_.begin());
+		}
+		return result;
+	}
+
+	// Diagonal matrices, the identity included, stay diagonal: only the
+	// diagonal elements are raised to the power
+	if (is_upper_triangular() && is_lower_triangular())
 	{
-		os << std::setfill(' ');
+		if (&result != this)
+		{
+			result.resize(n, n);
+			std::fill(result.data_.begin(), result.data_.end(), T(0));
+		}
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			T base = data_[i * stride_ + i];
+			T value(1);
+			for (auto e = exponent; e > 0; e >>= 1)
+			{
+				if (e & 1) value = value * base;
+				if (e > 1) base = base * base;
+			}
+			result.data_[i * n + i] = value;
+		}
+		return result;
 	}
 
-	// TODO: Calculate largest element width
-	
-	for (const auto& vec : obj.vectors_)
+	// Binary exponentiation: the base is squared once per bit, and
+	// multiplied into the accumulator for the set bits. Every product goes
+	// to the spare workspace, which then swaps places with its operand, so
+	// the three buffers are allocated once for the whole call.
+	const auto resource = MatrixScratch::resource();
+	Matrix<T> base(*this, resource);
+	Matrix<T> accumulator(n, n, resource);
+	Matrix<T> spare(n, n, resource);
+
+	// The accumulator is the identity until the first set bit, which is a
+	// copy instead of a product
+	bool accumulated = false;
+	for (auto e = exponent; e > 0; e >>= 1)
 	{
-		os << std::endl << '|' << std::setw(4) << std::internal;
-		for (const T& element : vec)
+		if (e & 1)
 		{
-			if (float_format)
+			if (accumulated)
 			{
-				os << ' ' << element << ' ' << std::setw(4);
+				gemm(T(1), accumulator, op_type::none, base, op_type::none,
+					T(0), spare);
+				accumulator.data_.swap(spare.data_);
+				MATRIX_TRACE_COUNT(2 * n * n * n, 3 * n * n * sizeof(T));
 			}
 			else
 			{
-				os << element << std::setw(4);
+				accumulator.data_ = base.data_;
+				accumulated = true;
 			}
 		}
-		os << '|' << std::endl;
+		if (e > 1)
+		{
+			gemm(T(1), base, op_type::none, base, op_type::none, T(0), spare);
+			base.data_.swap(spare.data_);
+			MATRIX_TRACE_COUNT(2 * n * n * n, 2 * n * n * sizeof(T));
+		}
 	}
-	return os << std::endl;
+
+	result.resize(n, n);
+	std::copy(accumulator.data_.cbegin(), accumulator.data_.cend(),
+		result.data_.begin());
+	return result;
+}
+
+template <typename T>
+Matrix<T>& Matrix<T>::transpose()
+{
+	MATRIX_TRACE_SCOPE(transpose, 0, 2 * data_.size() * sizeof(T));
+
+	// Owned storage is dense, so only the sizes change around the
+	// in-place kernel
+	TransposeKernels::transpose(col_size_, row_size_, data_.data());
+	std::swap(col_size_, row_size_);
+	stride_ = row_size_;
+
+	return *this;
+}
+
+// Aligned columns with two decimals for floating point elements, see
+// TextKernels::write
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const Matrix<T>& obj)
+{
+	TextKernels::write(os, obj.data_.data(), obj.col_size_, obj.row_size_,
+		obj.stride_, 1, TextKernels::Format{});
+	return os;
 }
 
 template <typename T>
 bool Matrix<T>::all_of(const T predicate) const
 {
-	return std::all_of(
-		vectors_.cbegin(), vectors_.cend(),
-		[predicate](const std::vector<T>& vector)
-		{
-			return std::all_of(vector.cbegin(), vector.cend(),
-			[predicate](const T element)
-	        {
-				return element == predicate;
-	        });
-		}
-	);
+	return VectorOperations::all_equal(data_.data(), predicate, data_.size());
 }
 
 template <typename T>
 bool Matrix<T>::if_main_diag(const T predicate) const
 {
-	unsigned i = 0;
-	for (const auto& vector : vectors_)
+	const auto diag_size = std::min(col_size_, row_size_);
+	for (std::size_t i = 0; i < diag_size; ++i)
 	{
-		// vector.size() is row_size
-		if (i >= vector.size()) break;
-
-		if (vector[i] != predicate) return false;
-		++i;
+		if (data_[i * stride_ + i] != predicate) return false;
 	}
 	return true;
 }
@@ -232,11 +518,11 @@ bool Matrix<T>::if_main_diag(const T predicate) const
 template <typename T>
 bool Matrix<T>::is_upper_triangular() const
 {
-	for (unsigned i=1; i < col_size_; ++i)
+	for (std::size_t i = 1; i < col_size_; ++i)
 	{
-		for (auto j = i - 1; j < i; ++j)
+		for (std::size_t j = 0; j < std::min(i, row_size_); ++j)
 		{
-			if (vectors_[i][j] != 0) return false;
+			if (data_[i * stride_ + j] != 0) return false;
 		}
 	}
 	return true;
@@ -245,132 +531,482 @@ bool Matrix<T>::is_upper_triangular() const
 template <typename T>
 bool Matrix<T>::is_lower_triangular() const
 {
-	for (unsigned i = 0; i < col_size_; ++i)
+	for (std::size_t i = 0; i < col_size_; ++i)
 	{
 		for (auto j = i + 1; j < row_size_; ++j)
 		{
-			if (vectors_[i][j] != 0) return false;
+			if (data_[i * stride_ + j] != 0) return false;
 		}
 	}
 	return true;
 }
 
 template <typename T>
-bool Matrix<T>::check_matrix_rows() const
+void Matrix<T>::resize(const std::size_t n, const std::size_t m)
+{
+	// std::vector keeps its capacity when shrinking
+	data_.resize(n * m);
+	col_size_ = n;
+	row_size_ = m;
+	stride_ = m;
+}
+
+template <typename T>
+template <typename Rows>
+bool Matrix<T>::check_matrix_rows(const Rows& rows, const std::size_t row_size)
 {
 	return std::all_of(
-		vectors_.cbegin(), vectors_.cend(),
-		[row_size = row_size_](const std::vector<T>& row_vec)
+		rows.begin(), rows.end(),
+		[row_size](const auto& row)
 		{
-			return row_vec.size() == row_size;
+			return row.size() == row_size;
 		}
 	);
 }
 
 template <typename T>
-void Matrix<T>::fill_identity()
+template <typename Rows>
+void Matrix<T>::assign_rows(const Rows& rows)
 {
-	// TODO: Bench current impl. vs for-loop
-	
-	// Zero-init a new vectors_
-	std::vector<std::vector<T>> result(col_size_, std::vector<T>(row_size_));
-	
-	unsigned i = 0;
-	for (auto& vector : result)
+	data_.reserve(col_size_ * row_size_);
+	for (const auto& row : rows)
 	{
-		// Matrices where col_size > row_size
-		if (i >= row_size_) break;
+		data_.insert(data_.end(), row.begin(), row.end());
+	}
+}
+
+template <typename T>
+void Matrix<T>::fill_identity()
+{
+	// Zero the buffer in place
+	std::fill(data_.begin(), data_.end(), T(0));
 
-		vector[i] = 1;
-		++i;
+	// Matrices where col_size > row_size stop at the last column
+	const auto diag_size = std::min(col_size_, row_size_);
+	for (std::size_t i = 0; i < diag_size; ++i)
+	{
+		data_[i * stride_ + i] = 1;
 	}
-	// Replace old
-	vectors_ = result;
 }
 
 template <typename T>
 template <typename Dist>
-void Matrix<T>::fill_random(const Dist& number_dist) 
+Matrix<T>& Matrix<T>::fill_random(const Dist& dist, const std::uint64_t seed)
 {
-	static std::random_device rd;
-	static std::mt19937 rand_eng(rd());
+	MATRIX_TRACE_SCOPE(fill, 0, data_.size() * sizeof(T));
 
-	// Callback lambda for std::generate
-	const auto generator = [&number_dist]() {
-		return static_cast<T>(number_dist(rand_eng));
-	};
-	for (auto& vector : vectors_) 
+	// Owned storage is dense, element k is the k-th of the fill
+	RandomKernels::fill(data_.data(), data_.size(), dist, seed);
+	return *this;
+}
+
+template <typename T>
+Matrix<T> Matrix<T>::permute_rows(const std::vector<std::size_t>& perm) const
+{
+	assert(perm.size() == col_size_);
+
+	Matrix<T> result(col_size_, row_size_, get_allocator());
+	for (std::size_t i = 0; i < col_size_; ++i)
 	{
-		std::generate(vector.begin(), vector.end(), generator);
+		assert(perm[i] < col_size_);
+		const auto src = (*this)[perm[i]];
+		std::copy(src.begin(), src.end(), result[i].begin());
 	}
+	return result;
 }
 
 template <typename T>
-void Matrix<T>::fill_randi()
+typename Matrix<T>::LU Matrix<T>::compute_lu(Matrix<LU_T> A)
 {
-	const auto[min, max] = rand_limits_;
+	using VectorOperations::axpy;
+	using Operand = GemmKernels::Operand<LU_T>;
+
+	// Columns per panel. Panels are factored with row operations, the
+	// trailing matrix is then updated with a single GEMM per panel.
+	constexpr std::size_t block_size = 64;
+
+	const auto [rows, cols] = A.size();
+	const auto steps = std::min(rows, cols);
+	const auto ld = A.stride();
+	LU_T* a = A.data();
+
+	// Elimination of a rows x cols matrix takes about
+	// 2 * (rows * cols * steps - (rows + cols) * steps^2 / 2 + steps^3 / 3)
+	MATRIX_TRACE_SCOPE(lu, 2 * rows * cols * steps - (rows + cols) * steps * steps +
+		2 * steps * steps * steps / 3, 2 * rows * cols * sizeof(LU_T));
+
+	std::vector<std::size_t> perm(rows);
+	std::iota(perm.begin(), perm.end(), std::size_t(0));
+
+	// Largest magnitude for floating point, first nonzero for the exact
+	// types where magnitude does not matter
+	const auto select_pivot = [a, ld, rows = rows](const std::size_t k)
+	{
+		auto best = k;
+		if constexpr (std::is_floating_point_v<LU_T>)
+		{
+			for (auto i = k + 1; i < rows; ++i)
+			{
+				if (std::abs(a[i * ld + k]) > std::abs(a[best * ld + k]))
+				{
+					best = i;
+				}
+			}
+		}
+		else
+		{
+			while (best < rows && a[best * ld + k] == LU_T(0)) ++best;
+			if (best == rows) best = k;
+		}
+		return best;
+	};
+
+	for (std::size_t k0 = 0; k0 < steps; k0 += block_size)
+	{
+		const auto k_end = std::min(k0 + block_size, steps);
+
+		// Factor the panel of columns [k0, k_end)
+		{
+			MATRIX_TRACE_SCOPE(lu_panel, (rows - k0) * (k_end - k0) * (k_end - k0),
+				2 * (rows - k0) * (k_end - k0) * sizeof(LU_T));
+			for (auto k = k0; k < k_end; ++k)
+			{
+				const auto pivot_row = select_pivot(k);
+
+				// Singular column, there is nothing to eliminate
+				if (a[pivot_row * ld + k] == LU_T(0)) continue;
+
+				LU_T* row_k = a + k * ld;
+				if (pivot_row != k)
+				{
+					// Whole rows are swapped, which also applies the
+					// interchange to the columns of L computed so far
+					std::swap_ranges(row_k, row_k + cols, a + pivot_row * ld);
+					std::swap(perm[k], perm[pivot_row]);
+				}
+
+				const LU_T inv_pivot = LU_T(1) / row_k[k];
+				for (auto i = k + 1; i < rows; ++i)
+				{
+					LU_T* row_i = a + i * ld;
+					row_i[k] = row_i[k] * inv_pivot;
+					if (row_i[k] == LU_T(0)) continue;
+
+					// Only the rest of the panel is updated here
+					axpy(row_i + k + 1, LU_T(0) - row_i[k], row_k + k + 1,
+						k_end - k - 1);
+				}
+			}
+		}
+		if (k_end == cols) continue;
+
+		// U12 = L11^-1 * A12, L11 is unit lower
+		{
+			MATRIX_TRACE_SCOPE(lu_trsm, (k_end - k0) * (k_end - k0) * (cols - k_end),
+				((k_end - k0) * (k_end - k0) / 2 + 2 * (k_end - k0) * (cols - k_end)) *
+					sizeof(LU_T));
+			TriangularKernels::trsm_lower(k_end - k0, cols - k_end,
+				Operand{ a + k0 * ld + k0, ld, 1 }, true, a + k0 * ld + k_end, ld);
+		}
+
+		// Trailing update A22 -= L21 * U12
+		if (k_end < rows)
+		{
+			MATRIX_TRACE_SCOPE(lu_update, 2 * (rows - k_end) * (cols - k_end) * (k_end - k0),
+				((rows - k_end + cols - k_end) * (k_end - k0) +
+					2 * (rows - k_end) * (cols - k_end)) * sizeof(LU_T));
+			GemmKernels::gemm(rows - k_end, cols - k_end, k_end - k0,
+				LU_T(-1),
+				Operand{ a + k_end * ld + k0, ld, 1 },
+				Operand{ a + k0 * ld + k_end, ld, 1 },
+				LU_T(1), a + k_end * ld + k_end, ld);
+		}
+	}
 
-	static std::uniform_int_distribution<int> uid(min, max);
-	fill_random(uid);
+	// Split the multipliers below the diagonal into L
+	LU lu{ Matrix<LU_T>(rows, fill_type::identity, A.get_allocator()),
+		std::move(A),
+		std::move(perm) };
+	for (std::size_t i = 1; i < rows; ++i)
+	{
+		auto l_row = lu.L[i];
+		auto u_row = lu.U[i];
+		for (std::size_t j = 0; j < std::min(i, steps); ++j)
+		{
+			l_row[j] = u_row[j];
+			u_row[j] = LU_T(0);
+		}
+	}
+	return lu;
 }
 
 template <typename T>
-void Matrix<T>::fill_rand()
+template <typename W>
+Matrix<W> Matrix<T>::convert_to(std::pmr::memory_resource* resource) const
 {
-	const auto min = static_cast<float>(rand_limits_.min);
-	const auto max = static_cast<float>(rand_limits_.max);
+	Matrix<W> result(col_size_, row_size_, resource);
+	std::transform(data_.cbegin(), data_.cend(), result.data(),
+		[](const T& element)
+		{
+			return static_cast<W>(element);
+		});
+	return result;
+}
 
-	static std::uniform_real_distribution<float> uid(min, max);
-	fill_random(uid);
+template <typename T>
+template <typename W>
+typename Matrix<T>::template Bareiss<W> Matrix<T>::compute_bareiss(
+	std::pmr::memory_resource* resource) const
+{
+	Bareiss<W> result{ convert_to<W>(resource), {}, 0, W(0) };
+	const auto elim = bareiss_eliminate(result.R, row_size_, result.P);
+
+	result.rank = elim.rank;
+	if (col_size_ == row_size_ && elim.rank == col_size_)
+	{
+		result.determinant = elim.sign < 0 ?
+			exact_sub(W(0), elim.last_pivot) : elim.last_pivot;
+	}
+	return result;
 }
 
 template <typename T>
-LU_t<T>& Matrix<T>::compute_lu(LU& lu, const unsigned n) const
+template <typename W>
+typename Matrix<T>::template BareissSteps<W> Matrix<T>::bareiss_eliminate(
+	Matrix<W>& M, const std::size_t pivot_cols, std::vector<std::size_t>& perm)
 {
-	// Fetch the L and U
-	auto& [L, U] = lu;
+	const auto [rows, cols] = M.size();
+	const auto ld = M.stride();
+	W* m = M.data();
 
-	// End recursion
-	if (L.is_lower_triangular() && U.is_upper_triangular()) return lu;
+	perm.resize(rows);
+	std::iota(perm.begin(), perm.end(), std::size_t(0));
 
-	// Start Doolittle algorithm
-	Matrix<LU_T> l_n(col_size_, 1);
-	const auto pivot = U[n - 1][n - 1];
+	BareissSteps<W> steps{ 0, 1, W(1) };
 
-	// TODO: When pivot is zero (LU)
-	assert(pivot != 0);
+	// Previous pivot, the exact divisor of the next step
+	W prev(1);
 
-	LU_T factor;
-	if constexpr (std::is_floating_point<T>()) {
-		factor = static_cast<LU_T>(1) / pivot;
+	for (std::size_t c = 0; c < pivot_cols && steps.rank < rows; ++c)
+	{
+		const auto r = steps.rank;
+
+		// Any nonzero pivot keeps the arithmetic exact
+		auto p = r;
+		while (p < rows && m[p * ld + c] == W(0)) ++p;
+		if (p == rows) continue;
+
+		if (p != r)
+		{
+			std::swap_ranges(m + r * ld, m + (r + 1) * ld, m + p * ld);
+			std::swap(perm[r], perm[p]);
+			steps.sign = -steps.sign;
+		}
+
+		const W* row_r = m + r * ld;
+		const W pivot = row_r[c];
+		for (auto i = r + 1; i < rows; ++i)
+		{
+			W* row_i = m + i * ld;
+			const W factor = row_i[c];
+			for (auto j = c + 1; j < cols; ++j)
+			{
+				// The division is exact (Sylvester's identity)
+				row_i[j] = exact_div(exact_sub(exact_mul(pivot, row_i[j]),
+					exact_mul(factor, row_r[j])), prev);
+			}
+			row_i[c] = W(0);
+		}
+		prev = pivot;
+		steps.last_pivot = pivot;
+		++steps.rank;
 	}
-	else {
-		factor = Fraction(1, pivot);
+	return steps;
+}
+
+template <typename T>
+template <typename U>
+std::enable_if_t<!std::is_integral_v<U>, typename Matrix<T>::LU_T>
+Matrix<T>::determinant() const
+{
+	assert(col_size_ == row_size_);
+
+	// The factorization is only a temporary
+	auto lu_fact = compute_lu(
+		convert_to<LU_T>(MatrixScratch::resource()));
+
+	// Sign of the permutation from its cycle decomposition
+	auto& P = lu_fact.P;
+	bool negative = false;
+	for (std::size_t i = 0; i < P.size(); ++i)
+	{
+		while (P[i] != i)
+		{
+			std::swap(P[i], P[P[i]]);
+			negative = !negative;
+		}
 	}
-		
-	// Fetch the elements to the vector l_n (Doolittle's)
-	const auto col = n - 1;
-	for (auto i = n; i < col_size_; ++i)
+
+	LU_T result(negative ? -1 : 1);
+	for (std::size_t i = 0; i < col_size_; ++i)
 	{
-		l_n[i][0] = U[i][col];
+		result = result * lu_fact.U[i][i];
 	}
-	factor* l_n;
+	return result;
+}
 
-	// Construct a transposed natural base vector e_n
-	Matrix<LU_T> e_nt(1, col_size_);
-	e_nt[0][n - 1] = 1;
+template <typename T>
+template <typename W, typename U>
+std::enable_if_t<std::is_integral_v<U>, typename Matrix<T>::template ExactSolution<W>>
+Matrix<T>::solve_exact(const Matrix& B) const
+{
+	// Square and non-singular systems only
+	assert(col_size_ == row_size_);
+	assert(B.col_size_ == col_size_);
 
-	const Matrix<LU_T> identity(col_size_, fill_type::identity);
-	auto L_n_term = l_n * e_nt;
+	const auto n = col_size_;
+	const auto k = B.row_size_;
 
-	// Calculate the L_n matrix
-	auto L_n = identity - L_n_term;
+	// Eliminate the augmented Matrix [A | B]
+	Matrix<W> M(n, n + k, MatrixScratch::resource());
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		std::transform(data_.cbegin() + i * stride_,
+			data_.cbegin() + i * stride_ + n, M[i].begin(),
+			[](const T& element) { return static_cast<W>(element); });
+		std::transform(B.data_.cbegin() + i * B.stride_,
+			B.data_.cbegin() + i * B.stride_ + k, M[i].begin() + n,
+			[](const T& element) { return static_cast<W>(element); });
+	}
+	std::vector<std::size_t> perm;
+	const auto elim = bareiss_eliminate(M, n, perm);
+	assert(elim.rank == n);
+
+	// det(P * A). Fraction-free back substitution gives the numerators
+	// of X over it, all divisions are exact (Cramer's rule).
+	const W det = elim.last_pivot;
+	ExactSolution<W> result{ Matrix<W>(n, k), det };
+	for (std::size_t col = 0; col < k; ++col)
+	{
+		for (auto i = n; i-- > 0;)
+		{
+			W sum = exact_mul(det, M[i][n + col]);
+			for (auto j = i + 1; j < n; ++j)
+			{
+				sum = exact_sub(sum, exact_mul(M[i][j], result.X[j][col]));
+			}
+			result.X[i][col] = exact_div(sum, M[i][i]);
+		}
+	}
 
-	// Update U and L matrices
-	U = (L_n *= U);
-	L += L_n_term;
+	// Keep the denominator positive
+	if (det < W(0))
+	{
+		result.denominator = exact_sub(W(0), det);
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			for (auto& element : result.X[i])
+			{
+				element = exact_sub(W(0), element);
+			}
+		}
+	}
+	return result;
+}
 
-	return compute_lu(lu, n + 1);
+template <typename T>
+template <typename W>
+W Matrix<T>::exact_mul(const W& lhs, const W& rhs)
+{
+	if constexpr (std::is_integral_v<W>)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		W result;
+		if (__builtin_mul_overflow(lhs, rhs, &result))
+		{
+			throw std::overflow_error("Matrix: integer overflow in product");
+		}
+		return result;
+#else
+		using limits = std::numeric_limits<W>;
+		bool overflow = false;
+		if (lhs != 0 && rhs != 0)
+		{
+			if constexpr (std::is_signed_v<W>)
+			{
+				overflow = lhs > 0 ?
+					(rhs > 0 ? lhs > limits::max() / rhs
+						: rhs < limits::min() / lhs) :
+					(rhs > 0 ? lhs < limits::min() / rhs
+						: rhs < limits::max() / lhs);
+			}
+			else
+			{
+				overflow = lhs > limits::max() / rhs;
+			}
+		}
+		if (overflow)
+		{
+			throw std::overflow_error("Matrix: integer overflow in product");
+		}
+		return lhs * rhs;
+#endif
+	}
+	else
+	{
+		return lhs * rhs;
+	}
 }
 
+template <typename T>
+template <typename W>
+W Matrix<T>::exact_sub(const W& lhs, const W& rhs)
+{
+	if constexpr (std::is_integral_v<W>)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		W result;
+		if (__builtin_sub_overflow(lhs, rhs, &result))
+		{
+			throw std::overflow_error("Matrix: integer overflow in difference");
+		}
+		return result;
+#else
+		using limits = std::numeric_limits<W>;
+		bool overflow;
+		if constexpr (std::is_signed_v<W>)
+		{
+			overflow = rhs < 0 ? lhs > limits::max() + rhs
+				: lhs < limits::min() + rhs;
+		}
+		else
+		{
+			overflow = lhs < rhs;
+		}
+		if (overflow)
+		{
+			throw std::overflow_error("Matrix: integer overflow in difference");
+		}
+		return lhs - rhs;
+#endif
+	}
+	else
+	{
+		return lhs - rhs;
+	}
+}
 
+template <typename T>
+template <typename W>
+W Matrix<T>::exact_div(const W& lhs, const W& rhs)
+{
+	// min / -1 is the only quotient out of range
+	if constexpr (std::is_integral_v<W> && std::is_signed_v<W>)
+	{
+		if (rhs == W(-1) && lhs == std::numeric_limits<W>::min())
+		{
+			throw std::overflow_error("Matrix: integer overflow in quotient");
+		}
+	}
+	return lhs / rhs;
+}
@@ -0,0 +1,441 @@
+#pragma once
+
+// Binary matrix files and zero-copy loading through memory mapping
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "matrix.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+* File layout, all fields in the byte order of the writing machine:
+*
+*   Header             64 bytes
+*   zero padding       up to data_offset, a multiple of alignment
+*   elements           rows x cols, row i starts at element i * stride
+*
+* Readers reject files of another version, element type or byte order.
+* Unlike the rest of the library, which asserts on misuse, the file
+* functions throw: a missing or malformed file is not a programming error.
+* std::system_error reports failures of the operating system,
+* std::runtime_error files that are not valid matrix files.
+*/
+namespace MatrixFile
+{
+	inline constexpr char magic[8] = { 'M', 'A', 'T', 'R', 'I', 'X', 'B', '\0' };
+	inline constexpr std::uint32_t version = 1;
+
+	// Written as a number, reads back differently on the other byte order
+	inline constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+	// Default alignment of the elements, a cache line
+	inline constexpr std::uint32_t default_alignment = 64;
+
+	enum class element_type : std::uint32_t
+	{
+		int8 = 1, uint8, int16, uint16, int32, uint32, int64, uint64,
+		float32, float64
+	};
+
+	// Tag of an arithmetic type. Class types like Fraction have no binary
+	// representation and do not compile.
+	template<typename T>
+	constexpr element_type element_tag()
+	{
+		static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool> &&
+			sizeof(T) <= 8 && (std::is_integral_v<T> || sizeof(T) >= 4),
+			"only integral types and float / double can be stored");
+
+		if constexpr (std::is_floating_point_v<T>)
+		{
+			static_assert(sizeof(T) == 4 || sizeof(T) == 8,
+				"long double can't be stored");
+			return sizeof(T) == 4 ? element_type::float32 : element_type::float64;
+		}
+		else
+		{
+			// Signed and unsigned alternate from int8 on
+			std::uint32_t tag = 1;
+			for (std::size_t size = 1; size < sizeof(T); size *= 2) tag += 2;
+			return static_cast<element_type>(
+				std::is_signed_v<T> ? tag : tag + 1);
+		}
+	}
+
+	struct Header
+	{
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t byte_order;
+		element_type type;
+		std::uint32_t element_size;
+		std::uint64_t rows;
+		std::uint64_t cols;
+
+		// Row stride in elements, at least cols
+		std::uint64_t stride;
+
+		// Byte offset of the first element, a multiple of alignment
+		std::uint64_t data_offset;
+		std::uint32_t alignment;
+		std::uint32_t reserved;
+	};
+	static_assert(sizeof(Header) == 64 && std::is_trivially_copyable_v<Header>);
+
+	// Header of a dense rows x cols file of Ts
+	template<typename T>
+	[[nodiscard]] Header make_header(const std::size_t rows, const std::size_t cols,
+		const std::uint32_t alignment = default_alignment)
+	{
+		assert(alignment >= alignof(T) && (alignment & (alignment - 1)) == 0);
+
+		Header header{};
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.version = version;
+		header.byte_order = byte_order_mark;
+		header.type = element_tag<T>();
+		header.element_size = sizeof(T);
+		header.rows = rows;
+		header.cols = cols;
+		header.stride = cols;
+		header.data_offset = (sizeof(Header) + alignment - 1) / alignment * alignment;
+		header.alignment = alignment;
+		return header;
+	}
+
+	/**
+	 * \brief Writes the rows of matrix to a new file at path
+	 * \param alignment byte alignment of the first element, a power of two
+	 *        of at least alignof(T). Mapped files keep it in memory.
+	 */
+	template<typename V>
+	void save(const std::string& path, const MatrixView<V> matrix,
+		const std::uint32_t alignment = default_alignment)
+	{
+		using T = std::remove_const_t<V>;
+
+		const auto [rows, cols] = matrix.size();
+		const auto header = make_header<T>(rows, cols, alignment);
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			throw std::system_error(errno, std::generic_category(),
+				"can't create " + path);
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		const std::string padding(header.data_offset - sizeof(header), '\0');
+		file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+
+		// Views may be strided, the file is always dense
+		std::vector<T> row(cols);
+		for (std::size_t i = 0; i < rows && file; ++i)
+		{
+			matrix.eval_row(i, row.data());
+			file.write(reinterpret_cast<const char*>(row.data()),
+				static_cast<std::streamsize>(cols * sizeof(T)));
+		}
+		if (!file.flush())
+		{
+			throw std::system_error(errno, std::generic_category(),
+				"can't write " + path);
+		}
+	}
+
+	// Creates a file for a rows x cols zero matrix without writing the
+	// elements, most file systems keep the file sparse until it is filled
+	template<typename T>
+	void create(const std::string& path, const std::size_t rows,
+		const std::size_t cols, const std::uint32_t alignment = default_alignment)
+	{
+		const auto header = make_header<T>(rows, cols, alignment);
+		{
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			if (!file.write(reinterpret_cast<const char*>(&header), sizeof(header)))
+			{
+				throw std::system_error(errno, std::generic_category(),
+					"can't create " + path);
+			}
+		}
+		std::filesystem::resize_file(path, header.data_offset + rows * cols * sizeof(T));
+	}
+
+	template<typename T>
+	void save(const std::string& path, const Matrix<T>& matrix,
+		const std::uint32_t alignment = default_alignment)
+	{
+		save(path, matrix.view(), alignment);
+	}
+
+	// Reads and checks the header of a file of size bytes at data
+	template<typename T>
+	Header read_header(const std::byte* data, const std::size_t size,
+		const std::string& path)
+	{
+		const auto invalid = [&path](const char* what)
+		{
+			return std::runtime_error(path + ": " + what);
+		};
+
+		Header header;
+		if (size < sizeof(Header)) throw invalid("not a matrix file");
+		std::memcpy(&header, data, sizeof(header));
+
+		if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+		{
+			throw invalid("not a matrix file");
+		}
+		if (header.version != version) throw invalid("unsupported version");
+		if (header.byte_order != byte_order_mark) throw invalid("wrong byte order");
+		if (header.type != element_tag<T>() || header.element_size != sizeof(T))
+		{
+			throw invalid("wrong element type");
+		}
+		if (header.alignment < alignof(T) ||
+			(header.alignment & (header.alignment - 1)) != 0 ||
+			header.data_offset < sizeof(Header) ||
+			header.data_offset % header.alignment != 0 ||
+			header.stride < header.cols)
+		{
+			throw invalid("bad layout");
+		}
+
+		// Overflow-safe check that the last row ends inside the file
+		if (header.data_offset > size) throw invalid("truncated");
+		const auto available = (size - header.data_offset) / sizeof(T);
+		if (header.rows > 0 && header.cols > 0 && (header.cols > available ||
+			(header.rows - 1) > (available - header.cols) / header.stride))
+		{
+			throw invalid("truncated");
+		}
+		return header;
+	}
+}
+
+/*
+* Read-only matrix backed by a memory-mapped file. Loading maps the file
+* and checks the header, the elements are paged in by the operating system
+* on first access, so opening costs the same for any size. Use it through
+* view(), which works wherever a MatrixView<const T> does: expressions,
+* products, gemm, the triangular solves and LU::solve.
+* The mapping is released with the object, views must not outlive it.
+*/
+template<typename T>
+class MappedMatrix
+{
+public:
+	// Maps the file at path, throws if it is not a valid file of Ts
+	explicit MappedMatrix(const std::string& path);
+
+	~MappedMatrix()
+	{
+		unmap();
+	}
+
+	MappedMatrix(const MappedMatrix&) = delete;
+	MappedMatrix& operator=(const MappedMatrix&) = delete;
+
+	MappedMatrix(MappedMatrix&& other) noexcept :
+		base_(std::exchange(other.base_, nullptr)),
+		length_(std::exchange(other.length_, 0)),
+		header_(other.header_)
+	{}
+
+	MappedMatrix& operator=(MappedMatrix&& other) noexcept
+	{
+		if (this != &other)
+		{
+			unmap();
+			base_ = std::exchange(other.base_, nullptr);
+			length_ = std::exchange(other.length_, 0);
+			header_ = other.header_;
+		}
+		return *this;
+	}
+
+	[[nodiscard]] MatrixView<const T> view() const noexcept
+	{
+		return { data(), size().first, size().second, stride() };
+	}
+
+	operator MatrixView<const T>() const noexcept
+	{
+		return view();
+	}
+
+	[[nodiscard]] const T* data() const noexcept
+	{
+		return reinterpret_cast<const T*>(
+			static_cast<const std::byte*>(base_) + header_.data_offset);
+	}
+
+	[[nodiscard]] std::pair<std::size_t, std::size_t> size() const noexcept
+	{
+		return { static_cast<std::size_t>(header_.rows),
+			static_cast<std::size_t>(header_.cols) };
+	}
+
+	[[nodiscard]] std::size_t stride() const noexcept
+	{
+		return static_cast<std::size_t>(header_.stride);
+	}
+
+	[[nodiscard]] const MatrixFile::Header& header() const noexcept
+	{
+		return header_;
+	}
+
+private:
+	const void* base_{ nullptr };
+	std::size_t length_{ 0 };
+	MatrixFile::Header header_{};
+
+	void unmap() noexcept;
+};
+
+#if defined(_WIN32)
+
+template<typename T>
+MappedMatrix<T>::MappedMatrix(const std::string& path)
+{
+	const auto fail = [&path](const char* what)
+	{
+		return std::system_error(static_cast<int>(GetLastError()),
+			std::system_category(), what + path);
+	};
+
+	const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw fail("can't open ");
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		const auto error = fail("can't stat ");
+		CloseHandle(file);
+		throw error;
+	}
+	length_ = static_cast<std::size_t>(size.QuadPart);
+
+	// The mapping object keeps the file open
+	const HANDLE mapping = length_ == 0 ? nullptr :
+		CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping != nullptr)
+	{
+		base_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+	if (base_ == nullptr && length_ != 0) throw fail("can't map ");
+
+	try
+	{
+		header_ = MatrixFile::read_header<T>(
+			static_cast<const std::byte*>(base_), length_, path);
+	}
+	catch (...)
+	{
+		unmap();
+		throw;
+	}
+}
+
+template<typename T>
+void MappedMatrix<T>::unmap() noexcept
+{
+	if (base_ != nullptr) UnmapViewOfFile(base_);
+	base_ = nullptr;
+}
+
+#else
+
+template<typename T>
+MappedMatrix<T>::MappedMatrix(const std::string& path)
+{
+	const auto fail = [&path](const char* what)
+	{
+		return std::system_error(errno, std::generic_category(), what + path);
+	};
+
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) throw fail("can't open ");
+
+	struct stat info;
+	if (::fstat(fd, &info) != 0)
+	{
+		const auto error = fail("can't stat ");
+		::close(fd);
+		throw error;
+	}
+	length_ = static_cast<std::size_t>(info.st_size);
+
+	// The mapping keeps the file open
+	void* base = length_ == 0 ? nullptr :
+		::mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+	const auto error = fail("can't map ");
+	::close(fd);
+	if (base == MAP_FAILED) throw error;
+	base_ = base;
+
+	try
+	{
+		header_ = MatrixFile::read_header<T>(
+			static_cast<const std::byte*>(base_), length_, path);
+	}
+	catch (...)
+	{
+		unmap();
+		throw;
+	}
+}
+
+template<typename T>
+void MappedMatrix<T>::unmap() noexcept
+{
+	if (base_ != nullptr) ::munmap(const_cast<void*>(base_), length_);
+	base_ = nullptr;
+}
+
+#endif
+
+namespace MatrixFile
+{
+	// Maps the file, see MappedMatrix
+	template<typename T>
+	[[nodiscard]] MappedMatrix<T> map(const std::string& path)
+	{
+		return MappedMatrix<T>(path);
+	}
+
+	// Reads the file into a Matrix that owns its elements
+	template<typename T>
+	[[nodiscard]] Matrix<T> load(const std::string& path,
+		const typename Matrix<T>::allocator_type& alloc = {})
+	{
+		const MappedMatrix<T> mapped(path);
+		return Matrix<T>(mapped.view(), alloc);
+	}
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+// Quantized products: int8 and int16 matrices with int32 results
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include "matrix.h"
+#include "QuantizedKernels.h"
+
+/*
+* operator* of Matrix<std::int8_t> and Matrix<std::int16_t> sums in the
+* element type and overflows almost at once. multiply() sums in int32 with
+* the kernels of QuantizedKernels.h (VNNI, AVX-512, AVX2 or SSE2 where
+* available) and returns the exact Matrix<std::int32_t> product, as long
+* as it fits: the sums wrap modulo 2^32 otherwise. For int8 that takes an
+* inner dimension beyond 2^17.
+*
+* The int32 results can then be requantized, e.g. back to int8, with a
+* scale and zero point for the whole matrix, per row or per column.
+*/
+namespace MatrixQuantized
+{
+	// Elements that share a scale and zero point
+	enum class axis { tensor, row, column };
+
+	/*
+	* Maps the result x in row i, column j to round(x * scale) + zero_point,
+	* saturated to the output type. Rounding is half away from zero. With
+	* axis::row the scale and zero point of x are scales[i] and
+	* zero_points[i], with axis::column those at j, with axis::tensor the
+	* first ones. No zero points means zero.
+	*/
+	struct Requantization
+	{
+		axis per = axis::tensor;
+		std::vector<float> scales{ 1.0f };
+		std::vector<std::int32_t> zero_points;
+	};
+
+	// A * B with int32 sums, A and B are both int8 or both int16
+	template<typename V, typename W>
+	[[nodiscard]] Matrix<std::int32_t> multiply(const MatrixView<V> A, const MatrixView<W> B,
+		const typename Matrix<std::int32_t>::allocator_type& alloc = {})
+	{
+		using T = std::remove_const_t<V>;
+		static_assert(std::is_same_v<T, std::remove_const_t<W>>, "operands of the same type");
+
+		const auto [m, k] = A.size();
+		const auto n = B.size().second;
+		assert(B.size().first == k);
+
+		MATRIX_TRACE_SCOPE(multiply, 2 * m * n * k, (m * k + k * n) * sizeof(T) +
+			m * n * sizeof(std::int32_t));
+
+		Matrix<std::int32_t> result(m, n, alloc);
+		QuantizedKernels::gemm(m, n, k,
+			GemmKernels::Operand<T>{ A.data(), A.row_stride(), A.col_stride() },
+			GemmKernels::Operand<T>{ B.data(), B.row_stride(), B.col_stride() },
+			result.data(), result.stride());
+		return result;
+	}
+
+	template<typename T>
+	[[nodiscard]] Matrix<std::int32_t> multiply(const Matrix<T>& A, const Matrix<T>& B,
+		const typename Matrix<std::int32_t>::allocator_type& alloc = {})
+	{
+		return multiply(A.view(), B.view(), alloc);
+	}
+
+	// out = requantized values of products, see Requantization
+	template<typename V, typename U>
+	void requantize(const MatrixView<V> products,
+		const Requantization& requantization, const MatrixView<U> out)
+	{
+		static_assert(std::is_same_v<std::remove_const_t<V>, std::int32_t>, "int32 products");
+		// The limits of wider types aren't exact doubles, clamping to them
+		// wouldn't keep the conversion in range
+		static_assert(std::is_integral_v<U> && sizeof(U) <= 4,
+			"requantization into integers of up to 32 bits");
+
+		const auto [rows, cols] = products.size();
+		const auto& r = requantization;
+		assert(out.size() == products.size());
+		assert(r.scales.size() == (r.per == axis::row ? rows :
+			r.per == axis::column ? cols : 1));
+		assert(r.zero_points.empty() || r.zero_points.size() == r.scales.size());
+
+		constexpr auto low = static_cast<double>(std::numeric_limits<U>::min());
+		constexpr auto high = static_cast<double>(std::numeric_limits<U>::max());
+		VectorOperations::for_ranges(rows, cols, [&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				for (std::size_t j = 0; j < cols; ++j)
+				{
+					const auto s = r.per == axis::row ? i : r.per == axis::column ? j : 0;
+					const auto zero_point = r.zero_points.empty() ? 0.0 :
+						static_cast<double>(r.zero_points[s]);
+					const auto value = std::round(static_cast<double>(products(i, j)) *
+						static_cast<double>(r.scales[s])) + zero_point;
+					out(i, j) = static_cast<U>(std::clamp(value, low, high));
+				}
+			}
+		});
+	}
+
+	template<typename U>
+	void requantize(const Matrix<std::int32_t>& products,
+		const Requantization& requantization, Matrix<U>& out)
+	{
+		requantize(products.view(), requantization, out.view());
+	}
+
+	// out = requantized A * B, the int32 products are temporaries
+	template<typename V, typename W, typename U>
+	void multiply(const MatrixView<V> A, const MatrixView<W> B,
+		const Requantization& requantization, const MatrixView<U> out)
+	{
+		const auto products = multiply(A, B, MatrixScratch::resource());
+		requantize(products.view(), requantization, out);
+	}
+
+	template<typename T, typename U>
+	void multiply(const Matrix<T>& A, const Matrix<T>& B,
+		const Requantization& requantization, Matrix<U>& out)
+	{
+		multiply(A.view(), B.view(), requantization, out.view());
+	}
+}
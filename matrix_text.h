@@ -0,0 +1,104 @@
+#pragma once
+
+// Reading and writing matrices as text: CSV and whitespace-separated
+
+#include <cerrno>
+#include <cstddef>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include "matrix.h"
+
+/*
+* Elements are formatted with std::to_chars and parsed with
+* std::from_chars, so the text does not depend on the locale. Like the
+* functions of matrix_file.h, the parsers throw: std::system_error when a
+* file can't be read or written, std::runtime_error for invalid text, with
+* the line number in the message.
+*/
+namespace MatrixText
+{
+	using TextKernels::Format;
+	using TextKernels::csv;
+
+	// Writes the rows of matrix, by default in the layout of operator<<
+	template<typename V>
+	void write(std::ostream& os, const MatrixView<V> matrix, const Format& format = {})
+	{
+		const auto [rows, cols] = matrix.size();
+		TextKernels::write(os, matrix.data(), rows, cols,
+			matrix.row_stride(), matrix.col_stride(), format);
+	}
+
+	template<typename T>
+	void write(std::ostream& os, const Matrix<T>& matrix, const Format& format = {})
+	{
+		write(os, matrix.view(), format);
+	}
+
+	/**
+	 * \brief Matrix of the rows of text, one per line
+	 * \param delimiter ' ' separates the elements by any run of spaces and
+	 *        tabs, other characters like ',' by themselves. Blanks around
+	 *        the elements and empty lines are skipped.
+	 * \param source name of the text in error messages
+	 *
+	 * Large texts are split into chunks of whole lines that are counted and
+	 * then parsed in parallel. All rows must have the same length.
+	 */
+	template<typename T>
+	[[nodiscard]] Matrix<T> parse(const std::string_view text, const char delimiter = ' ',
+		const typename Matrix<T>::allocator_type& alloc = {},
+		const std::string& source = "text")
+	{
+		auto scan = TextKernels::scan(text, delimiter);
+		Matrix<T> result(scan.rows, scan.cols, alloc);
+		TextKernels::parse(text, delimiter, scan, result.data(), result.stride(), source);
+		return result;
+	}
+
+	// Parses the file at path, see parse()
+	template<typename T>
+	[[nodiscard]] Matrix<T> load(const std::string& path, const char delimiter = ',',
+		const typename Matrix<T>::allocator_type& alloc = {})
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			throw std::system_error(errno, std::generic_category(), "can't open " + path);
+		}
+		std::string text(static_cast<std::size_t>(file.tellg()), '\0');
+		file.seekg(0);
+		if (!file.read(text.data(), static_cast<std::streamsize>(text.size())))
+		{
+			throw std::system_error(errno, std::generic_category(), "can't read " + path);
+		}
+		return parse<T>(text, delimiter, alloc, path);
+	}
+
+	// Writes matrix to a new file at path, by default as CSV that reads back
+	// exactly
+	template<typename V>
+	void save(const std::string& path, const MatrixView<V> matrix, const Format& format = csv)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			throw std::system_error(errno, std::generic_category(), "can't create " + path);
+		}
+		write(file, matrix, format);
+		if (!file.flush())
+		{
+			throw std::system_error(errno, std::generic_category(), "can't write " + path);
+		}
+	}
+
+	template<typename T>
+	void save(const std::string& path, const Matrix<T>& matrix, const Format& format = csv)
+	{
+		save(path, matrix.view(), format);
+	}
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+// Products of matrices stored in files that don't fit into memory
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "matrix_file.h"
+
+namespace OutOfCore
+{
+	// Default memory budget of multiply(), 256 MiB
+	inline constexpr std::size_t default_budget = std::size_t(256) << 20;
+
+	// Tile sizes of a product, C tiles are rows x cols, the inner dimension
+	// is walked in steps of depth
+	struct Tiling
+	{
+		std::size_t rows;
+		std::size_t cols;
+		std::size_t depth;
+	};
+
+	/*
+	* Tiles whose buffers fit into budget bytes. The product holds two A
+	* tiles, two B tiles and two C tiles at a time: one of each is in use
+	* while the other is loaded or written. The tiles start out square,
+	* dimensions smaller than the side leave their share of the budget to
+	* the others.
+	*/
+	template<typename T>
+	[[nodiscard]] Tiling tiling(const std::size_t m, const std::size_t n,
+		const std::size_t k, const std::size_t budget = default_budget)
+	{
+		const auto elements = budget / sizeof(T) / 2;
+		auto side = static_cast<std::size_t>(std::sqrt(static_cast<double>(elements) / 3));
+		side = std::max<std::size_t>(side, 1);
+
+		// Zero dimensions still get tiles of one
+		const auto clamp = [](const std::size_t size, const std::size_t limit)
+		{
+			return std::max<std::size_t>(std::min(size, limit), 1);
+		};
+		Tiling result{ clamp(side, m), clamp(side, n), clamp(side, k) };
+
+		// 2 * (rows * depth + depth * cols + rows * cols) <= 2 * elements,
+		// grow the inner dimension first, it saves whole passes over C
+		const auto grow = [elements, clamp](const std::size_t fixed, const std::size_t a,
+			const std::size_t b, const std::size_t limit)
+		{
+			// fixed + x * (a + b) <= elements
+			if (fixed >= elements) return std::size_t(1);
+			return clamp((elements - fixed) / (a + b), limit);
+		};
+		result.depth = grow(result.rows * result.cols, result.rows, result.cols, k);
+		result.cols = grow(result.rows * result.depth, result.rows, result.depth, n);
+		result.rows = grow(result.cols * result.depth, result.cols, result.depth, m);
+		return result;
+	}
+}
+
+namespace OutOfCoreDetail
+{
+	// Matrix file read and written a tile at a time
+	template<typename T>
+	class TileFile
+	{
+	public:
+		TileFile(const std::string& path, const std::ios::openmode mode) :
+			path_(path),
+			file_(path, mode | std::ios::binary)
+		{
+			if (!file_)
+			{
+				throw std::system_error(errno, std::generic_category(),
+					"can't open " + path);
+			}
+
+			std::byte bytes[sizeof(MatrixFile::Header)]{};
+			file_.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+			file_.clear();
+			header_ = MatrixFile::read_header<T>(bytes,
+				static_cast<std::size_t>(std::filesystem::file_size(path)), path);
+		}
+
+		[[nodiscard]] std::size_t rows() const { return header_.rows; }
+		[[nodiscard]] std::size_t cols() const { return header_.cols; }
+
+		// Reads the rows x cols block at (i0, j0) into dst with row stride ld
+		void read(const std::size_t i0, const std::size_t j0,
+			const std::size_t rows, const std::size_t cols, T* dst, const std::size_t ld)
+		{
+			for (std::size_t i = 0; i < rows; ++i)
+			{
+				file_.seekg(static_cast<std::streamoff>(offset(i0 + i, j0)));
+				file_.read(reinterpret_cast<char*>(dst + i * ld),
+					static_cast<std::streamsize>(cols * sizeof(T)));
+			}
+			check("can't read ");
+		}
+
+		// Writes the rows x cols block at src with row stride ld to (i0, j0)
+		void write(const std::size_t i0, const std::size_t j0,
+			const std::size_t rows, const std::size_t cols, const T* src, const std::size_t ld)
+		{
+			for (std::size_t i = 0; i < rows; ++i)
+			{
+				file_.seekp(static_cast<std::streamoff>(offset(i0 + i, j0)));
+				file_.write(reinterpret_cast<const char*>(src + i * ld),
+					static_cast<std::streamsize>(cols * sizeof(T)));
+			}
+			file_.flush();
+			check("can't write ");
+		}
+
+	private:
+		std::string path_;
+		std::fstream file_;
+		MatrixFile::Header header_;
+
+		[[nodiscard]] std::size_t offset(const std::size_t i, const std::size_t j) const
+		{
+			return header_.data_offset + (i * header_.stride + j) * sizeof(T);
+		}
+
+		void check(const char* what) const
+		{
+			if (!file_)
+			{
+				throw std::system_error(errno, std::generic_category(), what + path_);
+			}
+		}
+	};
+}
+
+namespace OutOfCore
+{
+	/**
+	 * \brief C = A * B for matrix files, see matrix_file.h
+	 * \param budget bytes of tile buffers, the only memory that grows with
+	 *        the operands. See tiling().
+	 *
+	 * C is created or overwritten. Each C tile is accumulated over the
+	 * inner dimension with gemm, which uses the thread pool. Meanwhile a
+	 * second thread reads the next A and B tiles and a third writes the
+	 * previous C tile, so the disk and the cores are busy at the same time.
+	 * Throws like the functions of matrix_file.h, and std::runtime_error if
+	 * the inner dimensions differ.
+	 */
+	template<typename T>
+	void multiply(const std::string& a_path, const std::string& b_path,
+		const std::string& c_path, const std::size_t budget = default_budget)
+	{
+		using OutOfCoreDetail::TileFile;
+
+		TileFile<T> A(a_path, std::ios::in);
+		TileFile<T> B(b_path, std::ios::in);
+		if (A.cols() != B.rows())
+		{
+			throw std::runtime_error(a_path + ", " + b_path + ": inner dimensions differ");
+		}
+
+		const auto m = A.rows();
+		const auto n = B.cols();
+		const auto k = A.cols();
+		MatrixFile::create<T>(c_path, m, n);
+		TileFile<T> C(c_path, std::ios::in | std::ios::out);
+
+		const auto tiles = tiling<T>(m, n, k, budget);
+		const auto tm = tiles.rows;
+		const auto tn = tiles.cols;
+		const auto tk = tiles.depth;
+		const auto tiles_m = (m + tm - 1) / tm;
+		const auto tiles_n = (n + tn - 1) / tn;
+		const auto tiles_k = (k + tk - 1) / tk;
+		const auto steps = tiles_m * tiles_n * tiles_k;
+
+		// Step s multiplies the A and B tiles of inner block s % tiles_k into
+		// C tile s / tiles_k, the C tiles go row by row
+		struct Step
+		{
+			std::size_t i0, j0, p0, rows, cols, depth;
+		};
+		const auto step = [=](const std::size_t s)
+		{
+			const auto tile = s / tiles_k;
+			Step result;
+			result.i0 = tile / tiles_n * tm;
+			result.j0 = tile % tiles_n * tn;
+			result.p0 = s % tiles_k * tk;
+			result.rows = std::min(tm, m - result.i0);
+			result.cols = std::min(tn, n - result.j0);
+			result.depth = std::min(tk, k - result.p0);
+			return result;
+		};
+
+		// A tiles are rows x depth, B tiles depth x cols, all dense
+		std::vector<T> a_tiles[2] = { std::vector<T>(tm * tk), std::vector<T>(tm * tk) };
+		std::vector<T> b_tiles[2] = { std::vector<T>(tk * tn), std::vector<T>(tk * tn) };
+		std::vector<T> c_tiles[2] = { std::vector<T>(tm * tn), std::vector<T>(tm * tn) };
+
+		const auto load = [&](const std::size_t s)
+		{
+			const auto st = step(s);
+			A.read(st.i0, st.p0, st.rows, st.depth, a_tiles[s % 2].data(), st.depth);
+			B.read(st.p0, st.j0, st.depth, st.cols, b_tiles[s % 2].data(), st.cols);
+		};
+
+		// Only one read and one write are in flight at a time, so the
+		// streams are never used by two threads at once
+		std::future<void> loading;
+		std::future<void> writing;
+		if (steps > 0) loading = std::async(std::launch::async, load, 0);
+
+		for (std::size_t s = 0; s < steps; ++s)
+		{
+			loading.get();
+			if (s + 1 < steps) loading = std::async(std::launch::async, load, s + 1);
+
+			const auto st = step(s);
+			const auto tile = s / tiles_k;
+			auto& c = c_tiles[tile % 2];
+
+			// The write of the tile before the previous one used this buffer,
+			// it was waited for when the previous tile was written
+			gemm<T>(T(1),
+				MatrixView<const T>(a_tiles[s % 2].data(), st.rows, st.depth, st.depth),
+				op_type::none,
+				MatrixView<const T>(b_tiles[s % 2].data(), st.depth, st.cols, st.cols),
+				op_type::none,
+				st.p0 == 0 ? T(0) : T(1),
+				MatrixView<T>(c.data(), st.rows, st.cols, st.cols));
+
+			if (s % tiles_k == tiles_k - 1)
+			{
+				if (writing.valid()) writing.get();
+				writing = std::async(std::launch::async, [&C, st, &c]
+				{
+					C.write(st.i0, st.j0, st.rows, st.cols, c.data(), st.cols);
+				});
+			}
+		}
+		if (writing.valid()) writing.get();
+	}
+}
@@ -11,9 +11,14 @@
 // add headers that you want to pre-compile here
 #include "framework.h"
 #include <vector>
+#include <memory_resource>
 #include <utility>
+#include <tuple>
+#include <numeric>
+#include <cmath>
 #include <cassert>
 #include <ostream>
+#include <iomanip>
 #include <random>
 #include "Fraction.h"
 
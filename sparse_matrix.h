@@ -0,0 +1,528 @@
+#pragma once
+
+// Compressed sparse matrices for inputs that are mostly zeros
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <numeric>
+#include <ostream>
+#include <vector>
+#include "matrix.h"
+
+/*
+* rows x cols matrix that stores only its nonzero elements, in compressed
+* sparse row (CSR) form: the nonzeros of row i are
+* values()[k] at column col_indices()[k] for k in
+* [row_offsets()[i], row_offsets()[i + 1]).
+* The columns of a row are sorted and no zeros are stored, so memory and
+* the cost of every operation scale with nonzeros() instead of
+* rows * cols. The compressed column (CSC) form is available through
+* to_csc().
+*/
+template<typename T>
+class SparseMatrix
+{
+public:
+	using value_type = T;
+	using allocator_type = std::pmr::polymorphic_allocator<T>;
+
+	// Element of the coordinate form
+	struct Triplet
+	{
+		std::size_t row;
+		std::size_t col;
+		T value;
+	};
+
+	// Compressed sparse column form, the same layout as CSR with the roles
+	// of rows and columns swapped. The rows of a column are sorted.
+	struct CSC
+	{
+		std::size_t rows;
+		std::size_t cols;
+		std::pmr::vector<std::size_t> col_offsets;
+		std::pmr::vector<std::size_t> row_indices;
+		std::pmr::vector<T> values;
+	};
+
+	// n x m zero matrix
+	explicit SparseMatrix(const std::size_t n, const std::size_t m,
+		const allocator_type& alloc = {}) :
+		rows_(n),
+		cols_(m),
+		offsets_(n + 1, 0, alloc),
+		indices_(alloc),
+		values_(alloc)
+	{}
+
+	// From the coordinate form in any order. Duplicates are summed, zeros
+	// are dropped.
+	SparseMatrix(const std::size_t n, const std::size_t m,
+		std::vector<Triplet> triplets, const allocator_type& alloc = {});
+
+	// Nonzeros of a dense Matrix
+	explicit SparseMatrix(const Matrix<T>& dense, const allocator_type& alloc = {});
+
+	// Back from the compressed column form
+	explicit SparseMatrix(const CSC& csc, const allocator_type& alloc = {});
+
+	// Dense copy, costs rows * cols
+	[[nodiscard]] Matrix<T> to_dense() const;
+
+	explicit operator Matrix<T>() const
+	{
+		return to_dense();
+	}
+
+	[[nodiscard]] CSC to_csc() const;
+
+	// The transpose is a new matrix, the CSR form can't be transposed in
+	// place
+	[[nodiscard]] SparseMatrix transpose() const;
+
+	// Element (i, j), found by binary search in row i
+	[[nodiscard]] T coeff(const std::size_t i, const std::size_t j) const;
+
+	// Only the stored elements are checked
+	[[nodiscard]] bool is_upper_triangular() const;
+	[[nodiscard]] bool is_lower_triangular() const;
+
+
+	// Products. The results use the allocator of the sparse operand.
+
+	// SpMV, A * x
+	template<typename U>
+	friend std::vector<U> operator*(const SparseMatrix<U>& lhs, const std::vector<U>& rhs);
+
+	// SpMM, sparse times dense and dense times sparse
+	template<typename U>
+	friend Matrix<U> operator*(const SparseMatrix<U>& lhs, const Matrix<U>& rhs);
+
+	template<typename U>
+	friend Matrix<U> operator*(const Matrix<U>& lhs, const SparseMatrix<U>& rhs);
+
+	// SpGEMM, the product of two sparse matrices is sparse
+	template<typename U>
+	friend SparseMatrix<U> operator*(const SparseMatrix<U>& lhs, const SparseMatrix<U>& rhs);
+
+	// The stored form is unique, so comparing it compares the matrices
+	friend bool operator==(const SparseMatrix& lhs, const SparseMatrix& rhs)
+	{
+		return lhs.size() == rhs.size() && lhs.offsets_ == rhs.offsets_ &&
+			lhs.indices_ == rhs.indices_ && lhs.values_ == rhs.values_;
+	}
+
+	friend bool operator!=(const SparseMatrix& lhs, const SparseMatrix& rhs)
+	{
+		return !(lhs == rhs);
+	}
+
+	// One "(i, j) value" line per nonzero
+	friend std::ostream& operator<<(std::ostream& os, const SparseMatrix& obj)
+	{
+		for (std::size_t i = 0; i < obj.rows_; ++i)
+		{
+			for (auto k = obj.offsets_[i]; k < obj.offsets_[i + 1]; ++k)
+			{
+				os << '(' << i << ", " << obj.indices_[k] << ") "
+					<< obj.values_[k] << '\n';
+			}
+		}
+		return os;
+	}
+
+	[[nodiscard]] std::pair<std::size_t, std::size_t> size() const noexcept
+	{
+		return { rows_, cols_ };
+	}
+
+	[[nodiscard]] std::size_t nonzeros() const noexcept
+	{
+		return values_.size();
+	}
+
+	[[nodiscard]] const std::pmr::vector<std::size_t>& row_offsets() const noexcept
+	{
+		return offsets_;
+	}
+
+	[[nodiscard]] const std::pmr::vector<std::size_t>& col_indices() const noexcept
+	{
+		return indices_;
+	}
+
+	[[nodiscard]] const std::pmr::vector<T>& values() const noexcept
+	{
+		return values_;
+	}
+
+	[[nodiscard]] allocator_type get_allocator() const noexcept
+	{
+		return values_.get_allocator();
+	}
+
+private:
+	std::size_t rows_;
+	std::size_t cols_;
+
+	// CSR arrays, offsets_ has rows_ + 1 entries
+	std::pmr::vector<std::size_t> offsets_;
+	std::pmr::vector<std::size_t> indices_;
+	std::pmr::vector<T> values_;
+
+	// Average number of nonzeros per row, the work per row of the kernels
+	[[nodiscard]] std::size_t row_cost() const noexcept
+	{
+		return std::max<std::size_t>(values_.size() / std::max<std::size_t>(rows_, 1), 1);
+	}
+
+	// Compresses the other dimension of a compressed n x m form, i.e.
+	// CSR to CSC or CSC to CSR, with a counting sort over the m minor
+	// indices. The output is sorted because the input is read in order.
+	template<typename Offsets, typename Indices, typename Values>
+	static void recompress(const std::size_t n, const std::size_t m,
+		const Offsets& offsets, const Indices& indices, const Values& values,
+		Offsets& out_offsets, Indices& out_indices, Values& out_values);
+};
+
+template<typename T>
+SparseMatrix<T>::SparseMatrix(const std::size_t n, const std::size_t m,
+	std::vector<Triplet> triplets, const allocator_type& alloc) :
+	SparseMatrix(n, m, alloc)
+{
+	std::sort(triplets.begin(), triplets.end(),
+		[](const Triplet& lhs, const Triplet& rhs)
+		{
+			return lhs.row < rhs.row || (lhs.row == rhs.row && lhs.col < rhs.col);
+		});
+
+	indices_.reserve(triplets.size());
+	values_.reserve(triplets.size());
+	for (std::size_t t = 0; t < triplets.size();)
+	{
+		const auto [i, j, first] = triplets[t];
+		assert(i < rows_ && j < cols_);
+
+		T sum = first;
+		for (++t; t < triplets.size() && triplets[t].row == i &&
+			triplets[t].col == j; ++t)
+		{
+			sum = sum + triplets[t].value;
+		}
+		if (sum == T(0)) continue;
+
+		indices_.push_back(j);
+		values_.push_back(sum);
+		++offsets_[i + 1];
+	}
+	std::partial_sum(offsets_.begin(), offsets_.end(), offsets_.begin());
+}
+
+template<typename T>
+SparseMatrix<T>::SparseMatrix(const Matrix<T>& dense, const allocator_type& alloc) :
+	SparseMatrix(dense.size().first, dense.size().second, alloc)
+{
+	for (std::size_t i = 0; i < rows_; ++i)
+	{
+		const T* row = dense.data() + i * dense.stride();
+		for (std::size_t j = 0; j < cols_; ++j)
+		{
+			if (row[j] == T(0)) continue;
+
+			indices_.push_back(j);
+			values_.push_back(row[j]);
+		}
+		offsets_[i + 1] = values_.size();
+	}
+}
+
+template<typename T>
+SparseMatrix<T>::SparseMatrix(const CSC& csc, const allocator_type& alloc) :
+	SparseMatrix(csc.rows, csc.cols, alloc)
+{
+	assert(csc.col_offsets.size() == cols_ + 1);
+	recompress(cols_, rows_, csc.col_offsets, csc.row_indices, csc.values,
+		offsets_, indices_, values_);
+}
+
+template<typename T>
+Matrix<T> SparseMatrix<T>::to_dense() const
+{
+	Matrix<T> result(rows_, cols_, get_allocator());
+	for (std::size_t i = 0; i < rows_; ++i)
+	{
+		T* row = result.data() + i * result.stride();
+		for (auto k = offsets_[i]; k < offsets_[i + 1]; ++k)
+		{
+			row[indices_[k]] = values_[k];
+		}
+	}
+	return result;
+}
+
+template<typename T>
+typename SparseMatrix<T>::CSC SparseMatrix<T>::to_csc() const
+{
+	CSC result{ rows_, cols_,
+		std::pmr::vector<std::size_t>(get_allocator()),
+		std::pmr::vector<std::size_t>(get_allocator()),
+		std::pmr::vector<T>(get_allocator()) };
+	recompress(rows_, cols_, offsets_, indices_, values_,
+		result.col_offsets, result.row_indices, result.values);
+	return result;
+}
+
+template<typename T>
+SparseMatrix<T> SparseMatrix<T>::transpose() const
+{
+	// The CSC arrays of A are the CSR arrays of A^T
+	SparseMatrix result(cols_, rows_, get_allocator());
+	recompress(rows_, cols_, offsets_, indices_, values_,
+		result.offsets_, result.indices_, result.values_);
+	return result;
+}
+
+template<typename T>
+T SparseMatrix<T>::coeff(const std::size_t i, const std::size_t j) const
+{
+	assert(i < rows_ && j < cols_);
+
+	const auto first = indices_.begin() + offsets_[i];
+	const auto last = indices_.begin() + offsets_[i + 1];
+	const auto it = std::lower_bound(first, last, j);
+	if (it == last || *it != j) return T(0);
+	return values_[it - indices_.begin()];
+}
+
+template<typename T>
+bool SparseMatrix<T>::is_upper_triangular() const
+{
+	// The first column of row i is the smallest
+	for (std::size_t i = 0; i < rows_; ++i)
+	{
+		if (offsets_[i] != offsets_[i + 1] && indices_[offsets_[i]] < i) return false;
+	}
+	return true;
+}
+
+template<typename T>
+bool SparseMatrix<T>::is_lower_triangular() const
+{
+	// The last column of row i is the largest
+	for (std::size_t i = 0; i < rows_; ++i)
+	{
+		if (offsets_[i] != offsets_[i + 1] && indices_[offsets_[i + 1] - 1] > i) return false;
+	}
+	return true;
+}
+
+template<typename T>
+template<typename Offsets, typename Indices, typename Values>
+void SparseMatrix<T>::recompress(const std::size_t n, const std::size_t m,
+	const Offsets& offsets, const Indices& indices, const Values& values,
+	Offsets& out_offsets, Indices& out_indices, Values& out_values)
+{
+	out_offsets.assign(m + 1, 0);
+	out_indices.resize(indices.size());
+	out_values.resize(values.size());
+
+	// Counts per minor index, shifted by one for the prefix sum
+	for (const auto j : indices) ++out_offsets[j + 1];
+	std::partial_sum(out_offsets.begin(), out_offsets.end(), out_offsets.begin());
+
+	// Next free slot of every minor index
+	std::pmr::vector<std::size_t> next(out_offsets.begin(), out_offsets.end() - 1,
+		MatrixScratch::resource());
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		for (auto k = offsets[i]; k < offsets[i + 1]; ++k)
+		{
+			const auto slot = next[indices[k]]++;
+			out_indices[slot] = i;
+			out_values[slot] = values[k];
+		}
+	}
+}
+
+template<typename U>
+std::vector<U> operator*(const SparseMatrix<U>& lhs, const std::vector<U>& rhs)
+{
+	assert(lhs.cols_ == rhs.size());
+
+	std::vector<U> result(lhs.rows_);
+	VectorOperations::for_ranges(lhs.rows_, lhs.row_cost(),
+		[&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				U sum(0);
+				for (auto k = lhs.offsets_[i]; k < lhs.offsets_[i + 1]; ++k)
+				{
+					sum = sum + lhs.values_[k] * rhs[lhs.indices_[k]];
+				}
+				result[i] = sum;
+			}
+		});
+	return result;
+}
+
+template<typename U>
+Matrix<U> operator*(const SparseMatrix<U>& lhs, const Matrix<U>& rhs)
+{
+	assert(lhs.cols_ == rhs.size().first);
+
+	// Row i of the result combines the rows of rhs picked by row i of lhs
+	const auto n = rhs.size().second;
+	Matrix<U> result(lhs.rows_, n, lhs.get_allocator());
+	VectorOperations::for_ranges(lhs.rows_, lhs.row_cost() * n,
+		[&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				U* dst = result.data() + i * result.stride();
+				for (auto k = lhs.offsets_[i]; k < lhs.offsets_[i + 1]; ++k)
+				{
+					VectorOperations::axpy(dst, lhs.values_[k],
+						rhs.data() + lhs.indices_[k] * rhs.stride(), n);
+				}
+			}
+		});
+	return result;
+}
+
+template<typename U>
+Matrix<U> operator*(const Matrix<U>& lhs, const SparseMatrix<U>& rhs)
+{
+	assert(lhs.size().second == rhs.rows_);
+
+	// Row i of the result combines the rows of rhs weighted by row i of
+	// lhs, zeros of lhs skip a whole sparse row
+	const auto m = lhs.size().first;
+	Matrix<U> result(m, rhs.cols_, rhs.get_allocator());
+	VectorOperations::for_ranges(m, lhs.size().second + rhs.nonzeros(),
+		[&](const std::size_t begin, const std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				const U* a = lhs.data() + i * lhs.stride();
+				U* dst = result.data() + i * result.stride();
+				for (std::size_t p = 0; p < rhs.rows_; ++p)
+				{
+					if (a[p] == U(0)) continue;
+
+					for (auto k = rhs.offsets_[p]; k < rhs.offsets_[p + 1]; ++k)
+					{
+						dst[rhs.indices_[k]] = dst[rhs.indices_[k]] +
+							a[p] * rhs.values_[k];
+					}
+				}
+			}
+		});
+	return result;
+}
+
+/*
+* Gustavson's row-by-row product. A symbolic pass counts the columns of
+* every result row, so the numeric pass can write the rows in parallel
+* into their final slots. Both passes use a dense accumulator and marker
+* over the columns, taken once per range of rows. Entries that cancel to
+* zero are removed at the end.
+*/
+template<typename U>
+SparseMatrix<U> operator*(const SparseMatrix<U>& lhs, const SparseMatrix<U>& rhs)
+{
+	assert(lhs.cols_ == rhs.rows_);
+
+	constexpr auto unmarked = std::numeric_limits<std::size_t>::max();
+	const auto n = rhs.cols_;
+	const auto cost = lhs.row_cost() * rhs.row_cost();
+
+	SparseMatrix<U> result(lhs.rows_, n, lhs.get_allocator());
+	auto& offsets = result.offsets_;
+
+	VectorOperations::for_ranges(lhs.rows_, cost,
+		[&](const std::size_t begin, const std::size_t end)
+		{
+			std::pmr::vector<std::size_t> marker(n, unmarked, MatrixScratch::resource());
+			for (auto i = begin; i < end; ++i)
+			{
+				std::size_t count = 0;
+				for (auto k = lhs.offsets_[i]; k < lhs.offsets_[i + 1]; ++k)
+				{
+					const auto p = lhs.indices_[k];
+					for (auto q = rhs.offsets_[p]; q < rhs.offsets_[p + 1]; ++q)
+					{
+						if (marker[rhs.indices_[q]] == i) continue;
+						marker[rhs.indices_[q]] = i;
+						++count;
+					}
+				}
+				offsets[i + 1] = count;
+			}
+		});
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+	auto& indices = result.indices_;
+	auto& values = result.values_;
+	indices.resize(offsets.back());
+	values.resize(offsets.back());
+
+	VectorOperations::for_ranges(lhs.rows_, cost,
+		[&](const std::size_t begin, const std::size_t end)
+		{
+			std::pmr::vector<std::size_t> marker(n, unmarked, MatrixScratch::resource());
+			std::pmr::vector<U> accumulator(n, U(0), MatrixScratch::resource());
+			for (auto i = begin; i < end; ++i)
+			{
+				auto slot = offsets[i];
+				for (auto k = lhs.offsets_[i]; k < lhs.offsets_[i + 1]; ++k)
+				{
+					const auto p = lhs.indices_[k];
+					const auto a = lhs.values_[k];
+					for (auto q = rhs.offsets_[p]; q < rhs.offsets_[p + 1]; ++q)
+					{
+						const auto j = rhs.indices_[q];
+						if (marker[j] != i)
+						{
+							marker[j] = i;
+							indices[slot++] = j;
+							accumulator[j] = a * rhs.values_[q];
+						}
+						else
+						{
+							accumulator[j] = accumulator[j] + a * rhs.values_[q];
+						}
+					}
+				}
+
+				std::sort(indices.begin() + offsets[i], indices.begin() + slot);
+				for (auto s = offsets[i]; s < slot; ++s)
+				{
+					values[s] = accumulator[indices[s]];
+				}
+			}
+		});
+
+	// Drop the cancelled entries, the rows only move towards the front
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < result.rows_; ++i)
+	{
+		const auto first = offsets[i];
+		offsets[i] = kept;
+		for (auto s = first; s < offsets[i + 1]; ++s)
+		{
+			if (values[s] == U(0)) continue;
+			indices[kept] = indices[s];
+			values[kept] = values[s];
+			++kept;
+		}
+	}
+	offsets.back() = kept;
+	indices.resize(kept);
+	values.resize(kept);
+
+	return result;
+}